@@ -7,8 +7,20 @@
 #define CFLAGS "-Wall", "-Wextra", "-Wswitch-enum", "-Wmissing-prototypes", "-Wconversion", "-Wno-missing-braces", "-pedantic", "-fno-strict-aliasing", "-ggdb", "-std=c11"
 #endif
 
+#ifdef _WIN32
+#define EXE_EXT ".exe"
+#define OBJ_EXT ".obj"
+#define LIBBM PATH("build", "library", "bm.lib")
+#else
+#define EXE_EXT ""
+#define OBJ_EXT ".o"
+#define LIBBM PATH("build", "library", "libbm.a")
+#endif // _WIN32
+
+#define TOOL_EXE(name) PATH("build", "toolchain", CONCAT(name, EXE_EXT))
+
 const char *toolchain[] = {
-    "basm", "bme", "bmr", "debasm", "bdb", "basm2nasm", "expr2dot"
+    "basm", "bme", "bmr", "debasm", "bdb", "basm2nasm", "expr2dot", "basmgen"
 };
 
 void build_c_file(const char *input_path, const char *output_path)
@@ -27,7 +39,7 @@ void build_c_file(const char *input_path, const char *output_path)
 void build_tool(const char *name)
 {
 #ifdef _WIN32
-    CMD("cl.exe", CFLAGS,
+    JOB("cl.exe", CFLAGS,
         "/Fe.\\build\\toolchain\\",
         "/Fo.\\build\\toolchain\\",
         "/I", PATH("src", "library"),
@@ -40,7 +52,7 @@ void build_tool(const char *name)
         cc = "cc";
     }
 
-    CMD(cc, CFLAGS, 
+    JOB(cc, CFLAGS, "-pthread",
         "-o", PATH("build", "toolchain", name),
         "-I", PATH("src", "library"),
         "-L", PATH("build", "library"),
@@ -49,32 +61,300 @@ void build_tool(const char *name)
 #endif // _WIN32
 }
 
+// NOTE: the changes in the headers of the library rebuild the library,
+// so the tools depend only on their sources and the library itself
 void build_toolchain(void)
 {
-    RM(PATH("build", "toolchain"));
     MKDIRS("build", "toolchain");
 
     FOREACH_FILE_IN_DIR(file, PATH("src", "toolchain"), {
-        if (ENDS_WITH(file, ".c")) {
+        if (ENDS_WITH(file, ".c") &&
+                NEEDS_REBUILD(TOOL_EXE(NOEXT(file)), PATH("src", "toolchain", file), LIBBM)) {
             build_tool(NOEXT(file));
         }
     });
+
+    JOBS_WAIT();
 }
 
-void build_examples(void)
+// NOTE: the benchmarks are compiled together with the sources of the
+// library, so both of them are optimized the same way
+void build_bench(const char *name)
 {
-    RM(PATH("build", "examples"));
-    MKDIRS("build", "examples");
+#ifdef _WIN32
+    CMD("cl.exe", CFLAGS,
+        "/Fe.\\build\\bench\\",
+        "/Fo.\\build\\bench\\",
+        "/I", PATH("src", "library"),
+        PATH("src", "bench", CONCAT(name, ".c")),
+        PATH("src", "library", "arena.c"),
+        PATH("src", "library", "basm.c"),
+        PATH("src", "library", "bm.c"),
+        PATH("src", "library", "optimizer.c"),
+        PATH("src", "library", "verifier.c"),
+        PATH("src", "library", "sv.c"));
+#else
+    const char *cc = getenv("CC");
+    if (cc == NULL) {
+        cc = "cc";
+    }
 
-    FOREACH_FILE_IN_DIR(example, "examples", {
+    CMD(cc, CFLAGS, "-O2",
+        "-o", PATH("build", "bench", name),
+        "-I", PATH("src", "library"),
+        PATH("src", "bench", CONCAT(name, ".c")),
+        PATH("src", "library", "arena.c"),
+        PATH("src", "library", "basm.c"),
+        PATH("src", "library", "bm.c"),
+        PATH("src", "library", "optimizer.c"),
+        PATH("src", "library", "verifier.c"),
+        PATH("src", "library", "sv.c"));
+#endif // _WIN32
+}
+
+void bench_command(void)
+{
+    MKDIRS("build", "bench");
+
+    FOREACH_FILE_IN_DIR(file, PATH("src", "bench"), {
+        if (ENDS_WITH(file, ".c")) {
+            build_bench(NOEXT(file));
+            CMD(PATH("build", "bench", NOEXT(file)));
+        }
+    });
+}
+
+// Checks the dependency file <output>.d written by `basm -MD`. The
+// output is also rebuilt when basm itself changes.
+int assembly_needs_rebuild(const char *output)
+{
+    if (NEEDS_REBUILD(output, TOOL_EXE("basm"))) {
+        return 1;
+    }
+
+    FILE *deps = fopen(CONCAT(output, ".d"), "r");
+    if (deps == NULL) {
+        return 1;
+    }
+
+    // Skip the target
+    int x = fgetc(deps);
+    while (x != EOF && x != '\n') {
+        x = fgetc(deps);
+    }
+
+    int result = 0;
+    char dep[4096];
+    size_t dep_size = 0;
+    while (x != EOF) {
+        x = fgetc(deps);
+        if (x == '\\') {
+            x = fgetc(deps);
+            if (x == ' ' && dep_size + 1 < sizeof(dep)) {
+                dep[dep_size++] = ' ';
+            }
+        } else if (x == EOF || x == ' ' || x == '\n') {
+            if (dep_size > 0) {
+                dep[dep_size] = '\0';
+                if (NEEDS_REBUILD(output, dep)) {
+                    result = 1;
+                }
+                dep_size = 0;
+            }
+        } else if (dep_size + 1 < sizeof(dep)) {
+            dep[dep_size++] = (char) x;
+        }
+    }
+
+    fclose(deps);
+    return result;
+}
+
+// NOTE: the synthetic programs are too big for the VM to run them, so
+// only the assembler is measured. basm -time-report prints the lines
+// per second and the peak memory.
+void bench_basm_command(void)
+{
+    const char *sizes[] = {"10000", "100000", "1000000"};
+
+    FOREACH_ARRAY(const char *, lines, sizes, {
+        const char *dir = PATH("build", "bench-basm", lines);
+        MKDIRS("build", "bench-basm", lines);
+        CMD(PATH("build", "toolchain", "basmgen"), "-lines", lines, dir);
+        CMD(PATH("build", "toolchain", "basm"),
+            "-time-report",
+            PATH(dir, "main.basm"),
+            PATH(dir, "main.bm"));
+    });
+}
+
+// NOTE: the examples in examples/linked/ are assembled separately into
+// object files and linked with natives.hasm by bmld
+void assemble_linked_examples(void)
+{
+    const char *natives = PATH("build", "examples", "natives.bo");
+    if (assembly_needs_rebuild(natives)) {
+        JOB(PATH("build", "toolchain", "basm"),
+            "-c", "-MD",
+            PATH("examples", "natives.hasm"),
+            natives);
+    }
+
+    FOREACH_FILE_IN_DIR(example, PATH("examples", "linked"), {
+        if (ENDS_WITH(example, ".basm"))
+        {
+            const char *object = PATH("build", "examples", CONCAT("linked-", NOEXT(example), ".bo"));
+            if (assembly_needs_rebuild(object)) {
+                JOB(PATH("build", "toolchain", "basm"),
+                    "-c", "-MD",
+                    PATH("examples", "linked", example),
+                    object);
+            }
+        }
+    });
+}
+
+void link_linked_examples(void)
+{
+    const char *natives = PATH("build", "examples", "natives.bo");
+
+    FOREACH_FILE_IN_DIR(example, PATH("examples", "linked"), {
         if (ENDS_WITH(example, ".basm"))
         {
-            CMD(PATH("build", "toolchain", "basm"),
-                "-g",
-                PATH("examples", example),
-                PATH("build", "examples", CONCAT(NOEXT(example), ".bm")));
+            const char *example_base = NOEXT(example);
+            const char *object = PATH("build", "examples", CONCAT("linked-", example_base, ".bo"));
+            const char *program = PATH("build", "examples", CONCAT("linked-", example_base, ".bm"));
+            if (NEEDS_REBUILD(program, object, natives, TOOL_EXE("bmld"))) {
+                JOB(PATH("build", "toolchain", "bmld"),
+                    "-g",
+                    "-o", program,
+                    object,
+                    natives);
+            }
+        }
+    });
+}
+
+// NOTE: the examples in examples/dynamic/ import the functions of
+// natives.hasm from the shared module libnatives.bm at runtime
+void assemble_dynamic_examples(void)
+{
+    FOREACH_FILE_IN_DIR(example, PATH("examples", "dynamic"), {
+        if (ENDS_WITH(example, ".basm"))
+        {
+            const char *object = PATH("build", "examples", CONCAT("dynamic-", NOEXT(example), ".bo"));
+            if (assembly_needs_rebuild(object)) {
+                JOB(PATH("build", "toolchain", "basm"),
+                    "-c", "-MD",
+                    PATH("examples", "dynamic", example),
+                    object);
+            }
+        }
+    });
+}
+
+void link_dynamic_examples(void)
+{
+    const char *natives = PATH("build", "examples", "natives.bo");
+    const char *module = PATH("build", "examples", "libnatives.bm");
+    if (NEEDS_REBUILD(module, natives, TOOL_EXE("bmld"))) {
+        CMD(PATH("build", "toolchain", "bmld"),
+            "-shared",
+            "-o", module,
+            natives);
+    }
+
+    FOREACH_FILE_IN_DIR(example, PATH("examples", "dynamic"), {
+        if (ENDS_WITH(example, ".basm"))
+        {
+            const char *example_base = NOEXT(example);
+            const char *object = PATH("build", "examples", CONCAT("dynamic-", example_base, ".bo"));
+            const char *program = PATH("build", "examples", CONCAT("dynamic-", example_base, ".bm"));
+            if (NEEDS_REBUILD(program, object, module, TOOL_EXE("bmld"))) {
+                JOB(PATH("build", "toolchain", "bmld"),
+                    "-g",
+                    "-m", module,
+                    "-o", program,
+                    object);
+            }
+        }
+    });
+}
+
+// NOTE: bme prints the output of the example while profiling it, so
+// only the example with the short output is profiled
+void build_profiled_examples(void)
+{
+    const char *profile = PATH("build", "examples", "rot13.prof");
+    const char *program = PATH("build", "examples", "profiled-rot13.bm");
+    if (NEEDS_REBUILD(profile, PATH("build", "examples", "rot13.bm"), TOOL_EXE("bme"))) {
+        CMD(PATH("build", "toolchain", "bme"),
+            "-i", PATH("build", "examples", "rot13.bm"),
+            "-prof", profile);
+    }
+    if (assembly_needs_rebuild(program) || NEEDS_REBUILD(program, profile)) {
+        JOB(PATH("build", "toolchain", "basm"),
+            "-g", "-MD", CONCAT("-fprofile-use=", profile),
+            PATH("examples", "rot13.basm"),
+            program);
+    }
+}
+
+// Lists the examples that are out of date for a single batch invocation
+// of basm, so the includes shared by the examples are read only once.
+// Returns the amount of the listed examples.
+int write_examples_manifest(const char *manifest_path, const char *prefix)
+{
+    FILE *manifest = fopen(manifest_path, "w");
+    if (manifest == NULL) {
+        ERRO("could not open file %s: %s", manifest_path, strerror(errno));
+        exit(1);
+    }
+
+    int count = 0;
+    FOREACH_FILE_IN_DIR(example, "examples", {
+        const char *output = PATH("build", "examples", CONCAT(prefix, NOEXT(example), ".bm"));
+        if (ENDS_WITH(example, ".basm") && assembly_needs_rebuild(output))
+        {
+            fprintf(manifest, "%s:%s\n", PATH("examples", example), output);
+            count += 1;
         }
     });
+
+    fclose(manifest);
+    return count;
+}
+
+// NOTE: the batches of basm are the bulk of the work, so each of them
+// runs as many threads as there are job slots
+void build_examples(void)
+{
+    MKDIRS("build", "examples");
+
+    char batch_jobs[32];
+    snprintf(batch_jobs, sizeof(batch_jobs), "%zu", jobs_slots());
+
+    if (write_examples_manifest(PATH("build", "examples", "examples.txt"), "") > 0) {
+        JOB(PATH("build", "toolchain", "basm"),
+            "-g", "-MD", "-j", batch_jobs,
+            "-m", PATH("build", "examples", "examples.txt"));
+    }
+
+    // NOTE: the optimized examples are expected to produce the same output
+    if (write_examples_manifest(PATH("build", "examples", "optimized.txt"), "optimized-") > 0) {
+        JOB(PATH("build", "toolchain", "basm"),
+            "-g", "-O", "-MD", "-j", batch_jobs,
+            "-m", PATH("build", "examples", "optimized.txt"));
+    }
+
+    assemble_linked_examples();
+    assemble_dynamic_examples();
+    JOBS_WAIT();
+
+    link_linked_examples();
+    link_dynamic_examples();
+    build_profiled_examples();
+    JOBS_WAIT();
 }
 
 void build_x86_64_example(const char *example)
@@ -105,20 +385,71 @@ void run_tests(void)
         if (ENDS_WITH(example, ".basm"))
         {
             const char *example_base = NOEXT(example);
-            CMD(PATH("build", "toolchain", "bmr"),
+            JOB(PATH("build", "toolchain", "bmr"),
+                "-p", PATH("build", "examples", CONCAT(example_base, ".bm")),
+                "-eo", PATH("test", "examples", CONCAT(example_base, ".expected.out")));
+            JOB(PATH("build", "toolchain", "bmr"),
+                "-p", PATH("build", "examples", CONCAT("optimized-", example_base, ".bm")),
+                "-eo", PATH("test", "examples", CONCAT(example_base, ".expected.out")));
+        }
+    });
+
+    JOB(PATH("build", "toolchain", "bmr"),
+        "-p", PATH("build", "examples", "profiled-rot13.bm"),
+        "-eo", PATH("test", "examples", "rot13.expected.out"));
+
+    FOREACH_FILE_IN_DIR(example, PATH("examples", "linked"), {
+        if (ENDS_WITH(example, ".basm"))
+        {
+            const char *example_base = CONCAT("linked-", NOEXT(example));
+            JOB(PATH("build", "toolchain", "bmr"),
                 "-p", PATH("build", "examples", CONCAT(example_base, ".bm")),
                 "-eo", PATH("test", "examples", CONCAT(example_base, ".expected.out")));
         }
     });
+
+    FOREACH_FILE_IN_DIR(example, PATH("examples", "dynamic"), {
+        if (ENDS_WITH(example, ".basm"))
+        {
+            const char *example_base = CONCAT("dynamic-", NOEXT(example));
+            JOB(PATH("build", "toolchain", "bmr"),
+                "-p", PATH("build", "examples", CONCAT(example_base, ".bm")),
+                "-eo", PATH("test", "examples", CONCAT(example_base, ".expected.out")));
+        }
+    });
+
+    JOBS_WAIT();
 }
 
+// NOTE: the optimized and the profiled examples are expected to print
+// the same as the original ones, so they are not recorded
 void record_tests(void)
 {
     FOREACH_FILE_IN_DIR(example, "examples", {
         if (ENDS_WITH(example, ".basm"))
         {
             const char *example_base = NOEXT(example);
-            CMD(PATH("build", "bin", "bmr"),
+            CMD(PATH("build", "toolchain", "bmr"),
+                "-p", PATH("build", "examples", CONCAT(example_base, ".bm")),
+                "-ao", PATH("test", "examples", CONCAT(example_base, ".expected.out")));
+        }
+    });
+
+    FOREACH_FILE_IN_DIR(example, PATH("examples", "linked"), {
+        if (ENDS_WITH(example, ".basm"))
+        {
+            const char *example_base = CONCAT("linked-", NOEXT(example));
+            CMD(PATH("build", "toolchain", "bmr"),
+                "-p", PATH("build", "examples", CONCAT(example_base, ".bm")),
+                "-ao", PATH("test", "examples", CONCAT(example_base, ".expected.out")));
+        }
+    });
+
+    FOREACH_FILE_IN_DIR(example, PATH("examples", "dynamic"), {
+        if (ENDS_WITH(example, ".basm"))
+        {
+            const char *example_base = CONCAT("dynamic-", NOEXT(example));
+            CMD(PATH("build", "toolchain", "bmr"),
                 "-p", PATH("build", "examples", CONCAT(example_base, ".bm")),
                 "-ao", PATH("test", "examples", CONCAT(example_base, ".expected.out")));
         }
@@ -154,11 +485,11 @@ void help_command(void)
 void build_lib_object(const char *name)
 {
 #ifdef _WIN32
-    CMD("cl.exe", CFLAGS, "/c",
+    JOB("cl.exe", CFLAGS, "/c",
         PATH("src", "library", CONCAT(name, ".c")),
         "/Fo.\\build\\library\\");
 #else
-    CMD("cc", CFLAGS, "-c", 
+    JOB("cc", CFLAGS, "-c", 
         PATH("src", "library", CONCAT(name, ".c")),
         "-o", PATH("build", "library", CONCAT(name, ".o")));
 #endif // _WIN32
@@ -172,6 +503,8 @@ void link_lib_objects(void)
         PATH("build", "library", "arena.obj"), 
         PATH("build", "library", "basm.obj"), 
         PATH("build", "library", "bm.obj"), 
+        PATH("build", "library", "optimizer.obj"), 
+        PATH("build", "library", "verifier.obj"), 
         PATH("build", "library", "sv.obj"));
 #else
     CMD("ar", "-crs", 
@@ -179,21 +512,52 @@ void link_lib_objects(void)
         PATH("build", "library", "arena.o"), 
         PATH("build", "library", "basm.o"), 
         PATH("build", "library", "bm.o"), 
+        PATH("build", "library", "optimizer.o"), 
+        PATH("build", "library", "verifier.o"), 
         PATH("build", "library", "sv.o"));
 #endif // _WIN32
 }
 
+// NOTE: every object of the library depends on all of its headers
+int lib_object_needs_rebuild(const char *name)
+{
+    const char *object = PATH("build", "library", CONCAT(name, OBJ_EXT));
+    int result = NEEDS_REBUILD(object, PATH("src", "library", CONCAT(name, ".c")));
+
+    FOREACH_FILE_IN_DIR(file, PATH("src", "library"), {
+        if (ENDS_WITH(file, ".h") && NEEDS_REBUILD(object, PATH("src", "library", file))) {
+            result = 1;
+        }
+    });
+
+    return result;
+}
+
 void lib_command(void)
 {
     MKDIRS("build", "library");
-    
+
+    int relink = 0;
     FOREACH_FILE_IN_DIR(file, PATH("src", "library"), {
         if (ENDS_WITH(file, ".c")) {
-            build_lib_object(NOEXT(file));
+            if (lib_object_needs_rebuild(NOEXT(file))) {
+                build_lib_object(NOEXT(file));
+            }
         }
     });
-    
-    link_lib_objects();
+
+    JOBS_WAIT();
+
+    FOREACH_FILE_IN_DIR(file, PATH("src", "library"), {
+        if (ENDS_WITH(file, ".c") &&
+                NEEDS_REBUILD(LIBBM, PATH("build", "library", CONCAT(NOEXT(file), OBJ_EXT)))) {
+            relink = 1;
+        }
+    });
+
+    if (relink) {
+        link_lib_objects();
+    }
 }
 
 void all_command(void)
@@ -251,6 +615,16 @@ Command commands[] = {
         .description = "Build the BM library (experimental)",
         .run = lib_command,
     },
+    {
+        .name = "bench",
+        .description = "Build and run the micro-benchmarks of the library",
+        .run = bench_command,
+    },
+    {
+        .name = "bench-basm",
+        .description = "Measure the throughput of basm on the generated programs of 10k, 100k and 1M lines",
+        .run = bench_basm_command,
+    },
 };
 size_t commands_size = sizeof(commands) / sizeof(commands[0]);
 
@@ -154,13 +154,31 @@
         cmd_impl(69, __VA_ARGS__, NULL);                        \
     } while(0)
 
+// Starts the command in the background as soon as one of the job slots
+// is free. There are as many slots as CPUs unless the NOBUILD_JOBS
+// environment variable says otherwise. Any failed job fails the build.
+#define JOB(...)                                                \
+    do {                                                        \
+        INFO(JOIN(" ", __VA_ARGS__));                           \
+        job_impl(69, __VA_ARGS__, NULL);                        \
+    } while(0)
+
+// Waits for all of the started jobs
+#define JOBS_WAIT() jobs_wait()
+
 const char *concat_impl(int ignore, ...);
 const char *concat_sep_impl(const char *sep, ...);
 const char *build__join(const char *sep, ...);
 int nobuild__ends_with(const char *str, const char *postfix);
 int nobuild__is_dir(const char *path);
+unsigned long long nobuild__mtime(const char *path);
+int needs_rebuild_impl(const char *output, ...);
 void mkdirs_impl(int ignore, ...);
 void cmd_impl(int ignore, ...);
+void job_impl(int ignore, ...);
+void jobs_wait(void);
+size_t jobs_slots(void);
+void nobuild__wait_job(void);
 void nobuild_exec(const char **argv);
 const char *remove_ext(const char *path);
 char *shift(int *argc, char ***argv);
@@ -174,6 +192,9 @@ void nobuild__rm(const char *path);
 #define NOEXT(path) nobuild__remove_ext(path)
 #define ENDS_WITH(str, postfix) nobuild__ends_with(str, postfix)
 #define IS_DIR(path) nobuild__is_dir(path)
+// Checks if the output does not exist or any of the inputs has been
+// modified after it
+#define NEEDS_REBUILD(output, ...) needs_rebuild_impl(output, __VA_ARGS__, NULL)
 #define RM(path)                                \
     do {                                        \
         INFO("rm %s", path);                    \
@@ -476,7 +497,10 @@ void nobuild_exec(const char **argv)
     } else {
         for (;;) {
             int wstatus = 0;
-            wait(&wstatus);
+            if (waitpid(cpid, &wstatus, 0) < 0) {
+                ERRO("could not wait on command (pid %d): %s", cpid, strerror(errno));
+                exit(1);
+            }
 
             if (WIFEXITED(wstatus)) {
                 int exit_status = WEXITSTATUS(wstatus);
@@ -519,6 +543,163 @@ void cmd_impl(int ignore, ...)
     nobuild_exec(argv);
 }
 
+#define NOBUILD_JOBS_CAPACITY 256
+
+#ifdef _WIN32
+typedef intptr_t Nobuild_Pid;
+#else
+typedef pid_t Nobuild_Pid;
+#endif // _WIN32
+
+Nobuild_Pid nobuild__jobs[NOBUILD_JOBS_CAPACITY];
+size_t nobuild__jobs_count = 0;
+
+size_t jobs_slots(void)
+{
+    long slots = 0;
+
+    const char *jobs = getenv("NOBUILD_JOBS");
+    if (jobs != NULL) {
+        slots = strtol(jobs, NULL, 10);
+    }
+
+    if (slots <= 0) {
+#ifdef _WIN32
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        slots = (long) info.dwNumberOfProcessors;
+#else
+        slots = sysconf(_SC_NPROCESSORS_ONLN);
+#endif // _WIN32
+    }
+
+    if (slots <= 0) {
+        slots = 1;
+    }
+
+    if (slots > NOBUILD_JOBS_CAPACITY) {
+        slots = NOBUILD_JOBS_CAPACITY;
+    }
+
+    return (size_t) slots;
+}
+
+// Waits for any of the started jobs to finish
+void nobuild__wait_job(void)
+{
+    assert(nobuild__jobs_count > 0);
+
+#ifdef _WIN32
+    // NOTE: _cwait() can't wait for any of the processes, so the jobs
+    // are waited for in the order they were started
+    int status = 0;
+    if (_cwait(&status, nobuild__jobs[0], _WAIT_CHILD) < 0) {
+        ERRO("could not wait on job: %s", strerror(errno));
+        exit(1);
+    }
+
+    nobuild__jobs_count -= 1;
+    memmove(nobuild__jobs, nobuild__jobs + 1, nobuild__jobs_count * sizeof(nobuild__jobs[0]));
+
+    if (status != 0) {
+        ERRO("job exited with exit code %d", status);
+        exit(1);
+    }
+#else
+    for (;;) {
+        int wstatus = 0;
+        const pid_t pid = waitpid(-1, &wstatus, 0);
+        if (pid < 0) {
+            ERRO("could not wait on job: %s", strerror(errno));
+            exit(1);
+        }
+
+        if (!WIFEXITED(wstatus) && !WIFSIGNALED(wstatus)) {
+            continue;
+        }
+
+        size_t index = 0;
+        while (index < nobuild__jobs_count && nobuild__jobs[index] != pid) {
+            index += 1;
+        }
+
+        if (index == nobuild__jobs_count) {
+            continue;
+        }
+
+        nobuild__jobs[index] = nobuild__jobs[--nobuild__jobs_count];
+
+        if (WIFSIGNALED(wstatus)) {
+            ERRO("job process was terminated by signal %d", WTERMSIG(wstatus));
+            exit(1);
+        }
+
+        const int exit_status = WEXITSTATUS(wstatus);
+        if (exit_status != 0) {
+            ERRO("job exited with exit code %d", exit_status);
+            exit(1);
+        }
+
+        return;
+    }
+#endif // _WIN32
+}
+
+void job_impl(int ignore, ...)
+{
+    size_t argc = 0;
+
+    va_list args;
+    FOREACH_VARGS(ignore, arg, args, {
+        argc += 1;
+    });
+
+    const char **argv = malloc(sizeof(const char*) * (argc + 1));
+
+    argc = 0;
+    FOREACH_VARGS(ignore, arg, args, {
+        argv[argc++] = arg;
+    });
+    argv[argc] = NULL;
+
+    assert(argc >= 1);
+
+    while (nobuild__jobs_count >= jobs_slots()) {
+        nobuild__wait_job();
+    }
+
+#ifdef _WIN32
+    const intptr_t pid = _spawnvp(_P_NOWAIT, argv[0], (char * const*) argv);
+    if (pid < 0) {
+        ERRO("could not start child process: %s", strerror(errno));
+        exit(1);
+    }
+#else
+    const pid_t pid = fork();
+    if (pid == -1) {
+        ERRO("could not fork a child process: %s", strerror(errno));
+        exit(1);
+    }
+
+    if (pid == 0) {
+        if (execvp(argv[0], (char * const*) argv) < 0) {
+            ERRO("could not execute child process: %s", strerror(errno));
+            exit(1);
+        }
+    }
+#endif // _WIN32
+
+    nobuild__jobs[nobuild__jobs_count++] = pid;
+    free(argv);
+}
+
+void jobs_wait(void)
+{
+    while (nobuild__jobs_count > 0) {
+        nobuild__wait_job();
+    }
+}
+
 const char *nobuild__remove_ext(const char *path)
 {
     size_t n = strlen(path);
@@ -621,6 +802,66 @@ int nobuild__is_dir(const char *path)
 #endif // _WIN32
 }
 
+// Returns 0 if the file does not exist
+unsigned long long nobuild__mtime(const char *path)
+{
+#ifdef _WIN32
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if (!GetFileAttributesEx(path, GetFileExInfoStandard, &data)) {
+        if (GetLastError() == ERROR_FILE_NOT_FOUND || GetLastError() == ERROR_PATH_NOT_FOUND) {
+            return 0;
+        }
+
+        ERRO("could not retrieve information about file %s: %lu",
+             path, GetLastError());
+        exit(1);
+    }
+
+    return ((unsigned long long) data.ftLastWriteTime.dwHighDateTime << 32) |
+           data.ftLastWriteTime.dwLowDateTime;
+#else
+    struct stat statbuf = {0};
+    if (stat(path, &statbuf) < 0) {
+        if (errno == ENOENT) {
+            return 0;
+        }
+
+        ERRO("could not retrieve information about file %s: %s",
+             path, strerror(errno));
+        exit(1);
+    }
+
+#ifdef __linux__
+    return (unsigned long long) statbuf.st_mtim.tv_sec * 1000000000ULL +
+           (unsigned long long) statbuf.st_mtim.tv_nsec;
+#else
+    return (unsigned long long) statbuf.st_mtime;
+#endif // __linux__
+#endif // _WIN32
+}
+
+int needs_rebuild_impl(const char *output, ...)
+{
+    const unsigned long long output_mtime = nobuild__mtime(output);
+    if (output_mtime == 0) {
+        return 1;
+    }
+
+    // NOTE: the inputs modified at the same time are considered newer, so
+    // the output is rebuilt rather than left stale on the systems that
+    // report the time in seconds
+    int result = 0;
+    va_list args;
+    FOREACH_VARGS(output, input, args, {
+        const unsigned long long input_mtime = nobuild__mtime(input);
+        if (input_mtime == 0 || input_mtime >= output_mtime) {
+            result = 1;
+        }
+    });
+
+    return result;
+}
+
 void nobuild__rm(const char *path)
 {
     if (IS_DIR(path)) {
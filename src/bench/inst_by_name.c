@@ -0,0 +1,93 @@
+// Micro-benchmark of the mnemonic lookup of basm.
+//
+// Generates a synthetic source with 1M instructions and measures
+// inst_by_name() against the linear search it replaced, and the whole
+// basm_translate_source() on that source.
+#include <time.h>
+
+#include "./bm.h"
+#include "./basm.h"
+
+#define BENCH_LINES (1000 * 1000)
+#define BENCH_SOURCE_PATH "./build/bench/inst_by_name.basm"
+
+// NOTE: the implementation of inst_by_name() before the perfect hash
+static bool inst_by_name_linear(String_View name, Inst_Type *output)
+{
+    for (Inst_Type type = (Inst_Type) 0; type < NUMBER_OF_INSTS; type += 1) {
+        if (sv_eq(sv_from_cstr(inst_name(type)), name)) {
+            *output = type;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static double seconds_since(clock_t start)
+{
+    return (double) (clock() - start) / CLOCKS_PER_SEC;
+}
+
+static void generate_source(const char *file_path)
+{
+    FILE *f = fopen(file_path, "w");
+    if (f == NULL) {
+        fprintf(stderr, "ERROR: could not open file `%s`: %s\n",
+                file_path, strerror(errno));
+        exit(1);
+    }
+
+    fprintf(f, "main:\n");
+    for (size_t i = 0; i < BENCH_LINES; ++i) {
+        const Inst_Type type = (Inst_Type) (i % NUMBER_OF_INSTS);
+        if (inst_has_operand(type)) {
+            fprintf(f, "    %s %zu\n", inst_name(type), i % 100);
+        } else {
+            fprintf(f, "    %s\n", inst_name(type));
+        }
+    }
+    fprintf(f, "%%entry main\n");
+
+    fclose(f);
+}
+
+int main(void)
+{
+    String_View names[NUMBER_OF_INSTS];
+    for (Inst_Type type = (Inst_Type) 0; type < NUMBER_OF_INSTS; type += 1) {
+        names[type] = sv_from_cstr(inst_name(type));
+    }
+
+    size_t found = 0;
+    Inst_Type type = INST_NOP;
+
+    clock_t start = clock();
+    for (size_t i = 0; i < BENCH_LINES; ++i) {
+        found += inst_by_name_linear(names[i % NUMBER_OF_INSTS], &type);
+    }
+    const double linear = seconds_since(start);
+
+    start = clock();
+    for (size_t i = 0; i < BENCH_LINES; ++i) {
+        found += inst_by_name(names[i % NUMBER_OF_INSTS], &type);
+    }
+    const double hashed = seconds_since(start);
+
+    assert(found == 2 * BENCH_LINES);
+
+    printf("inst_by_name: %d lookups\n", BENCH_LINES);
+    printf("    linear search: %.3lfs\n", linear);
+    printf("    perfect hash:  %.3lfs\n", hashed);
+
+    generate_source(BENCH_SOURCE_PATH);
+
+    Basm basm = {0};
+    start = clock();
+    basm_translate_source(&basm, sv_from_cstr(BENCH_SOURCE_PATH));
+    printf("basm_translate_source: %d lines in %.3lfs\n",
+           BENCH_LINES, seconds_since(start));
+    arena_free(&basm.arena);
+
+    return 0;
+}
@@ -0,0 +1,152 @@
+// Throughput of the String_View scanning primitives on a multi-megabyte
+// source.
+//
+// Splits a synthetic source into lines and trims them the same way
+// basm_translate_source() does, once with the library implementations
+// and once with the char-at-a-time implementations they replaced.
+#include <time.h>
+
+#include "./bm.h"
+
+#define BENCH_SOURCE_SIZE (64 * 1024 * 1024)
+#define BENCH_ROUNDS 8
+
+static const char *const bench_lines[] = {
+    "main:",
+    "    push 69                        ; push a number",
+    "    push \"Hello, World\"",
+    "    native write",
+    "",
+    "loop:                                  ",
+    "    dup 0",
+    "    jmp_if loop",
+    "%const SOME_LONG_CONSTANT_NAME  (1 << 8) - 1",
+    "                                        halt",
+};
+
+#define BENCH_LINES_COUNT (sizeof(bench_lines) / sizeof(bench_lines[0]))
+
+static String_View scalar_trim_left(String_View sv)
+{
+    size_t i = 0;
+    while (i < sv.count && isspace(sv.data[i])) {
+        i += 1;
+    }
+    return (String_View) {
+        .count = sv.count - i,
+        .data = sv.data + i,
+    };
+}
+
+static String_View scalar_trim_right(String_View sv)
+{
+    size_t i = 0;
+    while (i < sv.count && isspace(sv.data[sv.count - 1 - i])) {
+        i += 1;
+    }
+    return (String_View) {
+        .count = sv.count - i,
+        .data = sv.data,
+    };
+}
+
+static String_View scalar_chop_by_delim(String_View *sv, char delim)
+{
+    size_t i = 0;
+    while (i < sv->count && sv->data[i] != delim) {
+        i += 1;
+    }
+
+    String_View result = {
+        .count = i,
+        .data = sv->data,
+    };
+
+    if (i < sv->count) {
+        sv->count -= i + 1;
+        sv->data  += i + 1;
+    } else {
+        sv->count -= i;
+        sv->data  += i;
+    }
+
+    return result;
+}
+
+static size_t split_lines_scalar(String_View source)
+{
+    size_t result = 0;
+    while (source.count > 0) {
+        String_View line = scalar_chop_by_delim(&source, '\n');
+        line = scalar_trim_right(scalar_trim_left(line));
+        line = scalar_chop_by_delim(&line, ';');
+        result += line.count;
+    }
+    return result;
+}
+
+static size_t split_lines(String_View source)
+{
+    size_t result = 0;
+    while (source.count > 0) {
+        String_View line = sv_chop_by_delim(&source, '\n');
+        line = sv_trim(line);
+        line = sv_chop_by_delim(&line, ';');
+        result += line.count;
+    }
+    return result;
+}
+
+static char *generate_source(size_t size)
+{
+    char *source = malloc(size);
+    if (source == NULL) {
+        fprintf(stderr, "ERROR: could not allocate %zu bytes\n", size);
+        exit(1);
+    }
+
+    size_t filled = 0;
+    for (size_t i = 0; filled < size; ++i) {
+        const char *line = bench_lines[i % BENCH_LINES_COUNT];
+        const size_t n = strlen(line);
+        for (size_t j = 0; j <= n && filled < size; ++j) {
+            source[filled++] = j < n ? line[j] : '\n';
+        }
+    }
+
+    return source;
+}
+
+static void bench(const char *name, size_t (*split)(String_View), String_View source, size_t expected)
+{
+    const clock_t start = clock();
+    for (size_t i = 0; i < BENCH_ROUNDS; ++i) {
+        const size_t result = split(source);
+        assert(result == expected);
+        (void) result;
+    }
+    const double seconds = (double) (clock() - start) / CLOCKS_PER_SEC;
+
+    printf("    %s: %.3lfs, %.2lf GB/s\n", name, seconds,
+           (double) source.count * BENCH_ROUNDS / seconds / 1e9);
+}
+
+int main(void)
+{
+    char *data = generate_source(BENCH_SOURCE_SIZE);
+    const String_View source = {
+        .count = BENCH_SOURCE_SIZE,
+        .data = data,
+    };
+
+    const size_t expected = split_lines_scalar(source);
+
+    printf("line splitting: %d MB x %d rounds\n",
+           BENCH_SOURCE_SIZE / 1024 / 1024, BENCH_ROUNDS);
+    bench("char at a time", split_lines_scalar, source, expected);
+    bench("sv.h          ", split_lines, source, expected);
+
+    free(data);
+
+    return 0;
+}
@@ -44,6 +44,39 @@ void *arena_alloc(Arena *arena, size_t size)
     return result;
 }
 
+// NOTE: the old memory is not reclaimed until the arena is cleaned up
+void *arena_realloc(Arena *arena, void *old_data, size_t old_size, size_t new_size)
+{
+    if (new_size <= old_size) {
+        return old_data;
+    }
+
+    void *new_data = arena_alloc(arena, new_size);
+    if (old_data) {
+        memcpy(new_data, old_data, old_size);
+    }
+    return new_data;
+}
+
+// Makes sure that the dynamic array `items` with `*capacity` elements of
+// `item_size` bytes can hold at least `required` elements. Returns the
+// new location of the array.
+void *arena_da_reserve(Arena *arena, void *items, size_t item_size, size_t *capacity, size_t required)
+{
+    if (required <= *capacity) {
+        return items;
+    }
+
+    size_t new_capacity = *capacity == 0 ? ARENA_DA_INITIAL_CAPACITY : *capacity;
+    while (new_capacity < required) {
+        new_capacity *= 2;
+    }
+
+    items = arena_realloc(arena, items, *capacity * item_size, new_capacity * item_size);
+    *capacity = new_capacity;
+    return items;
+}
+
 void arena_clean(Arena *arena)
 {
     for (Region *iter = arena->first;
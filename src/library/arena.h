@@ -20,6 +20,7 @@ struct Region {
 Region *region_create(size_t capacity);
 
 #define ARENA_DEFAULT_CAPACITY (640 * 1000)
+#define ARENA_DA_INITIAL_CAPACITY 256
 
 typedef struct {
     Region *first;
@@ -27,6 +28,8 @@ typedef struct {
 } Arena;
 
 void *arena_alloc(Arena *arena, size_t size);
+void *arena_realloc(Arena *arena, void *old_data, size_t old_size, size_t new_size);
+void *arena_da_reserve(Arena *arena, void *items, size_t item_size, size_t *capacity, size_t required);
 void arena_clean(Arena *arena);
 void arena_free(Arena *arena);
 void arena_summary(Arena *arena);
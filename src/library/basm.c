@@ -1,79 +1,379 @@
+// NOTE: for realpath(3)
+#ifndef _WIN32
+#define _XOPEN_SOURCE 500
+#endif // _WIN32
+
 #include <stdio.h>
+#include <time.h>
 
 #include "./basm.h"
 
-Binding *basm_resolve_binding(Basm *basm, String_View name)
+const char *basm_phase_name(Basm_Phase phase)
 {
-    for (size_t i = 0; i < basm->bindings_size; ++i) {
-        if (sv_eq(basm->bindings[i].name, name)) {
-            return &basm->bindings[i];
-        }
+    switch (phase) {
+    case BASM_PHASE_READ:
+        return "read";
+    case BASM_PHASE_FIRST_PASS:
+        return "first_pass";
+    case BASM_PHASE_SECOND_PASS:
+        return "second_pass";
+    case BASM_PHASE_OPTIMIZE:
+        return "optimize";
+    case BASM_PHASE_VERIFY:
+        return "verify";
+    case BASM_PHASE_SAVE:
+        return "save";
+    case NUMBER_OF_BASM_PHASES:
+    default:
+        assert(false && "basm_phase_name: unreachable");
+        exit(1);
     }
+}
 
-    return NULL;
+_Thread_local jmp_buf *basm_error_handler = NULL;
+
+void basm_exit(void)
+{
+    if (basm_error_handler != NULL) {
+        longjmp(*basm_error_handler, 1);
+    }
+    exit(1);
 }
 
-void basm_bind_value(Basm *basm, String_View name, Word value, Binding_Kind kind, File_Location location)
+double basm_clock(void)
 {
-    assert(basm->bindings_size < BASM_BINDINGS_CAPACITY);
+    struct timespec ts = {0};
+    timespec_get(&ts, TIME_UTC);
+    return (double) ts.tv_sec * 1000.0 + (double) ts.tv_nsec / 1000000.0;
+}
 
-    Binding *existing = basm_resolve_binding(basm, name);
-    if (existing) {
-        fprintf(stderr,
-                FL_Fmt": ERROR: name `"SV_Fmt"` is already bound\n",
-                FL_Arg(location),
-                SV_Arg(name));
-        fprintf(stderr,
-                FL_Fmt": NOTE: first binding is located here\n",
-                FL_Arg(existing->location));
-        exit(1);
+static size_t *basm_bindings_index_slot(Basm *basm, String_View name)
+{
+    assert(basm->bindings_index_capacity > 0);
+
+    const size_t mask = basm->bindings_index_capacity - 1;
+    size_t i = (size_t) sv_hash(name) & mask;
+    while (basm->bindings_index[i] != 0 &&
+            !sv_eq(basm->bindings[basm->bindings_index[i] - 1].name, name)) {
+        i = (i + 1) & mask;
     }
 
-    basm->bindings[basm->bindings_size++] = (Binding) {
-        .name = name,
-        .value = value,
-        .status = BINDING_EVALUATED,
-        .kind = kind,
-        .location = location,
-    };
+    return &basm->bindings_index[i];
 }
 
-void basm_bind_expr(Basm *basm, String_View name, Expr expr, Binding_Kind kind, File_Location location)
+static void basm_grow_bindings_index(Basm *basm)
+{
+    const size_t new_capacity = basm->bindings_index_capacity == 0
+                                ? BASM_BINDINGS_INDEX_INITIAL_CAPACITY
+                                : basm->bindings_index_capacity * 2;
+
+    basm->bindings_index = arena_alloc(&basm->arena, new_capacity * sizeof(basm->bindings_index[0]));
+    basm->bindings_index_capacity = new_capacity;
+
+    for (size_t i = 0; i < basm->bindings_size; ++i) {
+        *basm_bindings_index_slot(basm, basm->bindings[i].name) = i + 1;
+    }
+}
+
+Binding *basm_resolve_binding(Basm *basm, String_View name)
+{
+    if (basm->bindings_index_capacity == 0) {
+        return NULL;
+    }
+
+    const size_t index = *basm_bindings_index_slot(basm, name);
+    if (index == 0) {
+        return NULL;
+    }
+
+    return &basm->bindings[index - 1];
+}
+
+Binding *basm_push_binding(Basm *basm, String_View name, Binding_Kind kind, File_Location location)
 {
-    assert(basm->bindings_size < BASM_BINDINGS_CAPACITY);
+    // NOTE: keep the load factor of the index below 1/2
+    if ((basm->bindings_size + 1) * 2 > basm->bindings_index_capacity) {
+        basm_grow_bindings_index(basm);
+    }
 
-    Binding *existing = basm_resolve_binding(basm, name);
-    if (existing) {
+    size_t *slot = basm_bindings_index_slot(basm, name);
+    if (*slot != 0) {
         fprintf(stderr,
                 FL_Fmt": ERROR: name `"SV_Fmt"` is already bound\n",
                 FL_Arg(location),
                 SV_Arg(name));
+        if (basm->expansion_level > 0) {
+            fprintf(stderr,
+                    FL_Fmt": NOTE: the name is bound by the expansion requested here\n",
+                    FL_Arg(basm->expansion_location));
+        }
+        const Binding *first = &basm->bindings[*slot - 1];
         fprintf(stderr,
                 FL_Fmt": NOTE: first binding is located here\n",
-                FL_Arg(existing->location));
-        exit(1);
+                FL_Arg(first->location));
+        if (first->expanded) {
+            fprintf(stderr,
+                    FL_Fmt": NOTE: the first binding is made by the expansion requested here\n",
+                    FL_Arg(first->expansion_location));
+        }
+        basm_exit();
     }
 
-    basm->bindings[basm->bindings_size++] = (Binding) {
+    basm->bindings = arena_da_reserve(&basm->arena, basm->bindings,
+                                      sizeof(basm->bindings[0]),
+                                      &basm->bindings_capacity,
+                                      basm->bindings_size + 1);
+
+    Binding *binding = &basm->bindings[basm->bindings_size++];
+    *slot = basm->bindings_size;
+
+    *binding = (Binding) {
         .name = name,
-        .expr = expr,
         .kind = kind,
         .location = location,
+        .expanded = basm->expansion_level > 0,
+        .expansion_location = basm->expansion_location,
     };
+
+    return binding;
+}
+
+void basm_bind_value(Basm *basm, String_View name, Word value, Type type, Binding_Kind kind, File_Location location)
+{
+    Binding *binding = basm_push_binding(basm, name, kind, location);
+    binding->value = value;
+    binding->type = type;
+    binding->status = BINDING_EVALUATED;
+}
+
+void basm_bind_expr(Basm *basm, String_View name, Expr expr, Binding_Kind kind, File_Location location)
+{
+    Binding *binding = basm_push_binding(basm, name, kind, location);
+    binding->expr = expr;
 }
 
 void basm_push_deferred_operand(Basm *basm, Inst_Addr addr, Expr expr, File_Location location)
 {
-    assert(basm->deferred_operands_size < BASM_DEFERRED_OPERANDS_CAPACITY);
+    basm->deferred_operands = arena_da_reserve(&basm->arena, basm->deferred_operands,
+                              sizeof(basm->deferred_operands[0]),
+                              &basm->deferred_operands_capacity,
+                              basm->deferred_operands_size + 1);
     basm->deferred_operands[basm->deferred_operands_size++] =
     (Deferred_Operand) {
         .addr = addr, .expr = expr, .location = location
     };
 }
 
+void basm_push_deferred_assert(Basm *basm, Expr expr, File_Location location)
+{
+    basm->deferred_asserts = arena_da_reserve(&basm->arena, basm->deferred_asserts,
+                             sizeof(basm->deferred_asserts[0]),
+                             &basm->deferred_asserts_capacity,
+                             basm->deferred_asserts_size + 1);
+    basm->deferred_asserts[basm->deferred_asserts_size++] = (Deferred_Assert) {
+        .expr = expr,
+        .location = location,
+    };
+}
+
+void basm_push_inline_hint(Basm *basm, String_View name, File_Location location)
+{
+    basm->inline_hints = arena_da_reserve(&basm->arena, basm->inline_hints,
+                                          sizeof(basm->inline_hints[0]),
+                                          &basm->inline_hints_capacity,
+                                          basm->inline_hints_size + 1);
+    basm->inline_hints[basm->inline_hints_size++] = (Inline_Hint) {
+        .name = name,
+        .location = location,
+    };
+}
+
+void basm_push_signature_hint(Basm *basm, Signature_Hint hint)
+{
+    basm->signature_hints = arena_da_reserve(&basm->arena, basm->signature_hints,
+                            sizeof(basm->signature_hints[0]),
+                            &basm->signature_hints_capacity,
+                            basm->signature_hints_size + 1);
+    basm->signature_hints[basm->signature_hints_size++] = hint;
+}
+
+Macro *basm_resolve_macro(Basm *basm, String_View name)
+{
+    for (size_t i = 0; i < basm->macros_size; ++i) {
+        if (sv_eq(basm->macros[i].name, name)) {
+            return &basm->macros[i];
+        }
+    }
+
+    return NULL;
+}
+
+static size_t *basm_string_lengths_index_slot(Basm *basm, Inst_Addr addr)
+{
+    assert(basm->string_lengths_index_capacity > 0);
+
+    // NOTE: the strings are laid out sequentially in memory, so their
+    // addresses are already spread evenly enough to be their own hash
+    const size_t mask = basm->string_lengths_index_capacity - 1;
+    size_t i = (size_t) addr & mask;
+    while (basm->string_lengths_index[i] != 0 &&
+            basm->string_lengths[basm->string_lengths_index[i] - 1].addr != addr) {
+        i = (i + 1) & mask;
+    }
+
+    return &basm->string_lengths_index[i];
+}
+
+static void basm_grow_string_lengths_index(Basm *basm)
+{
+    const size_t new_capacity = basm->string_lengths_index_capacity == 0
+                                ? BASM_STRINGS_INDEX_INITIAL_CAPACITY
+                                : basm->string_lengths_index_capacity * 2;
+
+    basm->string_lengths_index = arena_alloc(&basm->arena, new_capacity * sizeof(basm->string_lengths_index[0]));
+    basm->string_lengths_index_capacity = new_capacity;
+
+    for (size_t i = 0; i < basm->string_lengths_size; ++i) {
+        size_t *slot = basm_string_lengths_index_slot(basm, basm->string_lengths[i].addr);
+        if (*slot == 0) {
+            *slot = i + 1;
+        }
+    }
+}
+
+void basm_push_relocation(Basm *basm, Inst_Addr addr, Type type)
+{
+    assert(type == TYPE_INST_ADDR || type == TYPE_MEMORY_ADDR);
+    basm->relocations = arena_da_reserve(&basm->arena, basm->relocations,
+                                         sizeof(basm->relocations[0]),
+                                         &basm->relocations_capacity,
+                                         basm->relocations_size + 1);
+    basm->relocations[basm->relocations_size++] = (Relocation) {
+        .addr = addr,
+        .type = type,
+    };
+}
+
+// NOTE: the linker and the optimizer move the instructions around and
+// need to know which operands are addresses
+bool basm_tracks_relocations(const Basm *basm)
+{
+    return basm->relocatable || basm->shared || basm->optimize;
+}
+
+void basm_push_import(Basm *basm, Deferred_Operand import)
+{
+    basm->imports = arena_da_reserve(&basm->arena, basm->imports,
+                                     sizeof(basm->imports[0]),
+                                     &basm->imports_capacity,
+                                     basm->imports_size + 1);
+    basm->imports[basm->imports_size++] = import;
+}
+
+void basm_push_string_length(Basm *basm, Inst_Addr addr, uint64_t length)
+{
+    if ((basm->string_lengths_size + 1) * 2 > basm->string_lengths_index_capacity) {
+        basm_grow_string_lengths_index(basm);
+    }
+
+    basm->string_lengths = arena_da_reserve(&basm->arena, basm->string_lengths,
+                                            sizeof(basm->string_lengths[0]),
+                                            &basm->string_lengths_capacity,
+                                            basm->string_lengths_size + 1);
+    basm->string_lengths[basm->string_lengths_size++] = (String_Length) {
+        .addr = addr,
+        .length = length,
+    };
+
+    // NOTE: an empty string shares its address with whatever is pushed
+    // to the memory right after it. The first length recorded for an
+    // address wins.
+    size_t *slot = basm_string_lengths_index_slot(basm, addr);
+    if (*slot == 0) {
+        *slot = basm->string_lengths_size;
+    }
+}
+
+static size_t *basm_strings_index_slot(Basm *basm, String_View text)
+{
+    assert(basm->strings_index_capacity > 0);
+
+    const size_t mask = basm->strings_index_capacity - 1;
+    size_t i = (size_t) sv_hash(text) & mask;
+    while (basm->strings_index[i] != 0) {
+        const String_Length *string = &basm->string_lengths[basm->strings_index[i] - 1];
+        if (string->length == text.count &&
+                memcmp(basm->memory + string->addr, text.data, text.count) == 0) {
+            break;
+        }
+        i = (i + 1) & mask;
+    }
+
+    return &basm->strings_index[i];
+}
+
+static void basm_grow_strings_index(Basm *basm)
+{
+    const size_t old_capacity = basm->strings_index_capacity;
+    size_t *old_index = basm->strings_index;
+
+    basm->strings_index_capacity = old_capacity == 0
+                                   ? BASM_STRINGS_INDEX_INITIAL_CAPACITY
+                                   : old_capacity * 2;
+    basm->strings_index = arena_alloc(&basm->arena, basm->strings_index_capacity * sizeof(basm->strings_index[0]));
+
+    for (size_t i = 0; i < old_capacity; ++i) {
+        if (old_index[i] != 0) {
+            const String_Length *string = &basm->string_lengths[old_index[i] - 1];
+            const String_View text = {
+                .count = string->length,
+                .data = (const char *) basm->memory + string->addr,
+            };
+            *basm_strings_index_slot(basm, text) = old_index[i];
+        }
+    }
+}
+
+Inst *basm_push_inst(Basm *basm, Inst_Type type)
+{
+    basm->program = arena_da_reserve(&basm->arena, basm->program,
+                                     sizeof(basm->program[0]),
+                                     &basm->program_capacity,
+                                     basm->program_size + 1);
+    Inst *inst = &basm->program[basm->program_size++];
+    inst->type = type;
+    inst->operand = word_u64(0);
+    return inst;
+}
+
+static void basm_reserve_memory(Basm *basm, size_t size)
+{
+    assert(basm->memory_size + size <= BM_MEMORY_CAPACITY);
+
+    basm->memory = arena_da_reserve(&basm->arena, basm->memory,
+                                    sizeof(basm->memory[0]),
+                                    &basm->memory_buffer_capacity,
+                                    basm->memory_size + size);
+}
+
 Word basm_push_string_to_memory(Basm *basm, String_View sv)
 {
-    assert(basm->memory_size + sv.count <= BM_MEMORY_CAPACITY);
+    // NOTE: empty strings are not interned. Their address is the end of
+    // the memory at the moment they are pushed and some programs use it
+    // as an end marker of the preceding string.
+    size_t *slot = NULL;
+    if (basm->intern_strings && sv.count > 0) {
+        if ((basm->strings_index_size + 1) * 2 > basm->strings_index_capacity) {
+            basm_grow_strings_index(basm);
+        }
+
+        slot = basm_strings_index_slot(basm, sv);
+        if (*slot != 0) {
+            return word_u64(basm->string_lengths[*slot - 1].addr);
+        }
+    }
+
+    basm_reserve_memory(basm, sv.count);
 
     Word result = word_u64(basm->memory_size);
     memcpy(basm->memory + basm->memory_size, sv.data, sv.count);
@@ -83,21 +383,70 @@ Word basm_push_string_to_memory(Basm *basm, String_View sv)
         basm->memory_capacity = basm->memory_size;
     }
 
-    basm->string_lengths[basm->string_lengths_size++] = (String_Length) {
-        .addr = result.as_u64,
-        .length = sv.count,
-    };
+    basm_push_string_length(basm, result.as_u64, sv.count);
+
+    if (slot != NULL) {
+        *slot = basm->string_lengths_size;
+        basm->strings_index_size += 1;
+    }
 
     return result;
 }
 
-bool basm_string_length_by_addr(Basm *basm, Inst_Addr addr, Word *length)
+void basm_push_word_to_memory(Basm *basm, Word word, size_t size)
 {
-    for (size_t i = 0; i < basm->string_lengths_size; ++i) {
-        if (basm->string_lengths[i].addr == addr) {
-            if (length) {
-                *length = word_u64(basm->string_lengths[i].length);
-            }
+    basm_reserve_memory(basm, size);
+
+    // NOTE: the bytes are laid out the same way the write16/write32/write64
+    // instructions of the BM would lay them out on the host machine
+    switch (size) {
+    case 1: {
+        uint8_t x = (uint8_t) word.as_u64;
+        memcpy(basm->memory + basm->memory_size, &x, size);
+    }
+    break;
+    case 2: {
+        uint16_t x = (uint16_t) word.as_u64;
+        memcpy(basm->memory + basm->memory_size, &x, size);
+    }
+    break;
+    case 4: {
+        uint32_t x = (uint32_t) word.as_u64;
+        memcpy(basm->memory + basm->memory_size, &x, size);
+    }
+    break;
+    case 8: {
+        memcpy(basm->memory + basm->memory_size, &word.as_u64, size);
+    }
+    break;
+    default:
+        assert(false && "basm_push_word_to_memory: unreachable");
+        exit(1);
+    }
+
+    basm->memory_size += size;
+
+    if (basm->memory_size > basm->memory_capacity) {
+        basm->memory_capacity = basm->memory_size;
+    }
+}
+
+static bool table_elem_size_by_name(String_View name, size_t *size)
+{
+    static const struct {
+        const char *name;
+        size_t size;
+    } elem_sizes[] = {
+        {"u8",  1},
+        {"u16", 2},
+        {"u32", 4},
+        {"u64", 8},
+        {"f64", 8},
+    };
+
+    for (size_t i = 0; i < sizeof(elem_sizes) / sizeof(elem_sizes[0]); ++i) {
+        if (sv_eq(name, sv_from_cstr(elem_sizes[i].name))) {
+            *size = elem_sizes[i].size;
             return true;
         }
     }
@@ -105,6 +454,23 @@ bool basm_string_length_by_addr(Basm *basm, Inst_Addr addr, Word *length)
     return false;
 }
 
+bool basm_string_length_by_addr(Basm *basm, Inst_Addr addr, Word *length)
+{
+    if (basm->string_lengths_index_capacity == 0) {
+        return false;
+    }
+
+    const size_t index = *basm_string_lengths_index_slot(basm, addr);
+    if (index == 0) {
+        return false;
+    }
+
+    if (length) {
+        *length = word_u64(basm->string_lengths[index - 1].length);
+    }
+    return true;
+}
+
 const char *binding_kind_as_cstr(Binding_Kind kind)
 {
     switch (kind) {
@@ -120,13 +486,37 @@ const char *binding_kind_as_cstr(Binding_Kind kind)
     }
 }
 
+static void basm_object_write(const void *data, size_t size, size_t count, FILE *f, const char *file_path)
+{
+    fwrite(data, size, count, f);
+    if (ferror(f)) {
+        fprintf(stderr, "ERROR: Could not write to file `%s`: %s\n",
+                file_path, strerror(errno));
+        basm_exit();
+    }
+}
+
+static void basm_object_write_sv(String_View sv, FILE *f, const char *file_path)
+{
+    basm_object_write(sv.data, sizeof(sv.data[0]), sv.count, f, file_path);
+}
+
 void basm_save_to_file(Basm *basm, const char *file_path)
 {
     FILE *f = fopen(file_path, "wb");
     if (f == NULL) {
         fprintf(stderr, "ERROR: Could not open file `%s`: %s\n",
                 file_path, strerror(errno));
-        exit(1);
+        basm_exit();
+    }
+
+    size_t exports_count = 0;
+    if (basm->shared) {
+        for (size_t i = 0; i < basm->bindings_size; ++i) {
+            if (basm->bindings[i].kind == BINDING_LABEL) {
+                exports_count += 1;
+            }
+        }
     }
 
     Bm_File_Meta meta = {
@@ -136,76 +526,1321 @@ void basm_save_to_file(Basm *basm, const char *file_path)
         .program_size = basm->program_size,
         .memory_size = basm->memory_size,
         .memory_capacity = basm->memory_capacity,
+        .exports_count = exports_count,
+        .relocations_count = basm->shared ? basm->relocations_size : 0,
+        .modules_count = basm->modules_size,
+        .imports_count = basm->module_imports_size,
+        .signatures_count = basm->signatures_size,
+        .native_signatures_count = basm->native_signatures_size,
     };
 
-    fwrite(&meta, sizeof(meta), 1, f);
-    if (ferror(f)) {
-        fprintf(stderr, "ERROR: Could not write to file `%s`: %s\n",
-                file_path, strerror(errno));
-        exit(1);
+    basm_object_write(&meta, sizeof(meta), 1, f, file_path);
+    basm_object_write(basm->program, sizeof(basm->program[0]), basm->program_size, f, file_path);
+    basm_object_write(basm->memory, sizeof(basm->memory[0]), basm->memory_size, f, file_path);
+
+    if (basm->shared) {
+        for (size_t i = 0; i < basm->bindings_size; ++i) {
+            const Binding *binding = &basm->bindings[i];
+            if (binding->kind == BINDING_LABEL) {
+                Bm_File_Export export = {
+                    .addr = binding->value.as_u64,
+                    .name_size = binding->name.count,
+                };
+                basm_object_write(&export, sizeof(export), 1, f, file_path);
+                basm_object_write_sv(binding->name, f, file_path);
+            }
+        }
+
+        for (size_t i = 0; i < basm->relocations_size; ++i) {
+            Bm_File_Relocation relocation = {
+                .addr = basm->relocations[i].addr,
+                .kind = basm->relocations[i].type == TYPE_INST_ADDR
+                ? BM_RELOCATION_INST_ADDR
+                : BM_RELOCATION_MEMORY_ADDR,
+            };
+            basm_object_write(&relocation, sizeof(relocation), 1, f, file_path);
+        }
     }
 
-    fwrite(basm->program, sizeof(basm->program[0]), basm->program_size, f);
-    if (ferror(f)) {
-        fprintf(stderr, "ERROR: Could not write to file `%s`: %s\n",
+    for (size_t i = 0; i < basm->modules_size; ++i) {
+        Bm_File_Module module = {
+            .file_path_size = basm->modules[i].count,
+        };
+        basm_object_write(&module, sizeof(module), 1, f, file_path);
+        basm_object_write_sv(basm->modules[i], f, file_path);
+    }
+
+    for (size_t i = 0; i < basm->module_imports_size; ++i) {
+        Bm_File_Import import = {
+            .module = basm->module_imports[i].module,
+            .stub = basm->module_imports[i].stub,
+            .name_size = basm->module_imports[i].name.count,
+        };
+        basm_object_write(&import, sizeof(import), 1, f, file_path);
+        basm_object_write_sv(basm->module_imports[i].name, f, file_path);
+    }
+
+    for (size_t i = 0; i < basm->signatures_size; ++i) {
+        Bm_File_Signature signature = {
+            .addr = basm->signatures[i].addr,
+            .in = basm->signatures[i].in,
+            .out = basm->signatures[i].out,
+            .depth = basm->signatures[i].depth,
+        };
+        basm_object_write(&signature, sizeof(signature), 1, f, file_path);
+    }
+
+    for (size_t i = 0; i < basm->native_signatures_size; ++i) {
+        Bm_File_Native_Signature signature = {
+            .native = basm->native_signatures[i].native,
+            .in = basm->native_signatures[i].in,
+            .out = basm->native_signatures[i].out,
+        };
+        basm_object_write(&signature, sizeof(signature), 1, f, file_path);
+    }
+
+    fclose(f);
+}
+
+void basm_save_symbols_to_file(Basm *basm, const char *file_path)
+{
+    FILE *f = fopen(file_path, "w");
+    if (f == NULL) {
+        fprintf(stderr, "ERROR: Could not open file `%s`: %s\n",
                 file_path, strerror(errno));
-        exit(1);
+        basm_exit();
     }
 
-    fwrite(basm->memory, sizeof(basm->memory[0]), basm->memory_size, f);
-    if (ferror(f)) {
-        fprintf(stderr, "ERROR: Could not write to file `%s`: %s\n",
+    /*
+     * Note: This will dump out *ALL* symbols, no matter whether
+     * they are jump labels or not. However, since the
+     * preprocessor runs before the jump mark resolution, all the
+     * labels are allocated in a way that enables us to just
+     * overwrite prerocessor labels with a value equal to the
+     * address of a jump label.
+     *
+     */
+    for (size_t i = 0; i < basm->bindings_size; ++i) {
+        if (basm->bindings[i].eliminated) {
+            continue;
+        }
+
+        fprintf(f, "%"PRIu64"\t%u\t"SV_Fmt"\n",
+                basm->bindings[i].value.as_u64,
+                basm->bindings[i].kind,
+                SV_Arg(basm->bindings[i].name));
+    }
+
+    fclose(f);
+}
+
+static void fprint_make_path(FILE *f, String_View path)
+{
+    for (size_t i = 0; i < path.count; ++i) {
+        if (path.data[i] == ' ') {
+            fputc('\\', f);
+        }
+        fputc(path.data[i], f);
+    }
+}
+
+// Makefile rule that lists the input and every file it includes, one
+// per line
+void basm_save_dependencies_to_file(Basm *basm, const char *target, const char *file_path)
+{
+    FILE *f = fopen(file_path, "w");
+    if (f == NULL) {
+        fprintf(stderr, "ERROR: Could not open file `%s`: %s\n",
                 file_path, strerror(errno));
-        exit(1);
+        basm_exit();
+    }
+
+    fprint_make_path(f, sv_from_cstr(target));
+    fprintf(f, ":");
+    for (size_t i = 0; i < basm->included_files_size; ++i) {
+        fprintf(f, " \\\n  ");
+        fprint_make_path(f, basm->included_files[i].canonical_path);
     }
+    fprintf(f, "\n");
 
     fclose(f);
 }
 
-static void basm_translate_bind_directive(Basm *basm, String_View *line, File_Location location, Binding_Kind binding_kind)
+void basm_load_profile(Basm *basm, const char *file_path)
 {
-    *line = sv_trim(*line);
-    String_View name = sv_chop_by_delim(line, ' ');
-    if (name.count > 0) {
-        *line = sv_trim(*line);
-        Expr expr = parse_expr_from_sv(&basm->arena, *line, location);
+    String_View profile = {0};
+    if (arena_slurp_file(&basm->arena, sv_from_cstr(file_path), &profile) < 0) {
+        fprintf(stderr, "ERROR: could not read file `%s`: %s\n",
+                file_path, strerror(errno));
+        basm_exit();
+    }
+
+    File_Location location = {
+        .file_path = sv_from_cstr(file_path),
+    };
+
+    while (profile.count > 0) {
+        String_View line = sv_trim(sv_chop_by_delim(&profile, '\n'));
+        location.line_number += 1;
+        if (line.count == 0) {
+            continue;
+        }
+
+        const String_View count = sv_trim(sv_chop_by_delim(&line, '\t'));
+        const String_View label = sv_trim(line);
+
+        bool valid = count.count > 0 && label.count > 0;
+        for (size_t i = 0; i < count.count && valid; ++i) {
+            valid = isdigit(count.data[i]);
+        }
+
+        if (!valid) {
+            fprintf(stderr, FL_Fmt": ERROR: expected `<count>\\t<label>`\n",
+                    FL_Arg(location));
+            basm_exit();
+        }
+
+        basm->profile = arena_da_reserve(&basm->arena, basm->profile,
+                                         sizeof(basm->profile[0]),
+                                         &basm->profile_capacity,
+                                         basm->profile_size + 1);
+        basm->profile[basm->profile_size++] = (Profile_Entry) {
+            .label = label,
+            .count = sv_to_u64(count),
+        };
+    }
+}
+
+void basm_save_to_object_file(Basm *basm, const char *file_path)
+{
+    assert(basm->relocatable);
+
+    FILE *f = fopen(file_path, "wb");
+    if (f == NULL) {
+        fprintf(stderr, "ERROR: Could not open file `%s`: %s\n",
+                file_path, strerror(errno));
+        basm_exit();
+    }
+
+    Basm_Object_Meta meta = {
+        .magic = BASM_OBJECT_MAGIC,
+        .version = BASM_OBJECT_VERSION,
+        .program_size = basm->program_size,
+        .memory_size = basm->memory_size,
+        .has_entry = basm->has_entry,
+        .entry = basm->entry,
+        .symbols_count = basm->bindings_size,
+        .relocations_count = basm->relocations_size,
+        .imports_count = basm->imports_size,
+    };
+
+    basm_object_write(&meta, sizeof(meta), 1, f, file_path);
+    basm_object_write(basm->program, sizeof(basm->program[0]), basm->program_size, f, file_path);
+    basm_object_write(basm->memory, sizeof(basm->memory[0]), basm->memory_size, f, file_path);
+
+    for (size_t i = 0; i < basm->bindings_size; ++i) {
+        const Binding *binding = &basm->bindings[i];
+        assert(binding->status == BINDING_EVALUATED);
+
+        Basm_Object_Symbol symbol = {
+            .kind = (uint8_t) binding->kind,
+            .type = (uint8_t) binding->type,
+            .value = binding->value.as_u64,
+            .name_size = binding->name.count,
+        };
+        basm_object_write(&symbol, sizeof(symbol), 1, f, file_path);
+        basm_object_write_sv(binding->name, f, file_path);
+    }
+
+    for (size_t i = 0; i < basm->relocations_size; ++i) {
+        Basm_Object_Relocation relocation = {
+            .addr = basm->relocations[i].addr,
+            .type = (uint8_t) basm->relocations[i].type,
+        };
+        basm_object_write(&relocation, sizeof(relocation), 1, f, file_path);
+    }
+
+    for (size_t i = 0; i < basm->imports_size; ++i) {
+        const Deferred_Operand *import = &basm->imports[i];
+        const String_View name = expr_root(import->expr).value.as_binding;
+
+        Basm_Object_Import object_import = {
+            .addr = import->addr,
+            .line_number = (uint64_t) import->location.line_number,
+            .file_path_size = import->location.file_path.count,
+            .name_size = name.count,
+        };
+        basm_object_write(&object_import, sizeof(object_import), 1, f, file_path);
+        basm_object_write_sv(import->location.file_path, f, file_path);
+        basm_object_write_sv(name, f, file_path);
+    }
+
+    fclose(f);
+}
+
+static void basm_object_read(void *data, size_t size, size_t count, FILE *f, const char *file_path)
+{
+    if (fread(data, size, count, f) != count) {
+        fprintf(stderr, "ERROR: %s: unexpected end of the object file\n", file_path);
+        basm_exit();
+    }
+}
+
+static String_View basm_object_read_sv(Basm *basm, size_t count, FILE *f, const char *file_path)
+{
+    char *data = arena_alloc(&basm->arena, count);
+    basm_object_read(data, sizeof(data[0]), count, f, file_path);
+    return (String_View) {
+        .count = count,
+        .data = data,
+    };
+}
+
+static Word relocate_word(Word word, Type type, Inst_Addr program_base, Memory_Addr memory_base)
+{
+    switch (type) {
+    case TYPE_INST_ADDR:
+        return word_u64(word.as_u64 + program_base);
+    case TYPE_MEMORY_ADDR:
+        return word_u64(word.as_u64 + memory_base);
+    case TYPE_INTEGER:
+    case TYPE_FLOAT:
+        return word;
+    default:
+        assert(false && "relocate_word: unreachable");
+        exit(1);
+    }
+}
+
+void basm_link_object_file(Basm *basm, const char *file_path)
+{
+    FILE *f = fopen(file_path, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "ERROR: Could not open file `%s`: %s\n",
+                file_path, strerror(errno));
+        basm_exit();
+    }
+
+    Basm_Object_Meta meta = {0};
+    basm_object_read(&meta, sizeof(meta), 1, f, file_path);
+
+    if (meta.magic != BASM_OBJECT_MAGIC) {
+        fprintf(stderr,
+                "ERROR: %s does not appear to be a valid BASM object file. "
+                "Unexpected magic %04X. Expected %04X.\n",
+                file_path,
+                meta.magic, BASM_OBJECT_MAGIC);
+        basm_exit();
+    }
+
+    if (meta.version != BASM_OBJECT_VERSION) {
+        fprintf(stderr,
+                "ERROR: %s: unsupported version of BASM object file %d. Expected version %d.\n",
+                file_path,
+                meta.version, BASM_OBJECT_VERSION);
+        basm_exit();
+    }
+
+    if (meta.memory_size > BM_MEMORY_CAPACITY - basm->memory_size) {
+        fprintf(stderr, "ERROR: %s: the memory sections of the linked objects do not fit into the memory of the BM\n",
+                file_path);
+        basm_exit();
+    }
+
+    const File_Location location = {
+        .file_path = sv_from_cstr(file_path),
+    };
+    const Inst_Addr program_base = basm->program_size;
+    const Memory_Addr memory_base = basm->memory_size;
+
+    basm->program = arena_da_reserve(&basm->arena, basm->program,
+                                     sizeof(basm->program[0]),
+                                     &basm->program_capacity,
+                                     basm->program_size + meta.program_size);
+    basm_object_read(basm->program + program_base, sizeof(basm->program[0]), meta.program_size, f, file_path);
+    basm->program_size += meta.program_size;
+
+    basm_reserve_memory(basm, meta.memory_size);
+    basm_object_read(basm->memory + memory_base, sizeof(basm->memory[0]), meta.memory_size, f, file_path);
+    basm->memory_size += meta.memory_size;
+    if (basm->memory_size > basm->memory_capacity) {
+        basm->memory_capacity = basm->memory_size;
+    }
+
+    for (uint64_t i = 0; i < meta.symbols_count; ++i) {
+        Basm_Object_Symbol symbol = {0};
+        basm_object_read(&symbol, sizeof(symbol), 1, f, file_path);
+        const String_View name = basm_object_read_sv(basm, symbol.name_size, f, file_path);
+
+        if (symbol.kind > BINDING_NATIVE || symbol.type > TYPE_MEMORY_ADDR) {
+            fprintf(stderr, "ERROR: %s: symbol `"SV_Fmt"` has invalid kind %u or type %u\n",
+                    file_path, SV_Arg(name), symbol.kind, symbol.type);
+            basm_exit();
+        }
+
+        basm_bind_value(basm, name,
+                        relocate_word(word_u64(symbol.value), (Type) symbol.type, program_base, memory_base),
+                        (Type) symbol.type, (Binding_Kind) symbol.kind, location);
+    }
+
+    for (uint64_t i = 0; i < meta.relocations_count; ++i) {
+        Basm_Object_Relocation relocation = {0};
+        basm_object_read(&relocation, sizeof(relocation), 1, f, file_path);
+
+        if (relocation.addr >= meta.program_size ||
+                (relocation.type != TYPE_INST_ADDR && relocation.type != TYPE_MEMORY_ADDR)) {
+            fprintf(stderr, "ERROR: %s: invalid relocation of the instruction %"PRIu64"\n",
+                    file_path, relocation.addr);
+            basm_exit();
+        }
+
+        Inst *inst = &basm->program[program_base + relocation.addr];
+        inst->operand = relocate_word(inst->operand, (Type) relocation.type, program_base, memory_base);
+        if (basm->shared) {
+            basm_push_relocation(basm, program_base + relocation.addr, (Type) relocation.type);
+        }
+    }
+
+    for (uint64_t i = 0; i < meta.imports_count; ++i) {
+        Basm_Object_Import object_import = {0};
+        basm_object_read(&object_import, sizeof(object_import), 1, f, file_path);
+
+        Deferred_Operand import = {
+            .addr = program_base + object_import.addr,
+            .location = {
+                .file_path = basm_object_read_sv(basm, object_import.file_path_size, f, file_path),
+                .line_number = (int) object_import.line_number,
+            },
+        };
+
+        Expr_Node *node = arena_alloc(&basm->arena, sizeof(*node));
+        node->kind = EXPR_KIND_BINDING;
+        node->value.as_binding = basm_object_read_sv(basm, object_import.name_size, f, file_path);
+        import.expr = (Expr) {
+            .nodes = node,
+            .count = 1,
+        };
+
+        basm_push_deferred_operand(basm, import.addr, import.expr, import.location);
+    }
+
+    if (meta.has_entry) {
+        if (basm->has_entry) {
+            fprintf(stderr, "ERROR: %s: entry point has been already set!\n", file_path);
+            fprintf(stderr, FL_Fmt": NOTE: the first entry point\n", FL_Arg(basm->entry_location));
+            basm_exit();
+        }
+
+        basm->has_entry = true;
+        basm->entry = program_base + meta.entry;
+        basm->entry_location = location;
+    }
+
+    fclose(f);
+}
+
+void basm_link_module(Basm *basm, const char *file_path)
+{
+    assert(!basm->shared);
+
+    const Bm_Module *module = bm_module_load(file_path);
+    const File_Location location = {
+        .file_path = sv_from_cstr(file_path),
+    };
+
+    basm->modules = arena_da_reserve(&basm->arena, basm->modules,
+                                     sizeof(basm->modules[0]),
+                                     &basm->modules_capacity,
+                                     basm->modules_size + 1);
+    const uint64_t module_index = basm->modules_size;
+    basm->modules[basm->modules_size++] = location.file_path;
+
+    // NOTE: every function of the module that is referred to but not
+    // defined by the linked objects gets a stub. The stub stays in the
+    // program and is patched by the BM on the first call.
+    for (size_t i = 0; i < basm->deferred_operands_size; ++i) {
+        const String_View name = expr_root(basm->deferred_operands[i].expr).value.as_binding;
+        Inst_Addr addr = 0;
+        if (basm_resolve_binding(basm, name) != NULL || !bm_module_find_export(module, name, &addr)) {
+            continue;
+        }
+
+        if (basm->module_imports_size >= BM_IMPORTS_CAPACITY) {
+            fprintf(stderr, "ERROR: %s: too many imported functions. The capacity is %d\n",
+                    file_path, BM_IMPORTS_CAPACITY);
+            basm_exit();
+        }
+
+        const Inst_Addr stub = basm->program_size;
+        basm_push_inst(basm, INST_JMP)->operand = word_u64(BM_LAZY_BIND_ADDR + basm->module_imports_size);
+
+        basm->module_imports = arena_da_reserve(&basm->arena, basm->module_imports,
+                                                sizeof(basm->module_imports[0]),
+                                                &basm->module_imports_capacity,
+                                                basm->module_imports_size + 1);
+        basm->module_imports[basm->module_imports_size++] = (Bm_Import) {
+            .name = name,
+            .module = module_index,
+            .stub = stub,
+        };
+
+        basm_bind_value(basm, name, word_u64(stub), TYPE_INST_ADDR, BINDING_LABEL, location);
+    }
+}
+
+static Expr parse_whole_expr_from_lexer(Arena *arena, Lexer *lexer, File_Location location);
+
+// Counts the tokens for `basm -time-report`
+static Expr basm_parse_expr(Basm *basm, String_View source, File_Location location)
+{
+    Lexer lexer = lexer_from_sv(source, location);
+    Expr expr = parse_whole_expr_from_lexer(&basm->arena, &lexer, location);
+    basm->stats.tokens_count += lexer.tokens_count;
+    return expr;
+}
+
+static void basm_translate_bind_directive(Basm *basm, String_View *line, File_Location location, Binding_Kind binding_kind)
+{
+    *line = sv_trim(*line);
+    String_View name = sv_chop_by_delim(line, ' ');
+    if (name.count > 0) {
+        *line = sv_trim(*line);
+        Expr expr = basm_parse_expr(basm, *line, location);
+
+        basm_bind_expr(basm, name, expr, binding_kind, location);
+
+    } else {
+        fprintf(stderr,
+                FL_Fmt": ERROR: binding name is not provided\n",
+                FL_Arg(location));
+        basm_exit();
+    }
+}
+
+static void basm_translate_table_directive(Basm *basm, String_View line, File_Location location)
+{
+    line = sv_trim(line);
+    String_View name = sv_chop_by_delim(&line, ' ');
+    if (name.count == 0) {
+        fprintf(stderr, FL_Fmt": ERROR: table name is not provided\n",
+                FL_Arg(location));
+        basm_exit();
+    }
+
+    line = sv_trim(line);
+    String_View type = sv_chop_by_delim(&line, ' ');
+    size_t elem_size = 0;
+    if (!table_elem_size_by_name(type, &elem_size)) {
+        fprintf(stderr, FL_Fmt": ERROR: unknown table element type `"SV_Fmt"`. Expected u8, u16, u32, u64 or f64.\n",
+                FL_Arg(location), SV_Arg(type));
+        basm_exit();
+    }
+
+    line = sv_trim(line);
+    String_View count_source = sv_chop_by_delim(&line, ' ');
+    if (count_source.count == 0) {
+        fprintf(stderr, FL_Fmt": ERROR: table size is not provided\n",
+                FL_Arg(location));
+        basm_exit();
+    }
+
+    line = sv_trim(line);
+    if (line.count == 0) {
+        fprintf(stderr, FL_Fmt": ERROR: table element expression is not provided\n",
+                FL_Arg(location));
+        basm_exit();
+    }
+
+    Type count_type = TYPE_INTEGER;
+    const uint64_t count = basm_expr_eval(
+                               basm,
+                               basm_parse_expr(basm, count_source, location),
+                               location,
+                               &count_type).as_u64;
+    if (count_type != TYPE_INTEGER) {
+        fprintf(stderr, FL_Fmt": ERROR: table size has to be an %s, but got %s\n",
+                FL_Arg(location), type_name(TYPE_INTEGER), type_name(count_type));
+        basm_exit();
+    }
+
+    const bool is_float_table = sv_eq(type, sv_from_cstr("f64"));
+    Expr expr = basm_parse_expr(basm, line, location);
+
+    if (count > (BM_MEMORY_CAPACITY - basm->memory_size) / elem_size) {
+        fprintf(stderr, FL_Fmt": ERROR: table `"SV_Fmt"` does not fit into the memory of the BM\n",
+                FL_Arg(location), SV_Arg(name));
+        basm_exit();
+    }
+
+    const Word addr = word_u64(basm->memory_size);
+
+    for (uint64_t i = 0; i < count; ++i) {
+        basm->has_table_index = true;
+        basm->table_index = i;
+        Type elem_type = TYPE_INTEGER;
+        Word elem = basm_expr_eval(basm, expr, location, &elem_type);
+        basm->has_table_index = false;
+
+        if (is_float_table && elem_type == TYPE_INTEGER) {
+            elem = word_f64((double) elem.as_i64);
+        } else if (basm->relocatable && type_is_addr(elem_type)) {
+            fprintf(stderr, FL_Fmt": ERROR: element %"PRIu64" of table `"SV_Fmt"` is an %s. Relocatable objects can't store addresses in the memory.\n",
+                    FL_Arg(location), i, SV_Arg(name), type_name(elem_type));
+            basm_exit();
+        } else if (basm->optimize && elem_type == TYPE_INST_ADDR) {
+            fprintf(stderr, FL_Fmt": ERROR: element %"PRIu64" of table `"SV_Fmt"` is an %s. The optimizer can't update the addresses of the instructions stored in the memory.\n",
+                    FL_Arg(location), i, SV_Arg(name), type_name(elem_type));
+            basm_exit();
+        } else if (!is_float_table && elem_type == TYPE_FLOAT) {
+            fprintf(stderr, FL_Fmt": ERROR: element %"PRIu64" of table `"SV_Fmt"` is a %s, but the table is of type "SV_Fmt"\n",
+                    FL_Arg(location), i, SV_Arg(name), type_name(elem_type), SV_Arg(type));
+            basm_exit();
+        }
+
+        if (elem_type == TYPE_MEMORY_ADDR) {
+            basm->memory_has_addrs = true;
+        }
+
+        basm_push_word_to_memory(basm, elem, elem_size);
+    }
+
+    basm_push_string_length(basm, addr.as_u64, count * elem_size);
+
+    basm_bind_value(basm, name, addr, TYPE_MEMORY_ADDR, BINDING_CONST, location);
+}
+
+static void basm_report_file_error(Basm *basm, String_View file_path)
+{
+    if (basm->include_level > 0) {
+        fprintf(stderr, FL_Fmt": ERROR: could not read file `"SV_Fmt"`: %s\n",
+                FL_Arg(basm->include_location),
+                SV_Arg(file_path), strerror(errno));
+    } else {
+        fprintf(stderr, "ERROR: could not read file `"SV_Fmt"`: %s\n",
+                SV_Arg(file_path), strerror(errno));
+    }
+    basm_exit();
+}
+
+static String_View basm_canonical_path(Basm *basm, String_View file_path)
+{
+    const char *file_path_cstr = arena_sv_to_cstr(&basm->arena, file_path);
+
+#ifdef _WIN32
+    char *canonical_path = _fullpath(NULL, file_path_cstr, 0);
+#else
+    char *canonical_path = realpath(file_path_cstr, NULL);
+#endif // _WIN32
+
+    if (canonical_path == NULL) {
+        basm_report_file_error(basm, file_path);
+    }
+
+    String_View result = arena_sv_dup(&basm->arena, sv_from_cstr(canonical_path));
+    free(canonical_path);
+    return result;
+}
+
+static void basm_include_cache_lock(Basm_Include_Cache *cache)
+{
+    if (cache->lock != NULL) {
+        cache->lock(cache->lock_data);
+    }
+}
+
+static void basm_include_cache_unlock(Basm_Include_Cache *cache)
+{
+    if (cache->unlock != NULL) {
+        cache->unlock(cache->lock_data);
+    }
+}
+
+// Must be called under the lock
+static bool basm_include_cache_find(Basm_Include_Cache *cache, String_View canonical_path,
+                                    String_View *source)
+{
+    for (size_t i = 0; i < cache->files_size; ++i) {
+        if (sv_eq(cache->files[i].canonical_path, canonical_path)) {
+            *source = cache->files[i].source;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Must be called under the lock. The source lives in the arena of the
+// cache, so it outlives the translation that read it first.
+static bool basm_include_cache_read(Basm_Include_Cache *cache, String_View file_path,
+                                    String_View canonical_path, String_View *source)
+{
+    if (arena_slurp_file(&cache->arena, file_path, source) < 0) {
+        return false;
+    }
+
+    cache->files = arena_da_reserve(&cache->arena, cache->files,
+                                    sizeof(cache->files[0]),
+                                    &cache->files_capacity,
+                                    cache->files_size + 1);
+    cache->files[cache->files_size++] = (Included_File) {
+        .canonical_path = arena_sv_dup(&cache->arena, canonical_path),
+        .source = *source,
+    };
+
+    return true;
+}
+
+static String_View basm_include_cache_source(Basm *basm, Basm_Include_Cache *cache,
+        String_View file_path, String_View canonical_path)
+{
+    String_View source = {0};
+
+    basm_include_cache_lock(cache);
+    const bool ok = basm_include_cache_find(cache, canonical_path, &source) ||
+                    basm_include_cache_read(cache, file_path, canonical_path, &source);
+    basm_include_cache_unlock(cache);
+
+    if (!ok) {
+        basm_report_file_error(basm, file_path);
+    }
+
+    return source;
+}
+
+// Must be called under the lock. Copies the files that are still in the
+// cache into a new arena and frees the old one.
+static void basm_include_cache_compact(Basm_Include_Cache *cache)
+{
+    Arena arena = {0};
+    size_t files_capacity = 0;
+    Included_File *files = arena_da_reserve(&arena, NULL, sizeof(files[0]),
+                                            &files_capacity, cache->files_size);
+    for (size_t i = 0; i < cache->files_size; ++i) {
+        files[i] = (Included_File) {
+            .canonical_path = arena_sv_dup(&arena, cache->files[i].canonical_path),
+            .source = arena_sv_dup(&arena, cache->files[i].source),
+        };
+    }
+
+    arena_free(&cache->arena);
+    cache->arena = arena;
+    cache->files = files;
+    cache->files_capacity = files_capacity;
+    cache->forgotten_size = 0;
+}
+
+void basm_include_cache_forget(Basm_Include_Cache *cache, String_View canonical_path)
+{
+    basm_include_cache_lock(cache);
+
+    for (size_t i = 0; i < cache->files_size; ++i) {
+        const Included_File file = cache->files[i];
+        if (sv_eq(file.canonical_path, canonical_path)) {
+            cache->forgotten_size += file.canonical_path.count + file.source.count;
+            cache->files[i] = cache->files[--cache->files_size];
+            break;
+        }
+    }
+
+    size_t size = 0;
+    for (size_t i = 0; i < cache->files_size; ++i) {
+        size += cache->files[i].canonical_path.count + cache->files[i].source.count;
+    }
+
+    if (cache->forgotten_size > size) {
+        basm_include_cache_compact(cache);
+    }
+
+    basm_include_cache_unlock(cache);
+}
+
+// Returns the index of the file in basm->included_files reading it if
+// it has not been read yet
+static size_t basm_include_file(Basm *basm, String_View file_path)
+{
+    const String_View canonical_path = basm_canonical_path(basm, file_path);
+
+    for (size_t i = 0; i < basm->included_files_size; ++i) {
+        if (sv_eq(basm->included_files[i].canonical_path, canonical_path)) {
+            return i;
+        }
+    }
+
+    const double start = basm_clock();
+    String_View source = {0};
+    if (basm->include_cache != NULL) {
+        source = basm_include_cache_source(basm, basm->include_cache, file_path, canonical_path);
+    } else if (arena_slurp_file(&basm->arena, file_path, &source) < 0) {
+        basm_report_file_error(basm, file_path);
+    }
+    basm->stats.phase_times[BASM_PHASE_READ] += basm_clock() - start;
+
+    basm->included_files = arena_da_reserve(&basm->arena, basm->included_files,
+                                            sizeof(basm->included_files[0]),
+                                            &basm->included_files_capacity,
+                                            basm->included_files_size + 1);
+    basm->included_files[basm->included_files_size] = (Included_File) {
+        .canonical_path = canonical_path,
+        .source = source,
+    };
+
+    return basm->included_files_size++;
+}
+
+static bool is_name(char x);
+
+static bool sv_is_name(String_View sv)
+{
+    if (sv.count == 0 || isdigit(*sv.data)) {
+        return false;
+    }
+
+    for (size_t i = 0; i < sv.count; ++i) {
+        if (!is_name(sv.data[i])) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Chops the lines of the source up to the line that starts with the
+// `end` directive skipping the nested `begin` ... `end` blocks. The
+// location is the location of the `begin` directive.
+static String_View basm_chop_block(String_View *source, File_Location *location,
+                                   const char *begin, const char *end)
+{
+    const File_Location begin_location = *location;
+    const String_View block_start = *source;
+    size_t depth = 0;
+
+    while (source->count > 0) {
+        const char *line_start = source->data;
+        String_View line = sv_trim(sv_chop_by_delim(source, '\n'));
+        line = sv_trim(sv_chop_by_delim(&line, BASM_COMMENT_SYMBOL));
+        location->line_number += 1;
+
+        String_View token = sv_chop_by_delim(&line, ' ');
+        if (sv_eq(token, sv_from_cstr(end))) {
+            if (depth == 0) {
+                return (String_View) {
+                    .count = (size_t) (line_start - block_start.data),
+                    .data = block_start.data,
+                };
+            }
+            depth -= 1;
+        } else if (sv_eq(token, sv_from_cstr(begin))) {
+            depth += 1;
+        }
+    }
+
+    fprintf(stderr, FL_Fmt": ERROR: `%s` is not closed with `%s`\n",
+            FL_Arg(begin_location), begin, end);
+    basm_exit();
+}
+
+static void basm_substitute_append(char *out, size_t *size, const char *data, size_t count)
+{
+    if (out != NULL) {
+        memcpy(out + *size, data, count);
+    }
+    *size += count;
+}
+
+// Copies the text into out replacing the names with the values and
+// `%%label`s with `label__<owner>__<id>` unique to the expansion id of
+// the owner (the name of the macro, `rep` or `unroll`). Returns the size
+// of the result. Only computes the size if out is NULL.
+static size_t basm_substitute(String_View text,
+                              const String_View *names, const String_View *values, size_t count,
+                              String_View owner, size_t id, char *out)
+{
+    char suffix[32];
+    const int suffix_size = snprintf(suffix, sizeof(suffix), "__%zu", id);
+    assert(suffix_size > 0);
+
+    size_t size = 0;
+    while (text.count > 0) {
+        const char x = *text.data;
+        if (x == '"' || x == '\'') {
+            size_t n = 1;
+            while (n < text.count && text.data[n] != x && text.data[n] != '\n') {
+                n += 1;
+            }
+            if (n < text.count && text.data[n] == x) {
+                n += 1;
+            }
+            basm_substitute_append(out, &size, text.data, n);
+            sv_chop_left(&text, n);
+        } else if (x == BASM_COMMENT_SYMBOL) {
+            size_t n = 0;
+            if (!sv_index_of(text, '\n', &n)) {
+                n = text.count;
+            }
+            basm_substitute_append(out, &size, text.data, n);
+            sv_chop_left(&text, n);
+        } else if (x == BASM_PP_SYMBOL && text.count > 1 && text.data[1] == BASM_PP_SYMBOL) {
+            sv_chop_left(&text, 2);
+            String_View label = sv_chop_left_while(&text, is_name);
+            basm_substitute_append(out, &size, label.data, label.count);
+            basm_substitute_append(out, &size, "__", 2);
+            basm_substitute_append(out, &size, owner.data, owner.count);
+            basm_substitute_append(out, &size, suffix, (size_t) suffix_size);
+        } else if (is_name(x)) {
+            String_View name = sv_chop_left_while(&text, is_name);
+            for (size_t i = 0; i < count; ++i) {
+                if (sv_eq(names[i], name)) {
+                    name = values[i];
+                    break;
+                }
+            }
+            basm_substitute_append(out, &size, name.data, name.count);
+        } else {
+            basm_substitute_append(out, &size, text.data, 1);
+            sv_chop_left(&text, 1);
+        }
+    }
+
+    return size;
+}
+
+static void basm_translate_lines(Basm *basm, String_View source, File_Location location, size_t file_index);
+
+// Translates a copy of the text with the names replaced by the values
+static void basm_translate_expansion(Basm *basm, String_View text,
+                                     const String_View *names, const String_View *values, size_t count,
+                                     String_View owner,
+                                     File_Location location, File_Location expansion_location,
+                                     size_t file_index)
+{
+    if (basm->expansion_level + 1 >= BASM_MAX_EXPANSION_LEVEL) {
+        fprintf(stderr, FL_Fmt": ERROR: exceeded maximum expansion level\n",
+                FL_Arg(expansion_location));
+        basm_exit();
+    }
+
+    const size_t id = basm->expansions_count++;
+    const size_t size = basm_substitute(text, names, values, count, owner, id, NULL);
+    char *data = arena_alloc(&basm->arena, size + 1);
+    basm_substitute(text, names, values, count, owner, id, data);
+
+    const File_Location saved_expansion_location = basm->expansion_location;
+    basm->expansion_location = expansion_location;
+    basm->expansion_level += 1;
+    basm_translate_lines(basm, (String_View) {
+        .count = size, .data = data
+    }, location, file_index);
+    basm->expansion_level -= 1;
+    basm->expansion_location = saved_expansion_location;
+}
+
+static void basm_translate_macro_directive(Basm *basm, String_View line,
+        String_View *source, File_Location *location)
+{
+    Macro macro = {
+        .location = *location,
+    };
+
+    line = sv_trim(line);
+    size_t paren = 0;
+    const bool has_params = sv_index_of(line, '(', &paren);
+    macro.name = sv_trim(sv_chop_left(&line, has_params ? paren : line.count));
+    if (!sv_is_name(macro.name)) {
+        fprintf(stderr, FL_Fmt": ERROR: `"SV_Fmt"` is not a valid macro name\n",
+                FL_Arg(macro.location), SV_Arg(macro.name));
+        basm_exit();
+    }
+
+    Inst_Type inst_type = INST_NOP;
+    if (inst_by_name(macro.name, &inst_type)) {
+        fprintf(stderr, FL_Fmt": ERROR: macro `"SV_Fmt"` has the same name as an instruction\n",
+                FL_Arg(macro.location), SV_Arg(macro.name));
+        basm_exit();
+    }
+
+    const Macro *existing = basm_resolve_macro(basm, macro.name);
+    if (existing != NULL) {
+        fprintf(stderr, FL_Fmt": ERROR: macro `"SV_Fmt"` is already defined\n",
+                FL_Arg(macro.location), SV_Arg(macro.name));
+        fprintf(stderr, FL_Fmt": NOTE: the first definition is located here\n",
+                FL_Arg(existing->location));
+        basm_exit();
+    }
+
+    if (has_params) {
+        if (line.data[line.count - 1] != ')') {
+            fprintf(stderr, FL_Fmt": ERROR: the parameters of macro `"SV_Fmt"` are not closed with `)`\n",
+                    FL_Arg(macro.location), SV_Arg(macro.name));
+            basm_exit();
+        }
+        line.data  += 1;
+        line.count -= 2;
+        line = sv_trim(line);
+
+        while (line.count > 0) {
+            const String_View param = sv_trim(sv_chop_by_delim(&line, ','));
+            if (!sv_is_name(param)) {
+                fprintf(stderr, FL_Fmt": ERROR: `"SV_Fmt"` is not a valid name of a macro parameter\n",
+                        FL_Arg(macro.location), SV_Arg(param));
+                basm_exit();
+            }
+
+            if (macro.params_count >= BASM_MACRO_PARAMS_CAPACITY) {
+                fprintf(stderr, FL_Fmt": ERROR: macro `"SV_Fmt"` has more than %d parameters\n",
+                        FL_Arg(macro.location), SV_Arg(macro.name), BASM_MACRO_PARAMS_CAPACITY);
+                basm_exit();
+            }
+
+            macro.params[macro.params_count++] = param;
+        }
+    } else if (line.count > 0) {
+        fprintf(stderr, FL_Fmt": ERROR: unexpected `"SV_Fmt"` after the name of macro `"SV_Fmt"`\n",
+                FL_Arg(macro.location), SV_Arg(line), SV_Arg(macro.name));
+        basm_exit();
+    }
+
+    macro.body = basm_chop_block(source, location, "%macro", "%endmacro");
+
+    basm->macros = arena_da_reserve(&basm->arena, basm->macros,
+                                    sizeof(basm->macros[0]),
+                                    &basm->macros_capacity,
+                                    basm->macros_size + 1);
+    basm->macros[basm->macros_size++] = macro;
+}
+
+static uint64_t basm_eval_count(Basm *basm, String_View source, File_Location location, const char *what)
+{
+    Type type = TYPE_INTEGER;
+    const uint64_t count = basm_expr_eval(
+                               basm,
+                               basm_parse_expr(basm, source, location),
+                               location,
+                               &type).as_u64;
+    if (type != TYPE_INTEGER) {
+        fprintf(stderr, FL_Fmt": ERROR: %s has to be an %s, but got %s\n",
+                FL_Arg(location), what, type_name(TYPE_INTEGER), type_name(type));
+        basm_exit();
+    }
+    return count;
+}
+
+static void basm_translate_rep_directive(Basm *basm, String_View line,
+        String_View *source, File_Location *location,
+        size_t file_index)
+{
+    const File_Location rep_location = *location;
+
+    line = sv_trim(line);
+    const String_View count_source = sv_chop_by_delim(&line, ' ');
+    if (count_source.count == 0) {
+        fprintf(stderr, FL_Fmt": ERROR: repetition count is not provided\n",
+                FL_Arg(rep_location));
+        basm_exit();
+    }
+
+    const String_View counter = sv_trim(line);
+    if (counter.count > 0 && !sv_is_name(counter)) {
+        fprintf(stderr, FL_Fmt": ERROR: `"SV_Fmt"` is not a valid name of a counter\n",
+                FL_Arg(rep_location), SV_Arg(counter));
+        basm_exit();
+    }
+
+    const uint64_t count = basm_eval_count(basm, count_source, rep_location, "repetition count");
+    const String_View body = basm_chop_block(source, location, "%rep", "%endrep");
+
+    for (uint64_t i = 0; i < count; ++i) {
+        char value_cstr[32];
+        snprintf(value_cstr, sizeof(value_cstr), "%"PRIu64, i);
+        const String_View value = sv_from_cstr(value_cstr);
+
+        basm_translate_expansion(basm, body, &counter, &value, counter.count > 0 ? 1 : 0,
+                                 sv_from_cstr("rep"), rep_location, rep_location, file_index);
+    }
+}
+
+// `%unroll K [N]` followed by a loop
+//
+//     label:
+//         <body>
+//         jmp_if label
+//
+// translates the body K times. If the trip count N is provided it has to
+// be a multiple of K and the first K - 1 copies drop the loop condition
+// instead of jumping back. Otherwise every copy leaves the loop if its
+// condition is false, so the loop may run any number of times.
+static void basm_translate_unroll_directive(Basm *basm, String_View line,
+        String_View *source, File_Location *location,
+        size_t file_index)
+{
+    const File_Location unroll_location = *location;
+
+    line = sv_trim(line);
+    if (line.count == 0) {
+        fprintf(stderr, FL_Fmt": ERROR: unroll factor is not provided\n",
+                FL_Arg(unroll_location));
+        basm_exit();
+    }
+
+    const String_View factor_source = sv_chop_by_delim(&line, ' ');
+    const uint64_t factor = basm_eval_count(basm, factor_source, unroll_location, "unroll factor");
+    if (factor == 0) {
+        fprintf(stderr, FL_Fmt": ERROR: unroll factor has to be positive\n",
+                FL_Arg(unroll_location));
+        basm_exit();
+    }
+
+    line = sv_trim(line);
+    const bool has_trip_count = line.count > 0;
+    if (has_trip_count) {
+        const uint64_t trip_count = basm_eval_count(basm, line, unroll_location, "trip count");
+        if (trip_count % factor != 0) {
+            fprintf(stderr, FL_Fmt": ERROR: trip count %"PRIu64" is not a multiple of unroll factor %"PRIu64"\n",
+                    FL_Arg(unroll_location), trip_count, factor);
+            basm_exit();
+        }
+    }
+
+    String_View label = {0};
+    String_View body = {0};
+    File_Location body_location = *location;
+    while (source->count > 0 && label.count == 0) {
+        String_View statement = sv_trim(sv_chop_by_delim(source, '\n'));
+        location->line_number += 1;
+        body_location = *location;
+        body = *source;
+        statement = sv_trim(sv_chop_by_delim(&statement, BASM_COMMENT_SYMBOL));
+        if (statement.count == 0) {
+            continue;
+        }
+
+        label = sv_trim(sv_chop_by_delim(&statement, ' '));
+        if (label.count < 2 || label.data[label.count - 1] != ':') {
+            fprintf(stderr, FL_Fmt": ERROR: `%%unroll` has to be followed by the label of a loop\n",
+                    FL_Arg(unroll_location));
+            basm_exit();
+        }
+        label.count -= 1;
+
+        // NOTE: the instruction after the label belongs to the body
+        body.count += (size_t) (body.data - statement.data);
+        body.data = statement.data;
+        body_location.line_number -= 1;
+    }
+
+    if (label.count == 0) {
+        fprintf(stderr, FL_Fmt": ERROR: `%%unroll` has to be followed by the label of a loop\n",
+                FL_Arg(unroll_location));
+        basm_exit();
+    }
+
+    String_View back_edge = {0};
+    File_Location back_edge_location = *location;
+    while (source->count > 0 && back_edge.count == 0) {
+        const char *line_start = source->data;
+        String_View statement = sv_trim(sv_chop_by_delim(source, '\n'));
+        statement = sv_trim(sv_chop_by_delim(&statement, BASM_COMMENT_SYMBOL));
+        location->line_number += 1;
+
+        const String_View full_statement = statement;
+        const String_View token = sv_chop_by_delim(&statement, ' ');
+        if (sv_eq(token, sv_from_cstr("jmp_if")) && sv_eq(sv_trim(statement), label)) {
+            back_edge = full_statement;
+            back_edge_location.line_number = location->line_number - 1;
+            body.count = (size_t) (line_start - body.data);
+        }
+    }
+
+    if (back_edge.count == 0) {
+        fprintf(stderr, FL_Fmt": ERROR: the loop `"SV_Fmt"` is not closed with `jmp_if "SV_Fmt"`\n",
+                FL_Arg(unroll_location), SV_Arg(label), SV_Arg(label));
+        basm_exit();
+    }
+
+    basm_bind_value(basm, label, word_u64(basm->program_size), TYPE_INST_ADDR, BINDING_LABEL, body_location);
+
+    // The copies that are not the last one jump here if their condition
+    // is false
+    char exit_label_cstr[256];
+    snprintf(exit_label_cstr, sizeof(exit_label_cstr), SV_Fmt"__unroll_exit__%zu",
+             SV_Arg(label), basm->expansions_count++);
+    const String_View exit_label = arena_sv_dup(&basm->arena, sv_from_cstr(exit_label_cstr));
+    const String_View exit_check = sv_from_cstr(CSTR_CONCAT(&basm->arena, "not\njmp_if ", exit_label_cstr));
+
+    for (uint64_t i = 0; i < factor; ++i) {
+        basm_translate_expansion(basm, body, NULL, NULL, 0, sv_from_cstr("unroll"),
+                                 body_location, unroll_location, file_index);
+        if (i + 1 < factor) {
+            if (has_trip_count) {
+                basm_push_inst(basm, INST_DROP);
+            } else {
+                basm_translate_lines(basm, exit_check, unroll_location, file_index);
+            }
+        }
+    }
+
+    basm_translate_lines(basm, back_edge, back_edge_location, file_index);
+
+    if (!has_trip_count) {
+        basm_bind_value(basm, exit_label, word_u64(basm->program_size),
+                        TYPE_INST_ADDR, BINDING_LABEL, unroll_location);
+    }
+}
+
+// `%sig <name> <in> -> <out>`
+static void basm_translate_sig_directive(Basm *basm, String_View line, File_Location location)
+{
+    line = sv_trim(line);
+    const String_View name = sv_chop_by_delim(&line, ' ');
+    if (name.count == 0) {
+        fprintf(stderr, FL_Fmt": ERROR: name of the function is not provided\n",
+                FL_Arg(location));
+        basm_exit();
+    }
+
+    size_t arrow = 0;
+    while (arrow + 1 < line.count && !(line.data[arrow] == '-' && line.data[arrow + 1] == '>')) {
+        arrow += 1;
+    }
+
+    const String_View in = sv_trim(sv_chop_left(&line, arrow));
+    sv_chop_left(&line, 2);
+    const String_View out = sv_trim(line);
+    if (in.count == 0 || out.count == 0) {
+        fprintf(stderr, FL_Fmt": ERROR: expected `%%sig <name> <in> -> <out>`\n",
+                FL_Arg(location));
+        basm_exit();
+    }
+
+    basm_push_signature_hint(basm, (Signature_Hint) {
+        .name = name,
+        .in = basm_eval_count(basm, in, location, "number of the inputs"),
+        .out = basm_eval_count(basm, out, location, "number of the outputs"),
+        .location = location,
+    });
+}
+
+// Splits `(arg, arg, ...)` by the commas that are not inside of the
+// nested parenthesis or the quotes
+static size_t basm_split_macro_args(String_View args, String_View *result, size_t capacity, File_Location location)
+{
+    assert(args.count >= 2);
+    args.data  += 1;
+    args.count -= 2;
+    if (sv_trim(args).count == 0) {
+        return 0;
+    }
+
+    size_t count = 0;
+    size_t depth = 0;
+    char quote = 0;
+    size_t start = 0;
+    for (size_t i = 0; i <= args.count; ++i) {
+        const char x = i < args.count ? args.data[i] : ',';
+        if (quote != 0) {
+            if (x == quote) {
+                quote = 0;
+            }
+        } else if (x == '"' || x == '\'') {
+            quote = x;
+        } else if (x == '(') {
+            depth += 1;
+        } else if (x == ')' && depth > 0) {
+            depth -= 1;
+        } else if (x == ',' && depth == 0) {
+            if (count >= capacity) {
+                fprintf(stderr, FL_Fmt": ERROR: too many macro arguments\n",
+                        FL_Arg(location));
+                basm_exit();
+            }
+            result[count++] = sv_trim((String_View) {
+                .count = i - start,
+                .data = args.data + start,
+            });
+            start = i + 1;
+        }
+    }
+
+    return count;
+}
+
+static void basm_expand_macro(Basm *basm, const Macro *macro, String_View args,
+                              File_Location location, size_t file_index)
+{
+    String_View values[BASM_MACRO_PARAMS_CAPACITY];
+    size_t values_count = 0;
+
+    args = sv_trim(args);
+    if (args.count > 0) {
+        if (*args.data != '(' || args.data[args.count - 1] != ')') {
+            fprintf(stderr, FL_Fmt": ERROR: the arguments of macro `"SV_Fmt"` have to be surrounded with parenthesis\n",
+                    FL_Arg(location), SV_Arg(macro->name));
+            basm_exit();
+        }
+        values_count = basm_split_macro_args(args, values, BASM_MACRO_PARAMS_CAPACITY, location);
+    }
+
+    if (values_count != macro->params_count) {
+        fprintf(stderr, FL_Fmt": ERROR: macro `"SV_Fmt"` expects %zu arguments, but got %zu\n",
+                FL_Arg(location), SV_Arg(macro->name), macro->params_count, values_count);
+        fprintf(stderr, FL_Fmt": NOTE: the macro is defined here\n",
+                FL_Arg(macro->location));
+        basm_exit();
+    }
+
+    basm_translate_expansion(basm, macro->body, macro->params, values, values_count,
+                             macro->name, macro->location, location, file_index);
+}
+
+void basm_resolve_deferred_operands(Basm *basm)
+{
+    for (size_t i = 0; i < basm->deferred_operands_size; ++i) {
+        Expr_Node root = expr_root(basm->deferred_operands[i].expr);
+        assert(root.kind == EXPR_KIND_BINDING);
+        String_View name = root.value.as_binding;
+
+        Inst_Addr addr = basm->deferred_operands[i].addr;
+        Binding *binding = basm_resolve_binding(basm, name);
+        if (binding == NULL && basm->relocatable) {
+            basm_push_import(basm, basm->deferred_operands[i]);
+            continue;
+        }
+
+        if (binding == NULL) {
+            fprintf(stderr, FL_Fmt": ERROR: unknown binding `"SV_Fmt"`\n",
+                    FL_Arg(basm->deferred_operands[i].location),
+                    SV_Arg(name));
+            basm_exit();
+        }
 
-        basm_bind_expr(basm, name, expr, binding_kind, location);
+        if (basm->program[addr].type == INST_CALL && binding->kind != BINDING_LABEL) {
+            fprintf(stderr, FL_Fmt": ERROR: trying to call not a label. `"SV_Fmt"` is %s, but the call instructions accepts only literals or labels.\n", FL_Arg(basm->deferred_operands[i].location), SV_Arg(name), binding_kind_as_cstr(binding->kind));
+            basm_exit();
+        }
 
-    } else {
-        fprintf(stderr,
-                FL_Fmt": ERROR: binding name is not provided\n",
-                FL_Arg(location));
-        exit(1);
-    }
-}
+        if (basm->program[addr].type == INST_NATIVE && binding->kind != BINDING_NATIVE) {
+            fprintf(stderr, FL_Fmt": ERROR: trying to invoke native function from a binding that is %s. Bindings for native functions have to be defined via `%%native` basm directive.\n", FL_Arg(basm->deferred_operands[i].location), binding_kind_as_cstr(binding->kind));
+            basm_exit();
+        }
 
-void basm_translate_source(Basm *basm, String_View input_file_path)
-{
-    String_View original_source = {0};
-    if (arena_slurp_file(&basm->arena, input_file_path, &original_source) < 0) {
-        if (basm->include_level > 0) {
-            fprintf(stderr, FL_Fmt": ERROR: could not read file `"SV_Fmt"`: %s\n",
-                    FL_Arg(basm->include_location),
-                    SV_Arg(input_file_path), strerror(errno));
-        } else {
-            fprintf(stderr, "ERROR: could not read file `"SV_Fmt"`: %s\n",
-                    SV_Arg(input_file_path), strerror(errno));
+        Type type = TYPE_INTEGER;
+        basm->program[addr].operand = basm_binding_eval(basm, binding, basm->deferred_operands[i].location, &type);
+        if (basm_tracks_relocations(basm) && type_is_addr(type)) {
+            basm_push_relocation(basm, addr, type);
         }
-        exit(1);
     }
 
-    String_View source = original_source;
-
-    File_Location location = {
-        .file_path = input_file_path,
-    };
+    basm->deferred_operands_size = 0;
+}
 
-    // First pass
+// The first pass. Translates the instructions and the directives and
+// defers the operands that refer to the bindings.
+static void basm_translate_lines(Basm *basm, String_View source, File_Location location, size_t file_index)
+{
     while (source.count > 0) {
         String_View line = sv_trim(sv_chop_by_delim(&source, '\n'));
         line = sv_trim(sv_chop_by_delim(&line, BASM_COMMENT_SYMBOL));
         location.line_number += 1;
+        basm->stats.lines_count += 1;
         if (line.count > 0) {
             String_View token = sv_trim(sv_chop_by_delim(&line, ' '));
 
@@ -215,17 +1850,27 @@ void basm_translate_source(Basm *basm, String_View input_file_path)
                 token.data  += 1;
                 if (sv_eq(token, sv_from_cstr("bind"))) {
                     fprintf(stderr, FL_Fmt": ERROR: %%bind directive has been removed! Use %%const directive to define consts. Use %%native directive to define native functions.\n", FL_Arg(location));
-                    exit(1);
+                    basm_exit();
                 } else if (sv_eq(token, sv_from_cstr("const"))) {
                     basm_translate_bind_directive(basm, &line, location, BINDING_CONST);
                 } else if (sv_eq(token, sv_from_cstr("native"))) {
                     basm_translate_bind_directive(basm, &line, location, BINDING_NATIVE);
                 } else if (sv_eq(token, sv_from_cstr("assert"))) {
-                    Expr expr = parse_expr_from_sv(&basm->arena, sv_trim(line), location);
-                    basm->deferred_asserts[basm->deferred_asserts_size++] = (Deferred_Assert) {
-                        .expr = expr,
-                        .location = location,
-                    };
+                    Expr expr = basm_parse_expr(basm, sv_trim(line), location);
+                    basm_push_deferred_assert(basm, expr, location);
+                } else if (sv_eq(token, sv_from_cstr("table"))) {
+                    basm_translate_table_directive(basm, line, location);
+                } else if (sv_eq(token, sv_from_cstr("pragma"))) {
+                    line = sv_trim(line);
+                    if (sv_eq(line, sv_from_cstr("once"))) {
+                        basm->included_files[file_index].once = true;
+                    } else if (sv_eq(line, sv_from_cstr("intern_strings"))) {
+                        basm->intern_strings = true;
+                    } else {
+                        fprintf(stderr, FL_Fmt": ERROR: unknown pragma `"SV_Fmt"`\n",
+                                FL_Arg(location), SV_Arg(line));
+                        basm_exit();
+                    }
                 } else if (sv_eq(token, sv_from_cstr("include"))) {
                     line = sv_trim(line);
 
@@ -239,7 +1884,7 @@ void basm_translate_source(Basm *basm, String_View input_file_path)
                                 fprintf(stderr,
                                         FL_Fmt": ERROR: exceeded maximum include level\n",
                                         FL_Arg(location));
-                                exit(1);
+                                basm_exit();
                             }
 
                             {
@@ -254,34 +1899,58 @@ void basm_translate_source(Basm *basm, String_View input_file_path)
                             fprintf(stderr,
                                     FL_Fmt": ERROR: include file path has to be surrounded with quotation marks\n",
                                     FL_Arg(location));
-                            exit(1);
+                            basm_exit();
                         }
                     } else {
                         fprintf(stderr,
                                 FL_Fmt": ERROR: include file path is not provided\n",
                                 FL_Arg(location));
-                        exit(1);
+                        basm_exit();
                     }
+                } else if (sv_eq(token, sv_from_cstr("macro"))) {
+                    basm_translate_macro_directive(basm, line, &source, &location);
+                } else if (sv_eq(token, sv_from_cstr("endmacro"))) {
+                    fprintf(stderr, FL_Fmt": ERROR: `%%endmacro` without `%%macro`\n",
+                            FL_Arg(location));
+                    basm_exit();
+                } else if (sv_eq(token, sv_from_cstr("rep"))) {
+                    basm_translate_rep_directive(basm, line, &source, &location, file_index);
+                } else if (sv_eq(token, sv_from_cstr("endrep"))) {
+                    fprintf(stderr, FL_Fmt": ERROR: `%%endrep` without `%%rep`\n",
+                            FL_Arg(location));
+                    basm_exit();
+                } else if (sv_eq(token, sv_from_cstr("unroll"))) {
+                    basm_translate_unroll_directive(basm, line, &source, &location, file_index);
+                } else if (sv_eq(token, sv_from_cstr("sig"))) {
+                    basm_translate_sig_directive(basm, line, location);
+                } else if (sv_eq(token, sv_from_cstr("inline"))) {
+                    line = sv_trim(line);
+                    if (line.count == 0) {
+                        fprintf(stderr, FL_Fmt": ERROR: name of the function to inline is not provided\n",
+                                FL_Arg(location));
+                        basm_exit();
+                    }
+                    basm_push_inline_hint(basm, line, location);
                 } else if (sv_eq(token, sv_from_cstr("entry"))) {
                     if (basm->has_entry) {
                         fprintf(stderr,
                                 FL_Fmt": ERROR: entry point has been already set!\n",
                                 FL_Arg(location));
                         fprintf(stderr, FL_Fmt": NOTE: the first entry point\n", FL_Arg(basm->entry_location));
-                        exit(1);
+                        basm_exit();
                     }
 
                     line = sv_trim(line);
 
-                    Expr expr = parse_expr_from_sv(&basm->arena, line, location);
+                    Expr expr = basm_parse_expr(basm, line, location);
 
-                    if (expr.kind != EXPR_KIND_BINDING) {
+                    if (expr_root(expr).kind != EXPR_KIND_BINDING) {
                         fprintf(stderr, FL_Fmt": ERROR: only bindings are allowed to be set as entry points for now.\n",
                                 FL_Arg(location));
-                        exit(1);
+                        basm_exit();
                     }
 
-                    basm->deferred_entry_binding_name = expr.value.as_binding;
+                    basm->deferred_entry_binding_name = expr_root(expr).value.as_binding;
                     basm->has_entry = true;
                     basm->entry_location = location;
                 } else {
@@ -289,7 +1958,7 @@ void basm_translate_source(Basm *basm, String_View input_file_path)
                             FL_Fmt": ERROR: unknown pre-processor directive `"SV_Fmt"`\n",
                             FL_Arg(location),
                             SV_Arg(token));
-                    exit(1);
+                    basm_exit();
 
                 }
             } else {
@@ -300,87 +1969,106 @@ void basm_translate_source(Basm *basm, String_View input_file_path)
                         .data = token.data
                     };
 
-                    basm_bind_value(basm, label, word_u64(basm->program_size), BINDING_LABEL, location);
+                    basm_bind_value(basm, label, word_u64(basm->program_size), TYPE_INST_ADDR, BINDING_LABEL, location);
                     token = sv_trim(sv_chop_by_delim(&line, ' '));
                 }
 
-                // Instruction
-                if (token.count > 0) {
+                String_View macro_name = token;
+                macro_name = sv_chop_by_delim(&macro_name, '(');
+                const Macro *macro = basm_resolve_macro(basm, macro_name);
+
+                // Macro expansion or instruction
+                if (token.count > 0 && macro != NULL) {
+                    const String_View args = {
+                        .count = (size_t) (line.data + line.count - (macro_name.data + macro_name.count)),
+                        .data = macro_name.data + macro_name.count,
+                    };
+                    basm_expand_macro(basm, macro, args, location, file_index);
+                } else if (token.count > 0) {
                     String_View operand = line;
                     Inst_Type inst_type = INST_NOP;
                     if (inst_by_name(token, &inst_type)) {
-                        assert(basm->program_size < BM_PROGRAM_CAPACITY);
-                        basm->program[basm->program_size].type = inst_type;
+                        const Inst_Addr addr = basm->program_size;
+                        basm_push_inst(basm, inst_type);
 
                         if (inst_has_operand(inst_type)) {
                             if (operand.count == 0) {
                                 fprintf(stderr, FL_Fmt": ERROR: instruction `"SV_Fmt"` requires an operand\n",
                                         FL_Arg(location),
                                         SV_Arg(token));
-                                exit(1);
+                                basm_exit();
                             }
 
-                            Expr expr = parse_expr_from_sv(&basm->arena, operand, location);
+                            Expr expr = basm_parse_expr(basm, operand, location);
 
-                            if (expr.kind == EXPR_KIND_BINDING) {
-                                basm_push_deferred_operand(basm, basm->program_size, expr, location);
+                            if (expr_root(expr).kind == EXPR_KIND_BINDING) {
+                                basm_push_deferred_operand(basm, addr, expr, location);
                             } else {
-                                assert(expr.kind != EXPR_KIND_BINDING);
-                                basm->program[basm->program_size].operand =
-                                    basm_expr_eval(basm, expr, location);
+                                Type type = TYPE_INTEGER;
+                                basm->program[addr].operand =
+                                    basm_expr_eval(basm, expr, location, &type);
+                                if (basm_tracks_relocations(basm) && type_is_addr(type)) {
+                                    basm_push_relocation(basm, addr, type);
+                                }
                             }
                         }
-
-                        basm->program_size += 1;
                     } else {
                         fprintf(stderr, FL_Fmt": ERROR: unknown instruction `"SV_Fmt"`\n",
                                 FL_Arg(location),
                                 SV_Arg(token));
-                        exit(1);
+                        basm_exit();
                     }
                 }
             }
         }
     }
 
-    // Second pass
-    for (size_t i = 0; i < basm->deferred_operands_size; ++i) {
-        Expr expr = basm->deferred_operands[i].expr;
-        assert(expr.kind == EXPR_KIND_BINDING);
-        String_View name = expr.value.as_binding;
+}
 
-        Inst_Addr addr = basm->deferred_operands[i].addr;
-        Binding *binding = basm_resolve_binding(basm, name);
-        if (binding == NULL) {
-            fprintf(stderr, FL_Fmt": ERROR: unknown binding `"SV_Fmt"`\n",
-                    FL_Arg(basm->deferred_operands[i].location),
-                    SV_Arg(name));
-            exit(1);
-        }
+void basm_translate_source(Basm *basm, String_View input_file_path)
+{
+    // NOTE: don't keep a pointer to the Included_File. The nested
+    // includes may reallocate the included_files.
+    const size_t file_index = basm_include_file(basm, input_file_path);
+    if (basm->included_files[file_index].once) {
+        return;
+    }
 
-        if (basm->program[addr].type == INST_CALL && binding->kind != BINDING_LABEL) {
-            fprintf(stderr, FL_Fmt": ERROR: trying to call not a label. `"SV_Fmt"` is %s, but the call instructions accepts only literals or labels.\n", FL_Arg(basm->deferred_operands[i].location), SV_Arg(name), binding_kind_as_cstr(binding->kind));
-            exit(1);
-        }
+    File_Location location = {
+        .file_path = input_file_path,
+    };
 
-        if (basm->program[addr].type == INST_NATIVE && binding->kind != BINDING_NATIVE) {
-            fprintf(stderr, FL_Fmt": ERROR: trying to invoke native function from a binding that is %s. Bindings for native functions have to be defined via `%%native` basm directive.\n", FL_Arg(basm->deferred_operands[i].location), binding_kind_as_cstr(binding->kind));
-            exit(1);
-        }
+    const double read_time = basm->stats.phase_times[BASM_PHASE_READ];
+    const double first_pass_start = basm_clock();
+
+    basm_translate_lines(basm, basm->included_files[file_index].source, location, file_index);
 
-        basm->program[addr].operand = basm_binding_eval(basm, binding, basm->deferred_operands[i].location);
+    // NOTE: the included files may refer to the bindings of the files
+    // that include them, so the second pass waits for the whole program
+    if (basm->include_level > 0) {
+        return;
     }
 
+    const double second_pass_start = basm_clock();
+    basm->stats.phase_times[BASM_PHASE_FIRST_PASS] +=
+        second_pass_start - first_pass_start -
+        (basm->stats.phase_times[BASM_PHASE_READ] - read_time);
+    basm->stats.deferred_operands_count += basm->deferred_operands_size;
+
+    // Second pass
+    basm_resolve_deferred_operands(basm);
+
     // Eval deferred asserts
     for (size_t i = 0; i < basm->deferred_asserts_size; ++i) {
         Word value = basm_expr_eval(
                          basm,
                          basm->deferred_asserts[i].expr,
-                         basm->deferred_asserts[i].location);
+                         basm->deferred_asserts[i].location,
+                         NULL);
         if (!value.as_u64) {
             fprintf(stderr, FL_Fmt": ERROR: assertion failed\n",
                     FL_Arg(basm->deferred_asserts[i].location));
-            exit(1);
+            basm_exit();
         }
     }
 
@@ -393,125 +2081,398 @@ void basm_translate_source(Basm *basm, String_View input_file_path)
             fprintf(stderr, FL_Fmt": ERROR: unknown binding `"SV_Fmt"`\n",
                     FL_Arg(basm->entry_location),
                     SV_Arg(basm->deferred_entry_binding_name));
-            exit(1);
+            basm_exit();
         }
 
         if (binding->kind != BINDING_LABEL) {
             fprintf(stderr, FL_Fmt": ERROR: trying to set a %s as an entry point. Entry point has to be a label.\n", FL_Arg(basm->entry_location), binding_kind_as_cstr(binding->kind));
-            exit(1);
+            basm_exit();
         }
 
-        basm->entry = basm_binding_eval(basm, binding, basm->entry_location).as_u64;
+        basm->entry = basm_binding_eval(basm, binding, basm->entry_location, NULL).as_u64;
+    }
+
+    // NOTE: all the bindings of a relocatable object are exported, so
+    // every one of them needs a value. The optimizer needs them to know
+    // which of the instructions are jumped to.
+    if (basm->relocatable || basm->optimize) {
+        for (size_t i = 0; i < basm->bindings_size; ++i) {
+            basm_binding_eval(basm, &basm->bindings[i], basm->bindings[i].location, NULL);
+        }
     }
+
+    basm->stats.phase_times[BASM_PHASE_SECOND_PASS] += basm_clock() - second_pass_start;
 }
 
-Word basm_binding_eval(Basm *basm, Binding *binding, File_Location location)
+Word basm_binding_eval(Basm *basm, Binding *binding, File_Location location, Type *type)
 {
     if (binding->status == BINDING_EVALUATING) {
         fprintf(stderr, FL_Fmt": ERROR: cycling binding definition.\n",
                 FL_Arg(binding->location));
-        exit(1);
+        basm_exit();
     }
 
     if (binding->status == BINDING_UNEVALUATED) {
         binding->status = BINDING_EVALUATING;
-        Word value = basm_expr_eval(basm, binding->expr, location);
+        Type value_type = TYPE_INTEGER;
+        Word value = basm_expr_eval(basm, binding->expr, location, &value_type);
         binding->status = BINDING_EVALUATED;
         binding->value = value;
+        binding->type = value_type;
+    }
+
+    if (type) {
+        *type = binding->type;
     }
 
     return binding->value;
 }
 
-static Word basm_binary_op_eval(Basm *basm, Binary_Op *binary_op, File_Location location)
+static Word basm_float_binary_op_eval(Binary_Op_Kind kind, double left, double right, File_Location location, Type *type)
 {
-    Word left = basm_expr_eval(basm, binary_op->left, location);
-    Word right = basm_expr_eval(basm, binary_op->right, location);
+    *type = TYPE_INTEGER;
 
-    switch (binary_op->kind) {
-    case BINARY_OP_PLUS: {
-        // TODO(#183): compile-time sum can only work with integers
-        return word_u64(left.as_u64 + right.as_u64);
+    switch (kind) {
+    case BINARY_OP_PLUS:
+        *type = TYPE_FLOAT;
+        return word_f64(left + right);
+    case BINARY_OP_MINUS:
+        *type = TYPE_FLOAT;
+        return word_f64(left - right);
+    case BINARY_OP_MULT:
+        *type = TYPE_FLOAT;
+        return word_f64(left * right);
+    case BINARY_OP_DIV:
+        *type = TYPE_FLOAT;
+        return word_f64(left / right);
+
+    case BINARY_OP_GT:
+        return word_u64(left > right);
+    case BINARY_OP_LT:
+        return word_u64(left < right);
+    case BINARY_OP_GE:
+        return word_u64(left >= right);
+    case BINARY_OP_LE:
+        return word_u64(left <= right);
+    case BINARY_OP_EQ:
+        return word_u64(left == right);
+    case BINARY_OP_NE:
+        return word_u64(left != right);
+
+    case BINARY_OP_MOD:
+    case BINARY_OP_SHL:
+    case BINARY_OP_SHR:
+    case BINARY_OP_AND:
+    case BINARY_OP_OR:
+    case BINARY_OP_XOR: {
+        fprintf(stderr, FL_Fmt": ERROR: operator `%s` is not defined for %s operands\n",
+                FL_Arg(location), binary_op_kind_name(kind), type_name(TYPE_FLOAT));
+        basm_exit();
     }
-    break;
 
-    case BINARY_OP_GT: {
-        return word_u64(left.as_u64 > right.as_u64);
+    default: {
+        assert(false && "basm_float_binary_op_eval: unreachable");
+        exit(1);
     }
-    break;
+    }
+}
+
+static Word basm_integer_binary_op_eval(Binary_Op_Kind kind, Word left, Word right, File_Location location, Type *type)
+{
+    *type = TYPE_INTEGER;
+
+    switch (kind) {
+    case BINARY_OP_PLUS:
+        return word_u64(left.as_u64 + right.as_u64);
+    case BINARY_OP_MINUS:
+        return word_u64(left.as_u64 - right.as_u64);
+    case BINARY_OP_MULT:
+        return word_u64(left.as_u64 * right.as_u64);
+
+    case BINARY_OP_DIV:
+    case BINARY_OP_MOD: {
+        if (right.as_i64 == 0) {
+            fprintf(stderr, FL_Fmt": ERROR: division by zero\n",
+                    FL_Arg(location));
+            basm_exit();
+        }
+
+        // NOTE: INT64_MIN / -1 overflows. Wrap it around the same way the
+        // rest of the integer operations do.
+        if (right.as_i64 == -1) {
+            return kind == BINARY_OP_DIV ? word_u64(~left.as_u64 + 1) : word_u64(0);
+        }
+
+        return kind == BINARY_OP_DIV
+               ? word_i64(left.as_i64 / right.as_i64)
+               : word_i64(left.as_i64 % right.as_i64);
+    }
+
+    case BINARY_OP_SHL:
+        return word_u64(right.as_u64 < 64 ? left.as_u64 << right.as_u64 : 0);
+    case BINARY_OP_SHR:
+        return word_u64(right.as_u64 < 64 ? left.as_u64 >> right.as_u64 : 0);
+    case BINARY_OP_AND:
+        return word_u64(left.as_u64 & right.as_u64);
+    case BINARY_OP_OR:
+        return word_u64(left.as_u64 | right.as_u64);
+    case BINARY_OP_XOR:
+        return word_u64(left.as_u64 ^ right.as_u64);
+
+    case BINARY_OP_GT:
+        return word_u64(left.as_i64 > right.as_i64);
+    case BINARY_OP_LT:
+        return word_u64(left.as_i64 < right.as_i64);
+    case BINARY_OP_GE:
+        return word_u64(left.as_i64 >= right.as_i64);
+    case BINARY_OP_LE:
+        return word_u64(left.as_i64 <= right.as_i64);
+    case BINARY_OP_EQ:
+        return word_u64(left.as_u64 == right.as_u64);
+    case BINARY_OP_NE:
+        return word_u64(left.as_u64 != right.as_u64);
 
     default: {
-        assert(false && "basm_binary_op_eval: unreachable");
+        assert(false && "basm_integer_binary_op_eval: unreachable");
         exit(1);
     }
     }
 }
 
-Word basm_expr_eval(Basm *basm, Expr expr, File_Location location)
+bool type_is_addr(Type type)
 {
-    switch (expr.kind) {
-    case EXPR_KIND_LIT_INT:
-        return word_u64(expr.value.as_lit_int);
+    return type == TYPE_INST_ADDR || type == TYPE_MEMORY_ADDR;
+}
 
-    case EXPR_KIND_LIT_FLOAT:
-        return word_f64(expr.value.as_lit_float);
+// Only `addr + int`, `int + addr` and `addr - int` produce an address. The
+// rest of the operations treat addresses as plain integers.
+static bool basm_binary_op_addr_type(Binary_Op_Kind kind, Type left, Type right, Type *type)
+{
+    if (kind == BINARY_OP_PLUS && type_is_addr(left) && right == TYPE_INTEGER) {
+        *type = left;
+        return true;
+    }
 
-    case EXPR_KIND_LIT_CHAR:
-        return word_u64((uint64_t) expr.value.as_lit_char);
+    if (kind == BINARY_OP_PLUS && left == TYPE_INTEGER && type_is_addr(right)) {
+        *type = right;
+        return true;
+    }
 
-    case EXPR_KIND_LIT_STR:
-        return basm_push_string_to_memory(basm, expr.value.as_lit_str);
-
-    case EXPR_KIND_FUNCALL: {
-        if (sv_eq(expr.value.as_funcall->name, sv_from_cstr("len"))) {
-            const size_t actual_arity = funcall_args_len(expr.value.as_funcall->args);
-            if (actual_arity != 1) {
-                fprintf(stderr, FL_Fmt": ERROR: len() expects 1 argument but got %zu\n",
-                        FL_Arg(location), actual_arity);
-                exit(1);
+    if (kind == BINARY_OP_MINUS && type_is_addr(left) && right == TYPE_INTEGER) {
+        *type = left;
+        return true;
+    }
+
+    return false;
+}
+
+// NOTE: the difference and the comparisons of two addresses of the same
+// type do not depend on where the linker puts them
+static bool binary_op_is_relocatable(Binary_Op_Kind kind, Type left, Type right)
+{
+    if (!type_is_addr(left) && !type_is_addr(right)) {
+        return true;
+    }
+
+    if (left != right) {
+        return false;
+    }
+
+    switch (kind) {
+    case BINARY_OP_MINUS:
+    case BINARY_OP_GT:
+    case BINARY_OP_LT:
+    case BINARY_OP_GE:
+    case BINARY_OP_LE:
+    case BINARY_OP_EQ:
+    case BINARY_OP_NE:
+        return true;
+
+    case BINARY_OP_PLUS:
+    case BINARY_OP_MULT:
+    case BINARY_OP_DIV:
+    case BINARY_OP_MOD:
+    case BINARY_OP_SHL:
+    case BINARY_OP_SHR:
+    case BINARY_OP_AND:
+    case BINARY_OP_OR:
+    case BINARY_OP_XOR:
+        return false;
+
+    default:
+        assert(false && "binary_op_is_relocatable: unreachable");
+        exit(1);
+    }
+}
+
+static Typed_Word basm_binary_op_eval(Basm *basm, Binary_Op_Kind kind, Typed_Word left, Typed_Word right, File_Location location)
+{
+    Typed_Word result = {0};
+
+    if (left.type == TYPE_FLOAT || right.type == TYPE_FLOAT) {
+        // NOTE: integers are promoted to floats the same way the i2f instruction does it
+        double left_f64 = left.type == TYPE_FLOAT ? left.word.as_f64 : (double) left.word.as_i64;
+        double right_f64 = right.type == TYPE_FLOAT ? right.word.as_f64 : (double) right.word.as_i64;
+        result.word = basm_float_binary_op_eval(kind, left_f64, right_f64, location, &result.type);
+    } else {
+        result.word = basm_integer_binary_op_eval(kind, left.word, right.word, location, &result.type);
+    }
+
+    if (basm_binary_op_addr_type(kind, left.type, right.type, &result.type)) {
+        return result;
+    }
+
+    if (basm->relocatable && !binary_op_is_relocatable(kind, left.type, right.type)) {
+        fprintf(stderr, FL_Fmt": ERROR: operator `%s` can't be applied to %s and %s in a relocatable object, the result depends on where the linker puts them\n",
+                FL_Arg(location), binary_op_kind_name(kind), type_name(left.type), type_name(right.type));
+        basm_exit();
+    }
+
+    if (basm->optimize && (left.type == TYPE_INST_ADDR || right.type == TYPE_INST_ADDR)) {
+        fprintf(stderr, FL_Fmt": ERROR: operator `%s` can't be applied to %s and %s when optimizing, the result depends on the instructions the optimizer removes\n",
+                FL_Arg(location), binary_op_kind_name(kind), type_name(left.type), type_name(right.type));
+        basm_exit();
+    }
+
+    return result;
+}
+
+static void basm_eval_stack_push(Basm *basm, Typed_Word value)
+{
+    basm->eval_stack = arena_da_reserve(&basm->arena, basm->eval_stack,
+                                        sizeof(basm->eval_stack[0]),
+                                        &basm->eval_stack_capacity,
+                                        basm->eval_stack_size + 1);
+    basm->eval_stack[basm->eval_stack_size++] = value;
+}
+
+static Typed_Word basm_eval_stack_pop(Basm *basm)
+{
+    assert(basm->eval_stack_size > 0);
+    return basm->eval_stack[--basm->eval_stack_size];
+}
+
+Word basm_expr_eval(Basm *basm, Expr expr, File_Location location, Type *type)
+{
+    // NOTE: the bindings the expression refers to are evaluated on top
+    // of the same stack, so only the part of it above base belongs to
+    // this expression. Don't keep pointers into the stack across the
+    // iterations, it may be reallocated by the nested evaluations.
+    const size_t base = basm->eval_stack_size;
+
+    for (size_t i = 0; i < expr.count; ++i) {
+        const Expr_Node *node = &expr.nodes[i];
+        Typed_Word result = {0};
+
+        switch (node->kind) {
+        case EXPR_KIND_LIT_INT:
+            result.word = word_u64(node->value.as_lit_int);
+            break;
+
+        case EXPR_KIND_LIT_FLOAT:
+            result.word = word_f64(node->value.as_lit_float);
+            result.type = TYPE_FLOAT;
+            break;
+
+        case EXPR_KIND_LIT_CHAR:
+            result.word = word_u64((uint64_t) node->value.as_lit_char);
+            break;
+
+        case EXPR_KIND_LIT_STR:
+            result.word = basm_push_string_to_memory(basm, node->value.as_lit_str);
+            result.type = TYPE_MEMORY_ADDR;
+            break;
+
+        case EXPR_KIND_FUNCALL: {
+            const Funcall funcall = node->value.as_funcall;
+            if (sv_eq(funcall.name, sv_from_cstr("len"))) {
+                if (funcall.arity != 1) {
+                    fprintf(stderr, FL_Fmt": ERROR: len() expects 1 argument but got %zu\n",
+                            FL_Arg(location), funcall.arity);
+                    basm_exit();
+                }
+
+                Word addr = basm_eval_stack_pop(basm).word;
+                if (!basm_string_length_by_addr(basm, addr.as_u64, &result.word)) {
+                    fprintf(stderr, FL_Fmt": ERROR: Could not compute the length of string at address %"PRIu64"\n", FL_Arg(location), addr.as_u64);
+                    basm_exit();
+                }
+            } else {
+                fprintf(stderr,
+                        FL_Fmt": ERROR: Unknown translation time function `"SV_Fmt"`\n",
+                        FL_Arg(location), SV_Arg(funcall.name));
+                basm_exit();
+            }
+        }
+        break;
+
+        case EXPR_KIND_BINDING: {
+            String_View name = node->value.as_binding;
+
+            if (basm->has_table_index && sv_eq(name, sv_from_cstr(BASM_TABLE_INDEX_NAME))) {
+                result.word = word_u64(basm->table_index);
+                break;
             }
 
-            Word addr = basm_expr_eval(basm, expr.value.as_funcall->args->value, location);
-            Word length = {0};
-            if (!basm_string_length_by_addr(basm, addr.as_u64, &length)) {
-                fprintf(stderr, FL_Fmt": ERROR: Could not compute the length of string at address %"PRIu64"\n", FL_Arg(location), addr.as_u64);
-                exit(1);
+            Binding *binding = basm_resolve_binding(basm, name);
+            if (binding == NULL) {
+                fprintf(stderr, FL_Fmt": ERROR: could find binding `"SV_Fmt"`.\n",
+                        FL_Arg(location), SV_Arg(name));
+                basm_exit();
             }
 
-            return length;
-        } else {
-            fprintf(stderr,
-                    FL_Fmt": ERROR: Unknown translation time function `"SV_Fmt"`\n",
-                    FL_Arg(location), SV_Arg(expr.value.as_funcall->name));
-            exit(1);
+            // NOTE: the index of the table is only visible in the element
+            // expression itself. The bindings it refers to are evaluated
+            // and cached without it.
+            const bool has_table_index = basm->has_table_index;
+            basm->has_table_index = false;
+            result.word = basm_binding_eval(basm, binding, location, &result.type);
+            basm->has_table_index = has_table_index;
         }
-    }
-    break;
+        break;
 
-    case EXPR_KIND_BINDING: {
-        String_View name = expr.value.as_binding;
-        Binding *binding = basm_resolve_binding(basm, name);
-        if (binding == NULL) {
-            fprintf(stderr, FL_Fmt": ERROR: could find binding `"SV_Fmt"`.\n",
-                    FL_Arg(location), SV_Arg(name));
+        case EXPR_KIND_BINARY_OP: {
+            Typed_Word right = basm_eval_stack_pop(basm);
+            Typed_Word left = basm_eval_stack_pop(basm);
+            result = basm_binary_op_eval(basm, node->value.as_binary_op, left, right, location);
+        }
+        break;
+
+        default: {
+            assert(false && "basm_expr_eval: unreachable");
             exit(1);
         }
+        break;
+        }
 
-        return basm_binding_eval(basm, binding, location);
+        basm_eval_stack_push(basm, result);
     }
-    break;
 
-    case EXPR_KIND_BINARY_OP: {
-        return basm_binary_op_eval(basm, expr.value.as_binary_op, location);
+    assert(basm->eval_stack_size == base + 1);
+    Typed_Word result = basm_eval_stack_pop(basm);
+
+    if (type) {
+        *type = result.type;
     }
-    break;
 
-    default: {
-        assert(false && "basm_expr_eval: unreachable");
+    return result.word;
+}
+
+const char *type_name(Type type)
+{
+    switch (type) {
+    case TYPE_INTEGER:
+        return "integer";
+    case TYPE_FLOAT:
+        return "float";
+    case TYPE_INST_ADDR:
+        return "instruction address";
+    case TYPE_MEMORY_ADDR:
+        return "memory address";
+    default:
+        assert(false && "type_name: unreachable");
         exit(1);
     }
-    break;
-    }
 }
 
 const char *token_kind_name(Token_Kind kind)
@@ -525,6 +2486,22 @@ const char *token_kind_name(Token_Kind kind)
         return "plus";
     case TOKEN_KIND_MINUS:
         return "minus";
+    case TOKEN_KIND_MULT:
+        return "*";
+    case TOKEN_KIND_DIV:
+        return "/";
+    case TOKEN_KIND_MOD:
+        return "%";
+    case TOKEN_KIND_SHL:
+        return "<<";
+    case TOKEN_KIND_SHR:
+        return ">>";
+    case TOKEN_KIND_AND:
+        return "&";
+    case TOKEN_KIND_OR:
+        return "|";
+    case TOKEN_KIND_XOR:
+        return "^";
     case TOKEN_KIND_NUMBER:
         return "number";
     case TOKEN_KIND_NAME:
@@ -537,6 +2514,16 @@ const char *token_kind_name(Token_Kind kind)
         return "comma";
     case TOKEN_KIND_GT:
         return ">";
+    case TOKEN_KIND_LT:
+        return "<";
+    case TOKEN_KIND_GE:
+        return ">=";
+    case TOKEN_KIND_LE:
+        return "<=";
+    case TOKEN_KIND_EQ:
+        return "==";
+    case TOKEN_KIND_NE:
+        return "!=";
     default: {
         assert(false && "token_kind_name: unreachable");
         exit(1);
@@ -544,12 +2531,6 @@ const char *token_kind_name(Token_Kind kind)
     }
 }
 
-void tokens_push(Tokens *tokens, Token token)
-{
-    assert(tokens->count < TOKENS_CAPACITY);
-    tokens->elems[tokens->count++] = token;
-}
-
 static bool is_name(char x)
 {
     return isalnum(x) || x == '_';
@@ -569,396 +2550,491 @@ String_View sv_chop_left_while(String_View *sv, bool (*predicate)(char x))
     return sv_chop_left(sv, i);
 }
 
-void tokenize(String_View source, Tokens *tokens, File_Location location)
+static const struct {
+    const char *text;
+    Token_Kind kind;
+} operator_tokens[] = {
+    // NOTE: the operators that are prefixes of the other operators
+    // have to go after them
+    {"<<", TOKEN_KIND_SHL},
+    {">>", TOKEN_KIND_SHR},
+    {"<=", TOKEN_KIND_LE},
+    {">=", TOKEN_KIND_GE},
+    {"==", TOKEN_KIND_EQ},
+    {"!=", TOKEN_KIND_NE},
+    {"(",  TOKEN_KIND_OPEN_PAREN},
+    {")",  TOKEN_KIND_CLOSING_PAREN},
+    {",",  TOKEN_KIND_COMMA},
+    {"+",  TOKEN_KIND_PLUS},
+    {"-",  TOKEN_KIND_MINUS},
+    {"*",  TOKEN_KIND_MULT},
+    {"/",  TOKEN_KIND_DIV},
+    {"%",  TOKEN_KIND_MOD},
+    {"&",  TOKEN_KIND_AND},
+    {"|",  TOKEN_KIND_OR},
+    {"^",  TOKEN_KIND_XOR},
+    {"<",  TOKEN_KIND_LT},
+    {">",  TOKEN_KIND_GT},
+};
+
+static bool tokenize_operator(String_View *source, Token *token)
 {
-    source = sv_trim_left(source);
-    while (source.count > 0) {
-        switch (*source.data) {
-        case '(': {
-            tokens_push(tokens, (Token) {
-                .kind = TOKEN_KIND_OPEN_PAREN,
-                .text = sv_chop_left(&source, 1)
-            });
+    for (size_t i = 0; i < sizeof(operator_tokens) / sizeof(operator_tokens[0]); ++i) {
+        String_View text = sv_from_cstr(operator_tokens[i].text);
+        if (sv_has_prefix(*source, text)) {
+            token->kind = operator_tokens[i].kind;
+            token->text = sv_chop_left(source, text.count);
+            return true;
         }
-        break;
+    }
 
-        case ')': {
-            tokens_push(tokens, (Token) {
-                .kind = TOKEN_KIND_CLOSING_PAREN,
-                .text = sv_chop_left(&source, 1)
-            });
-        }
-        break;
+    return false;
+}
 
-        case ',': {
-            tokens_push(tokens, (Token) {
-                .kind = TOKEN_KIND_COMMA,
-                .text = sv_chop_left(&source, 1)
-            });
-        }
-        break;
+Lexer lexer_from_sv(String_View source, File_Location location)
+{
+    return (Lexer) {
+        .source = sv_trim_left(source),
+        .location = location,
+    };
+}
 
-        case '>': {
-            tokens_push(tokens, (Token) {
-                .kind = TOKEN_KIND_GT,
-                .text = sv_chop_left(&source, 1)
-            });
-        }
-        break;
+static String_View lexer_chop_quoted(Lexer *lexer, char quote)
+{
+    sv_chop_left(&lexer->source, 1);
 
-        case '+': {
-            tokens_push(tokens, (Token) {
-                .kind = TOKEN_KIND_PLUS,
-                .text = sv_chop_left(&source, 1)
-            });
-        }
-        break;
+    size_t index = 0;
+    if (!sv_index_of(lexer->source, quote, &index)) {
+        fprintf(stderr, FL_Fmt": ERROR: Could not find closing %c\n",
+                FL_Arg(lexer->location), quote);
+        basm_exit();
+    }
 
-        case '-': {
-            tokens_push(tokens, (Token) {
-                .kind = TOKEN_KIND_MINUS,
-                .text = sv_chop_left(&source, 1)
-            });
-        }
-        break;
+    String_View text = sv_chop_left(&lexer->source, index);
+    sv_chop_left(&lexer->source, 1);
+    return text;
+}
 
-        case '"': {
-            sv_chop_left(&source, 1);
+static Token lexer_chop_token(Lexer *lexer)
+{
+    assert(lexer->source.count > 0);
 
-            size_t index = 0;
+    Token token = {0};
 
-            if (sv_index_of(source, '"', &index)) {
-                String_View text = sv_chop_left(&source, index);
-                sv_chop_left(&source, 1);
-                tokens_push(tokens, (Token) {
-                    .kind = TOKEN_KIND_STR, .text = text
-                });
-            } else {
-                fprintf(stderr, FL_Fmt": ERROR: Could not find closing \"\n",
-                        FL_Arg(location));
-                exit(1);
-            }
+    switch (*lexer->source.data) {
+    case '"': {
+        token.kind = TOKEN_KIND_STR;
+        token.text = lexer_chop_quoted(lexer, '"');
+    }
+    break;
+
+    case '\'': {
+        token.kind = TOKEN_KIND_CHAR;
+        token.text = lexer_chop_quoted(lexer, '\'');
+    }
+    break;
+
+    default: {
+        if (isalpha(*lexer->source.data)) {
+            token.kind = TOKEN_KIND_NAME;
+            token.text = sv_chop_left_while(&lexer->source, is_name);
+        } else if (isdigit(*lexer->source.data)) {
+            token.kind = TOKEN_KIND_NUMBER;
+            token.text = sv_chop_left_while(&lexer->source, is_number);
+        } else if (!tokenize_operator(&lexer->source, &token)) {
+            fprintf(stderr, FL_Fmt": ERROR: Unknown token starts with %c\n",
+                    FL_Arg(lexer->location), *lexer->source.data);
+            basm_exit();
         }
-        break;
+    }
+    }
 
-        case '\'': {
-            sv_chop_left(&source, 1);
+    lexer->source = sv_trim_left(lexer->source);
 
-            size_t index = 0;
+    return token;
+}
 
-            if (sv_index_of(source, '\'', &index)) {
-                String_View text = sv_chop_left(&source, index);
-                sv_chop_left(&source, 1);
-                tokens_push(tokens, (Token) {
-                    .kind = TOKEN_KIND_CHAR, .text = text
-                });
-            } else {
-                fprintf(stderr, FL_Fmt": ERROR: Could not find closing \'\n",
-                        FL_Arg(location));
-                exit(1);
-            }
+bool lexer_peek(Lexer *lexer, Token *token)
+{
+    if (!lexer->peek_full) {
+        if (lexer->source.count == 0) {
+            return false;
         }
-        break;
 
-        default: {
-            if (isalpha(*source.data)) {
-                tokens_push(tokens, (Token) {
-                    .kind = TOKEN_KIND_NAME,
-                    .text = sv_chop_left_while(&source, is_name)
-                });
-            } else if (isdigit(*source.data)) {
-                tokens_push(tokens, (Token) {
-                    .kind = TOKEN_KIND_NUMBER,
-                    .text = sv_chop_left_while(&source, is_number)
-                });
-            } else {
-                fprintf(stderr, FL_Fmt": ERROR: Unknown token starts with %c\n",
-                        FL_Arg(location), *source.data);
-                exit(1);
-            }
-        }
-        }
+        lexer->peek_buffer = lexer_chop_token(lexer);
+        lexer->peek_full = true;
+        lexer->tokens_count += 1;
+    }
 
-        source = sv_trim_left(source);
+    if (token) {
+        *token = lexer->peek_buffer;
     }
+    return true;
 }
 
-Tokens_View tokens_as_view(const Tokens *tokens)
+bool lexer_next(Lexer *lexer, Token *token)
 {
-    return (Tokens_View) {
-        .elems = tokens->elems,
-        .count = tokens->count,
-    };
+    if (!lexer_peek(lexer, token)) {
+        return false;
+    }
+
+    lexer->peek_full = false;
+    return true;
 }
 
-Tokens_View tv_chop_left(Tokens_View *tv, size_t n)
+static bool lexer_next_is(Lexer *lexer, Token_Kind kind)
 {
-    if (n > tv->count) {
-        n = tv->count;
-    }
+    Token token = {0};
+    return lexer_peek(lexer, &token) && token.kind == kind;
+}
 
-    Tokens_View result = {
-        .elems = tv->elems,
-        .count = n,
-    };
+static void lexer_expect(Lexer *lexer, Token_Kind kind)
+{
+    if (!lexer_next_is(lexer, kind)) {
+        fprintf(stderr, FL_Fmt": ERROR: expected %s\n",
+                FL_Arg(lexer->location),
+                token_kind_name(kind));
+        basm_exit();
+    }
 
-    tv->elems += n;
-    tv->count -= n;
+    lexer_next(lexer, NULL);
+}
 
-    return result;
+static int digit_value(char x)
+{
+    if ('0' <= x && x <= '9') {
+        return x - '0';
+    } else if ('a' <= x && x <= 'f') {
+        return x - 'a' + 10;
+    } else if ('A' <= x && x <= 'F') {
+        return x - 'A' + 10;
+    } else {
+        return -1;
+    }
 }
 
-static Expr parse_number_from_tokens(Arena *arena, Tokens_View *tokens, File_Location location)
+// Parses the integer literal right from the source without making a
+// NUL-terminated copy for strtoull(). Sets overflow if the literal
+// consists only of valid digits but does not fit into 64 bits.
+static bool parse_int_literal(String_View text, uint64_t base, uint64_t *result, bool *overflow)
 {
-    if (tokens->count == 0) {
-        fprintf(stderr, FL_Fmt": ERROR: Cannot parse empty expression\n",
-                FL_Arg(location));
-        exit(1);
+    *overflow = false;
+
+    if (text.count == 0) {
+        return false;
     }
 
-    Expr result = {0};
+    uint64_t value = 0;
+    for (size_t i = 0; i < text.count; ++i) {
+        const int digit = digit_value(text.data[i]);
+        if (digit < 0 || (uint64_t) digit >= base) {
+            *overflow = false;
+            return false;
+        }
 
-    if (tokens->elems->kind == TOKEN_KIND_NUMBER) {
-        String_View text = tokens->elems->text;
+        if (value > (UINT64_MAX - (uint64_t) digit) / base) {
+            *overflow = true;
+        }
+        value = value * base + (uint64_t) digit;
+    }
 
-        const char *cstr = arena_sv_to_cstr(arena, text);
-        char *endptr = 0;
+    *result = value;
+    return !*overflow;
+}
 
-        if (sv_has_prefix(text, sv_from_cstr("0x"))) {
-            result.value.as_lit_int = strtoull(cstr, &endptr, 16);
-            if ((size_t) (endptr - cstr) != text.count) {
-                fprintf(stderr, FL_Fmt": ERROR: `"SV_Fmt"` is not a hex literal\n",
-                        FL_Arg(location), SV_Arg(text));
-                exit(1);
-            }
+// NOTE: the powers of ten that are exactly representable as double
+static const double exact_powers_of_ten[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+    1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+    1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+#define EXACT_POWERS_OF_TEN_COUNT (sizeof(exact_powers_of_ten) / sizeof(exact_powers_of_ten[0]))
+#define F64_MAX_EXACT_INT (1ULL << 53)
+
+// Parses `digits[.digits][e digits]` right from the source. If both the
+// mantissa and the power of ten are exactly representable as double
+// the result is correctly rounded by a single multiplication or
+// division. Everything else falls back to strtod() on a NUL-terminated
+// copy of the literal.
+static bool parse_float_literal(Arena *arena, String_View text, double *result)
+{
+    uint64_t mantissa = 0;
+    int64_t exponent = 0;
+    bool exact = true;
+    size_t digits = 0;
+    size_t i = 0;
 
-            result.kind = EXPR_KIND_LIT_INT;
-            tv_chop_left(tokens, 1);
+    while (i < text.count && isdigit(text.data[i])) {
+        const uint64_t digit = (uint64_t) (text.data[i] - '0');
+        if (mantissa <= (F64_MAX_EXACT_INT - digit) / 10) {
+            mantissa = mantissa * 10 + digit;
         } else {
-            result.value.as_lit_int = strtoull(cstr, &endptr, 10);
-            if ((size_t) (endptr - cstr) != text.count) {
-                result.value.as_lit_float = strtod(cstr, &endptr);
-                if ((size_t) (endptr - cstr) != text.count) {
-                    fprintf(stderr, FL_Fmt": ERROR: `"SV_Fmt"` is not a number literal\n",
-                            FL_Arg(location), SV_Arg(text));
-                } else {
-                    result.kind = EXPR_KIND_LIT_FLOAT;
-                }
+            exact = false;
+        }
+        digits += 1;
+        i += 1;
+    }
+
+    if (i < text.count && text.data[i] == '.') {
+        i += 1;
+        while (i < text.count && isdigit(text.data[i])) {
+            const uint64_t digit = (uint64_t) (text.data[i] - '0');
+            if (mantissa <= (F64_MAX_EXACT_INT - digit) / 10) {
+                mantissa = mantissa * 10 + digit;
+                exponent -= 1;
             } else {
-                result.kind = EXPR_KIND_LIT_INT;
+                exact = false;
             }
-
-            tv_chop_left(tokens, 1);
+            digits += 1;
+            i += 1;
         }
-    } else {
-        fprintf(stderr, FL_Fmt": ERROR: expected %s but got %s",
-                FL_Arg(location),
-                token_kind_name(TOKEN_KIND_NUMBER),
-                token_kind_name(tokens->elems->kind));
-        exit(1);
     }
 
-    return result;
-}
-
-// TODO(#199): parse_primary_from_tokens does not support parens
-Expr parse_primary_from_tokens(Arena *arena, Tokens_View *tokens, File_Location location)
-{
-    if (tokens->count == 0) {
-        fprintf(stderr, FL_Fmt": ERROR: Cannot parse empty expression\n",
-                FL_Arg(location));
-        exit(1);
+    if (digits == 0) {
+        return false;
     }
 
-    Expr result = {0};
+    if (i < text.count && (text.data[i] == 'e' || text.data[i] == 'E')) {
+        i += 1;
 
-    switch (tokens->elems->kind) {
-    case TOKEN_KIND_STR: {
-        // TODO(#66): string literals don't support escaped characters
-        result.kind = EXPR_KIND_LIT_STR;
-        result.value.as_lit_str = tokens->elems->text;
-        tv_chop_left(tokens, 1);
-    }
-    break;
+        size_t exponent_digits = 0;
+        int64_t literal_exponent = 0;
+        while (i < text.count && isdigit(text.data[i])) {
+            if (literal_exponent < (int64_t) EXACT_POWERS_OF_TEN_COUNT) {
+                literal_exponent = literal_exponent * 10 + (text.data[i] - '0');
+            } else {
+                exact = false;
+            }
+            exponent_digits += 1;
+            i += 1;
+        }
 
-    case TOKEN_KIND_CHAR: {
-        if (tokens->elems->text.count != 1) {
-            // TODO(#179): char literals don't support escaped characters
-            fprintf(stderr, FL_Fmt": ERROR: the length of char literal has to be exactly one\n",
-                    FL_Arg(location));
-            exit(1);
+        if (exponent_digits == 0) {
+            return false;
         }
 
-        result.kind = EXPR_KIND_LIT_CHAR;
-        result.value.as_lit_char = tokens->elems->text.data[0];
-        tv_chop_left(tokens, 1);
+        exponent += literal_exponent;
     }
-    break;
 
-    case TOKEN_KIND_NAME: {
-        if (tokens->count > 1 && tokens->elems[1].kind == TOKEN_KIND_OPEN_PAREN) {
-            result.kind = EXPR_KIND_FUNCALL;
-            result.value.as_funcall = arena_alloc(arena, sizeof(Funcall));
-            result.value.as_funcall->name = tokens->elems->text;
-            tv_chop_left(tokens, 1);
-            result.value.as_funcall->args = parse_funcall_args(arena, tokens, location);
+    if (i != text.count) {
+        return false;
+    }
+
+    if (exact && -exponent < (int64_t) EXACT_POWERS_OF_TEN_COUNT && exponent < (int64_t) EXACT_POWERS_OF_TEN_COUNT) {
+        if (exponent < 0) {
+            *result = (double) mantissa / exact_powers_of_ten[-exponent];
         } else {
-            result.value.as_binding = tokens->elems->text;
-            result.kind = EXPR_KIND_BINDING;
-            tv_chop_left(tokens, 1);
+            *result = (double) mantissa * exact_powers_of_ten[exponent];
         }
+        return true;
     }
-    break;
 
-    case TOKEN_KIND_NUMBER: {
-        return parse_number_from_tokens(arena, tokens, location);
+    const char *cstr = arena_sv_to_cstr(arena, text);
+    char *endptr = 0;
+    *result = strtod(cstr, &endptr);
+    return (size_t) (endptr - cstr) == text.count;
+}
+
+static Expr_Node parse_number_from_lexer(Arena *arena, Lexer *lexer)
+{
+    Token token = {0};
+    if (!lexer_next(lexer, &token)) {
+        fprintf(stderr, FL_Fmt": ERROR: Cannot parse empty expression\n",
+                FL_Arg(lexer->location));
+        basm_exit();
     }
-    break;
 
-    case TOKEN_KIND_MINUS: {
-        tv_chop_left(tokens, 1);
-        Expr expr = parse_number_from_tokens(arena, tokens, location);
+    if (token.kind != TOKEN_KIND_NUMBER) {
+        fprintf(stderr, FL_Fmt": ERROR: expected %s but got %s\n",
+                FL_Arg(lexer->location),
+                token_kind_name(TOKEN_KIND_NUMBER),
+                token_kind_name(token.kind));
+        basm_exit();
+    }
 
-        if (expr.kind == EXPR_KIND_LIT_INT) {
-            // TODO(#184): more cross-platform way to negate integer literals
-            // what if somewhere the numbers are not two's complement
-            expr.value.as_lit_int = (~expr.value.as_lit_int + 1);
-        } else if (expr.kind == EXPR_KIND_LIT_FLOAT) {
-            expr.value.as_lit_float = -expr.value.as_lit_float;
-        } else {
-            assert(false && "unreachable");
+    Expr_Node result = {0};
+    String_View text = token.text;
+    bool overflow = false;
+
+    if (sv_has_prefix(text, sv_from_cstr("0x"))) {
+        sv_chop_left(&text, 2);
+        if (!parse_int_literal(text, 16, &result.value.as_lit_int, &overflow)) {
+            fprintf(stderr, FL_Fmt": ERROR: `"SV_Fmt"` is not a hex literal\n",
+                    FL_Arg(lexer->location), SV_Arg(token.text));
+            basm_exit();
         }
 
-        return expr;
+        result.kind = EXPR_KIND_LIT_INT;
+    } else if (parse_int_literal(text, 10, &result.value.as_lit_int, &overflow)) {
+        result.kind = EXPR_KIND_LIT_INT;
+    } else if (overflow) {
+        fprintf(stderr, FL_Fmt": ERROR: integer literal `"SV_Fmt"` does not fit into 64 bits\n",
+                FL_Arg(lexer->location), SV_Arg(text));
+        basm_exit();
+    } else if (parse_float_literal(arena, text, &result.value.as_lit_float)) {
+        result.kind = EXPR_KIND_LIT_FLOAT;
+    } else {
+        fprintf(stderr, FL_Fmt": ERROR: `"SV_Fmt"` is not a number literal\n",
+                FL_Arg(lexer->location), SV_Arg(text));
+        basm_exit();
     }
-    break;
 
-    case TOKEN_KIND_GT:
-    case TOKEN_KIND_OPEN_PAREN:
-    case TOKEN_KIND_COMMA:
-    case TOKEN_KIND_CLOSING_PAREN:
-    case TOKEN_KIND_PLUS: {
-        fprintf(stderr, FL_Fmt": ERROR: expected primary expression but found %s\n",
-                FL_Arg(location), token_kind_name(tokens->elems->kind));
-        exit(1);
-    }
-    break;
+    return result;
+}
 
+size_t expr_node_arity(Expr_Node node)
+{
+    switch (node.kind) {
+    case EXPR_KIND_BINDING:
+    case EXPR_KIND_LIT_INT:
+    case EXPR_KIND_LIT_FLOAT:
+    case EXPR_KIND_LIT_CHAR:
+    case EXPR_KIND_LIT_STR:
+        return 0;
+    case EXPR_KIND_BINARY_OP:
+        return 2;
+    case EXPR_KIND_FUNCALL:
+        return node.value.as_funcall.arity;
     default: {
-        assert(false && "parse_primary_from_tokens: unreachable");
+        assert(false && "expr_node_arity: unreachable");
         exit(1);
     }
     }
+}
 
-    return result;
+Expr_Node expr_root(Expr expr)
+{
+    assert(expr.count > 0);
+    return expr.nodes[expr.count - 1];
 }
 
-size_t funcall_args_len(Funcall_Arg *args)
+// Finds the first node of the subexpression with the given root
+static size_t expr_subtree_start(Expr expr, size_t root)
 {
-    size_t result = 0;
-    while (args != NULL) {
-        result += 1;
-        args = args->next;
+    size_t need = 1;
+    size_t i = root + 1;
+    while (need > 0) {
+        assert(i > 0);
+        i -= 1;
+        need = need - 1 + expr_node_arity(expr.nodes[i]);
     }
-    return result;
+    return i;
 }
 
-void dump_expr(FILE *stream, Expr expr, int level)
+// Finds the root of the index-th operand of the node at the given root
+static size_t expr_operand_root(Expr expr, size_t root, size_t index)
+{
+    const size_t arity = expr_node_arity(expr.nodes[root]);
+    assert(index < arity);
+
+    size_t operand = root - 1;
+    for (size_t i = index + 1; i < arity; ++i) {
+        operand = expr_subtree_start(expr, operand) - 1;
+    }
+    return operand;
+}
+
+static void dump_expr_node(FILE *stream, Expr expr, size_t root, int level)
 {
+    const Expr_Node node = expr.nodes[root];
+
     fprintf(stream, "%*s", level * 2, "");
 
-    switch(expr.kind) {
+    switch(node.kind) {
     case EXPR_KIND_BINDING:
         fprintf(stream, "Binding: "SV_Fmt"\n",
-                SV_Arg(expr.value.as_binding));
+                SV_Arg(node.value.as_binding));
         break;
     case EXPR_KIND_LIT_INT:
-        fprintf(stream, "Int Literal: %"PRIu64"\n", expr.value.as_lit_int);
+        fprintf(stream, "Int Literal: %"PRIu64"\n", node.value.as_lit_int);
         break;
     case EXPR_KIND_LIT_FLOAT:
-        fprintf(stream, "Float Literal: %lf\n", expr.value.as_lit_float);
+        fprintf(stream, "Float Literal: %lf\n", node.value.as_lit_float);
         break;
     case EXPR_KIND_LIT_CHAR:
-        fprintf(stream, "Char Literal: '%c'\n", expr.value.as_lit_char);
+        fprintf(stream, "Char Literal: '%c'\n", node.value.as_lit_char);
         break;
     case EXPR_KIND_LIT_STR:
         fprintf(stream, "String Literal: \""SV_Fmt"\"\n",
-                SV_Arg(expr.value.as_lit_str));
+                SV_Arg(node.value.as_lit_str));
         break;
     case EXPR_KIND_BINARY_OP:
         fprintf(stream, "Binary Op: %s\n",
-                binary_op_kind_name(expr.value.as_binary_op->kind));
-        dump_binary_op(stream, *expr.value.as_binary_op, level + 1);
+                binary_op_kind_name(node.value.as_binary_op));
+        fprintf(stream, "%*sLeft:\n", (level + 1) * 2, "");
+        dump_expr_node(stream, expr, expr_operand_root(expr, root, 0), level + 2);
+        fprintf(stream, "%*sRight:\n", (level + 1) * 2, "");
+        dump_expr_node(stream, expr, expr_operand_root(expr, root, 1), level + 2);
         break;
     case EXPR_KIND_FUNCALL:
         fprintf(stream, "Funcall: "SV_Fmt"\n",
-                SV_Arg(expr.value.as_funcall->name));
-        dump_funcall_args(stream, expr.value.as_funcall->args, level + 1);
+                SV_Arg(node.value.as_funcall.name));
+        for (size_t i = 0; i < node.value.as_funcall.arity; ++i) {
+            fprintf(stream, "%*sArg:\n", (level + 1) * 2, "");
+            dump_expr_node(stream, expr, expr_operand_root(expr, root, i), level + 2);
+        }
         break;
     }
 }
 
-static int dump_expr_as_dot_edges(FILE *stream, Expr expr, int *counter)
+void dump_expr(FILE *stream, Expr expr, int level)
 {
-    int id = (*counter)++;
-
-    switch (expr.kind) {
-    case EXPR_KIND_BINDING: {
-        fprintf(stream, "Expr_%d [shape=box label=\""SV_Fmt"\"]\n",
-                id, SV_Arg(expr.value.as_binding));
-    }
-    break;
-    case EXPR_KIND_LIT_INT: {
-        fprintf(stream, "Expr_%d [shape=circle label=\"%"PRIu64"\"]\n",
-                id, expr.value.as_lit_int);
-    }
-    break;
-    case EXPR_KIND_LIT_FLOAT: {
-        fprintf(stream, "Expr_%d [shape=circle label=\"%lf\"]\n",
-                id, expr.value.as_lit_float);
-    }
-    break;
-    case EXPR_KIND_LIT_CHAR: {
-        fprintf(stream, "Expr_%d [shape=circle label=\"'%c'\"]\n",
-                id, expr.value.as_lit_char);
-    }
-    break;
-    case EXPR_KIND_LIT_STR: {
-        fprintf(stream, "Expr_%d [shape=circle label=\""SV_Fmt"\"]\n",
-                id, SV_Arg(expr.value.as_lit_str));
-    }
-    break;
-    case EXPR_KIND_BINARY_OP: {
-        fprintf(stream, "Expr_%d [shape=diamond label=\"%s\"]\n",
-                id, binary_op_kind_name(expr.value.as_binary_op->kind));
-        int left_id = dump_expr_as_dot_edges(stream, expr.value.as_binary_op->left, counter);
-        int right_id = dump_expr_as_dot_edges(stream, expr.value.as_binary_op->right, counter);
-        fprintf(stream, "Expr_%d -> Expr_%d\n", id, left_id);
-        fprintf(stream, "Expr_%d -> Expr_%d\n", id, right_id);
-    }
-    break;
-    case EXPR_KIND_FUNCALL: {
-        fprintf(stream, "Expr_%d [shape=diamond label=\""SV_Fmt"\"]\n",
-                id, SV_Arg(expr.value.as_funcall->name));
-
-        for (Funcall_Arg *arg = expr.value.as_funcall->args;
-                arg != NULL;
-                arg = arg->next) {
-            int child_id = dump_expr_as_dot_edges(stream, arg->value, counter);
-            fprintf(stream, "Expr_%d -> Expr_%d\n", id, child_id);
-        }
-    }
-    break;
-    }
-
-    return id;
+    assert(expr.count > 0);
+    dump_expr_node(stream, expr, expr.count - 1, level);
 }
 
 void dump_expr_as_dot(FILE *stream, Expr expr)
 {
     fprintf(stream, "digraph Expr {\n");
-    int counter = 0;
-    dump_expr_as_dot_edges(stream, expr, &counter);
+
+    for (size_t id = 0; id < expr.count; ++id) {
+        const Expr_Node node = expr.nodes[id];
+
+        switch (node.kind) {
+        case EXPR_KIND_BINDING: {
+            fprintf(stream, "Expr_%zu [shape=box label=\""SV_Fmt"\"]\n",
+                    id, SV_Arg(node.value.as_binding));
+        }
+        break;
+        case EXPR_KIND_LIT_INT: {
+            fprintf(stream, "Expr_%zu [shape=circle label=\"%"PRIu64"\"]\n",
+                    id, node.value.as_lit_int);
+        }
+        break;
+        case EXPR_KIND_LIT_FLOAT: {
+            fprintf(stream, "Expr_%zu [shape=circle label=\"%lf\"]\n",
+                    id, node.value.as_lit_float);
+        }
+        break;
+        case EXPR_KIND_LIT_CHAR: {
+            fprintf(stream, "Expr_%zu [shape=circle label=\"'%c'\"]\n",
+                    id, node.value.as_lit_char);
+        }
+        break;
+        case EXPR_KIND_LIT_STR: {
+            fprintf(stream, "Expr_%zu [shape=circle label=\""SV_Fmt"\"]\n",
+                    id, SV_Arg(node.value.as_lit_str));
+        }
+        break;
+        case EXPR_KIND_BINARY_OP: {
+            fprintf(stream, "Expr_%zu [shape=diamond label=\"%s\"]\n",
+                    id, binary_op_kind_name(node.value.as_binary_op));
+        }
+        break;
+        case EXPR_KIND_FUNCALL: {
+            fprintf(stream, "Expr_%zu [shape=diamond label=\""SV_Fmt"\"]\n",
+                    id, SV_Arg(node.value.as_funcall.name));
+        }
+        break;
+        }
+
+        for (size_t i = 0; i < expr_node_arity(node); ++i) {
+            fprintf(stream, "Expr_%zu -> Expr_%zu\n",
+                    id, expr_operand_root(expr, id, i));
+        }
+    }
+
     fprintf(stream, "}\n");
 }
 
@@ -967,148 +3043,391 @@ const char *binary_op_kind_name(Binary_Op_Kind kind)
     switch (kind) {
     case BINARY_OP_PLUS:
         return "+";
+    case BINARY_OP_MINUS:
+        return "-";
+    case BINARY_OP_MULT:
+        return "*";
+    case BINARY_OP_DIV:
+        return "/";
+    case BINARY_OP_MOD:
+        return "%";
+    case BINARY_OP_SHL:
+        return "<<";
+    case BINARY_OP_SHR:
+        return ">>";
+    case BINARY_OP_AND:
+        return "&";
+    case BINARY_OP_OR:
+        return "|";
+    case BINARY_OP_XOR:
+        return "^";
     case BINARY_OP_GT:
         return ">";
+    case BINARY_OP_LT:
+        return "<";
+    case BINARY_OP_GE:
+        return ">=";
+    case BINARY_OP_LE:
+        return "<=";
+    case BINARY_OP_EQ:
+        return "==";
+    case BINARY_OP_NE:
+        return "!=";
     default:
         assert(false && "binary_op_kind_name: unreachable");
         exit(1);
     }
 }
 
-void dump_binary_op(FILE *stream, Binary_Op binary_op, int level)
+bool binary_op_of_token(Token_Kind kind, Binary_Op_Kind *op)
 {
-    fprintf(stream, "%*sLeft:\n", level * 2, "");
-    dump_expr(stream, binary_op.left, level + 1);
+    switch (kind) {
+    case TOKEN_KIND_PLUS:
+        *op = BINARY_OP_PLUS;
+        return true;
+    case TOKEN_KIND_MINUS:
+        *op = BINARY_OP_MINUS;
+        return true;
+    case TOKEN_KIND_MULT:
+        *op = BINARY_OP_MULT;
+        return true;
+    case TOKEN_KIND_DIV:
+        *op = BINARY_OP_DIV;
+        return true;
+    case TOKEN_KIND_MOD:
+        *op = BINARY_OP_MOD;
+        return true;
+    case TOKEN_KIND_SHL:
+        *op = BINARY_OP_SHL;
+        return true;
+    case TOKEN_KIND_SHR:
+        *op = BINARY_OP_SHR;
+        return true;
+    case TOKEN_KIND_AND:
+        *op = BINARY_OP_AND;
+        return true;
+    case TOKEN_KIND_OR:
+        *op = BINARY_OP_OR;
+        return true;
+    case TOKEN_KIND_XOR:
+        *op = BINARY_OP_XOR;
+        return true;
+    case TOKEN_KIND_GT:
+        *op = BINARY_OP_GT;
+        return true;
+    case TOKEN_KIND_LT:
+        *op = BINARY_OP_LT;
+        return true;
+    case TOKEN_KIND_GE:
+        *op = BINARY_OP_GE;
+        return true;
+    case TOKEN_KIND_LE:
+        *op = BINARY_OP_LE;
+        return true;
+    case TOKEN_KIND_EQ:
+        *op = BINARY_OP_EQ;
+        return true;
+    case TOKEN_KIND_NE:
+        *op = BINARY_OP_NE;
+        return true;
 
-    fprintf(stream, "%*sRight:\n", level * 2, "");
-    dump_expr(stream, binary_op.right, level + 1);
+    case TOKEN_KIND_STR:
+    case TOKEN_KIND_CHAR:
+    case TOKEN_KIND_NUMBER:
+    case TOKEN_KIND_NAME:
+    case TOKEN_KIND_OPEN_PAREN:
+    case TOKEN_KIND_CLOSING_PAREN:
+    case TOKEN_KIND_COMMA:
+    default:
+        return false;
+    }
 }
 
-void dump_funcall_args(FILE *stream, Funcall_Arg *args, int level)
+// NOTE: the precedence of the operators follows C
+size_t binary_op_precedence(Binary_Op_Kind kind)
 {
-    while (args != NULL) {
-        fprintf(stream, "%*sArg:\n", level * 2, "");
-        dump_expr(stream, args->value, level + 1);
-        args = args->next;
+    switch (kind) {
+    case BINARY_OP_OR:
+        return BINARY_OP_PRECEDENCE_MIN;
+    case BINARY_OP_XOR:
+        return BINARY_OP_PRECEDENCE_MIN + 1;
+    case BINARY_OP_AND:
+        return BINARY_OP_PRECEDENCE_MIN + 2;
+    case BINARY_OP_EQ:
+    case BINARY_OP_NE:
+        return BINARY_OP_PRECEDENCE_MIN + 3;
+    case BINARY_OP_GT:
+    case BINARY_OP_LT:
+    case BINARY_OP_GE:
+    case BINARY_OP_LE:
+        return BINARY_OP_PRECEDENCE_MIN + 4;
+    case BINARY_OP_SHL:
+    case BINARY_OP_SHR:
+        return BINARY_OP_PRECEDENCE_MIN + 5;
+    case BINARY_OP_PLUS:
+    case BINARY_OP_MINUS:
+        return BINARY_OP_PRECEDENCE_MIN + 6;
+    case BINARY_OP_MULT:
+    case BINARY_OP_DIV:
+    case BINARY_OP_MOD:
+        return BINARY_OP_PRECEDENCE_MIN + 7;
+    default:
+        assert(false && "binary_op_precedence: unreachable");
+        exit(1);
     }
 }
 
-Funcall_Arg *parse_funcall_args(Arena *arena, Tokens_View *tokens, File_Location location)
+// NOTE: most of the expressions are just a couple of nodes. They are
+// collected in the scratch buffer and copied into the arena only once
+// they are complete, so the arena gets exactly one block of the right
+// size per expression.
+#define EXPR_PARSER_SCRATCH_CAPACITY 32
+
+typedef struct {
+    Arena *arena;
+    Lexer *lexer;
+    Expr_Node *nodes;
+    size_t nodes_size;
+    size_t nodes_capacity;
+    Expr_Node scratch[EXPR_PARSER_SCRATCH_CAPACITY];
+} Expr_Parser;
+
+static void expr_parser_push(Expr_Parser *parser, Expr_Node node)
 {
-    if (tokens->count < 1 || tokens->elems->kind != TOKEN_KIND_OPEN_PAREN) {
-        fprintf(stderr, FL_Fmt": ERROR: expected %s\n",
-                FL_Arg(location),
-                token_kind_name(TOKEN_KIND_OPEN_PAREN));
-        exit(1);
+    if (parser->nodes_size >= parser->nodes_capacity) {
+        const size_t new_capacity = parser->nodes_capacity * 2;
+        Expr_Node *new_nodes = arena_alloc(parser->arena, new_capacity * sizeof(new_nodes[0]));
+        memcpy(new_nodes, parser->nodes, parser->nodes_size * sizeof(new_nodes[0]));
+        parser->nodes = new_nodes;
+        parser->nodes_capacity = new_capacity;
     }
-    tv_chop_left(tokens, 1);
 
-    if (tokens->count > 0 && tokens->elems->kind == TOKEN_KIND_CLOSING_PAREN) {
-        return NULL;
+    parser->nodes[parser->nodes_size++] = node;
+}
+
+static void parse_binary_op(Expr_Parser *parser, size_t precedence);
+
+static size_t parse_funcall_args(Expr_Parser *parser)
+{
+    Lexer *lexer = parser->lexer;
+
+    lexer_expect(lexer, TOKEN_KIND_OPEN_PAREN);
+
+    if (lexer_next_is(lexer, TOKEN_KIND_CLOSING_PAREN)) {
+        lexer_next(lexer, NULL);
+        return 0;
     }
 
-    Funcall_Arg *first = NULL;
-    Funcall_Arg *last = NULL;
+    size_t arity = 0;
 
     // , b, c)
     Token token = {0};
     do {
-        Funcall_Arg *arg = arena_alloc(arena, sizeof(Funcall_Arg));
-        arg->value = parse_expr_from_tokens(arena, tokens, location);
-
-        if (first == NULL) {
-            first = arg;
-            last = arg;
-        } else {
-            last->next = arg;
-            last = arg;
-        }
+        parse_binary_op(parser, BINARY_OP_PRECEDENCE_MIN);
+        arity += 1;
 
-        if (tokens->count == 0) {
+        if (!lexer_next(lexer, &token)) {
             fprintf(stderr, FL_Fmt": ERROR: expected %s or %s\n",
-                    FL_Arg(location),
+                    FL_Arg(lexer->location),
                     token_kind_name(TOKEN_KIND_CLOSING_PAREN),
                     token_kind_name(TOKEN_KIND_COMMA));
-            exit(1);
+            basm_exit();
         }
-
-        token = tv_chop_left(tokens, 1).elems[0];
     } while (token.kind == TOKEN_KIND_COMMA);
 
     if (token.kind != TOKEN_KIND_CLOSING_PAREN) {
         fprintf(stderr, FL_Fmt": ERROR: expected %s\n",
-                FL_Arg(location),
+                FL_Arg(lexer->location),
                 token_kind_name(TOKEN_KIND_CLOSING_PAREN));
-        exit(1);
+        basm_exit();
     }
 
-    return first;
+    return arity;
 }
 
-Expr parse_gt_from_tokens(Arena *arena, Tokens_View *tokens, File_Location location)
+static void parse_primary(Expr_Parser *parser)
 {
-    Expr left = parse_sum_from_tokens(arena, tokens, location);
+    Lexer *lexer = parser->lexer;
 
-    if (tokens->count != 0 && tokens->elems->kind == TOKEN_KIND_GT) {
-        tv_chop_left(tokens, 1);
+    Token token = {0};
+    if (!lexer_peek(lexer, &token)) {
+        fprintf(stderr, FL_Fmt": ERROR: Cannot parse empty expression\n",
+                FL_Arg(lexer->location));
+        basm_exit();
+    }
 
-        Expr right = parse_gt_from_tokens(arena, tokens, location);
+    Expr_Node node = {0};
 
-        Binary_Op *binary_op = arena_alloc(arena, sizeof(Binary_Op));
-        binary_op->kind = BINARY_OP_GT;
-        binary_op->left = left;
-        binary_op->right = right;
+    switch (token.kind) {
+    case TOKEN_KIND_STR: {
+        // TODO(#66): string literals don't support escaped characters
+        node.kind = EXPR_KIND_LIT_STR;
+        node.value.as_lit_str = token.text;
+        lexer_next(lexer, NULL);
+    }
+    break;
 
-        Expr result = {
-            .kind = EXPR_KIND_BINARY_OP,
-            .value = {
-                .as_binary_op = binary_op,
-            }
-        };
+    case TOKEN_KIND_CHAR: {
+        if (token.text.count != 1) {
+            // TODO(#179): char literals don't support escaped characters
+            fprintf(stderr, FL_Fmt": ERROR: the length of char literal has to be exactly one\n",
+                    FL_Arg(lexer->location));
+            basm_exit();
+        }
 
-        return result;
-    } else {
-        return left;
+        node.kind = EXPR_KIND_LIT_CHAR;
+        node.value.as_lit_char = token.text.data[0];
+        lexer_next(lexer, NULL);
+    }
+    break;
+
+    case TOKEN_KIND_NAME: {
+        lexer_next(lexer, NULL);
+
+        if (lexer_next_is(lexer, TOKEN_KIND_OPEN_PAREN)) {
+            node.kind = EXPR_KIND_FUNCALL;
+            node.value.as_funcall.name = token.text;
+            node.value.as_funcall.arity = parse_funcall_args(parser);
+        } else {
+            node.kind = EXPR_KIND_BINDING;
+            node.value.as_binding = token.text;
+        }
+    }
+    break;
+
+    case TOKEN_KIND_NUMBER: {
+        node = parse_number_from_lexer(parser->arena, lexer);
+    }
+    break;
+
+    case TOKEN_KIND_MINUS: {
+        lexer_next(lexer, NULL);
+
+        if (!lexer_next_is(lexer, TOKEN_KIND_NUMBER)) {
+            // NOTE: negation of an arbitrary expression is translated to `0 - expr`
+            node.kind = EXPR_KIND_LIT_INT;
+            node.value.as_lit_int = 0;
+            expr_parser_push(parser, node);
+
+            parse_primary(parser);
+
+            node.kind = EXPR_KIND_BINARY_OP;
+            node.value.as_binary_op = BINARY_OP_MINUS;
+            break;
+        }
+
+        node = parse_number_from_lexer(parser->arena, lexer);
+
+        if (node.kind == EXPR_KIND_LIT_INT) {
+            // TODO(#184): more cross-platform way to negate integer literals
+            // what if somewhere the numbers are not two's complement
+            node.value.as_lit_int = (~node.value.as_lit_int + 1);
+        } else if (node.kind == EXPR_KIND_LIT_FLOAT) {
+            node.value.as_lit_float = -node.value.as_lit_float;
+        } else {
+            assert(false && "unreachable");
+        }
+    }
+    break;
+
+    case TOKEN_KIND_OPEN_PAREN: {
+        lexer_next(lexer, NULL);
+        parse_binary_op(parser, BINARY_OP_PRECEDENCE_MIN);
+        lexer_expect(lexer, TOKEN_KIND_CLOSING_PAREN);
+    }
+    return;
+
+    case TOKEN_KIND_GT:
+    case TOKEN_KIND_LT:
+    case TOKEN_KIND_GE:
+    case TOKEN_KIND_LE:
+    case TOKEN_KIND_EQ:
+    case TOKEN_KIND_NE:
+    case TOKEN_KIND_MULT:
+    case TOKEN_KIND_DIV:
+    case TOKEN_KIND_MOD:
+    case TOKEN_KIND_SHL:
+    case TOKEN_KIND_SHR:
+    case TOKEN_KIND_AND:
+    case TOKEN_KIND_OR:
+    case TOKEN_KIND_XOR:
+    case TOKEN_KIND_COMMA:
+    case TOKEN_KIND_CLOSING_PAREN:
+    case TOKEN_KIND_PLUS: {
+        fprintf(stderr, FL_Fmt": ERROR: expected primary expression but found %s\n",
+                FL_Arg(lexer->location), token_kind_name(token.kind));
+        basm_exit();
+    }
+    break;
+
+    default: {
+        assert(false && "parse_primary: unreachable");
+        exit(1);
     }
+    }
+
+    expr_parser_push(parser, node);
 }
 
-Expr parse_sum_from_tokens(Arena *arena, Tokens_View *tokens, File_Location location)
+static void parse_binary_op(Expr_Parser *parser, size_t precedence)
 {
-    Expr left = parse_primary_from_tokens(arena, tokens, location);
+    parse_primary(parser);
 
-    if (tokens->count != 0 && tokens->elems->kind == TOKEN_KIND_PLUS) {
-        tv_chop_left(tokens, 1);
-
-        Expr right = parse_sum_from_tokens(arena, tokens, location);
+    Token token = {0};
+    Binary_Op_Kind kind = 0;
+    while (lexer_peek(parser->lexer, &token) &&
+            binary_op_of_token(token.kind, &kind) &&
+            binary_op_precedence(kind) >= precedence) {
+        lexer_next(parser->lexer, NULL);
 
-        Binary_Op *binary_op = arena_alloc(arena, sizeof(Binary_Op));
-        binary_op->kind = BINARY_OP_PLUS;
-        binary_op->left = left;
-        binary_op->right = right;
+        parse_binary_op(parser, binary_op_precedence(kind) + 1);
 
-        Expr result = {
+        expr_parser_push(parser, (Expr_Node) {
             .kind = EXPR_KIND_BINARY_OP,
             .value = {
-                .as_binary_op = binary_op,
+                .as_binary_op = kind,
             }
-        };
-
-        return result;
-    } else {
-        return left;
+        });
     }
 }
 
-Expr parse_expr_from_tokens(Arena *arena, Tokens_View *tokens, File_Location location)
+Expr parse_expr_from_lexer(Arena *arena, Lexer *lexer)
 {
-    return parse_gt_from_tokens(arena, tokens, location);
+    Expr_Parser parser = {
+        .arena = arena,
+        .lexer = lexer,
+    };
+    parser.nodes = parser.scratch;
+    parser.nodes_capacity = EXPR_PARSER_SCRATCH_CAPACITY;
+
+    parse_binary_op(&parser, BINARY_OP_PRECEDENCE_MIN);
+
+    Expr expr = {
+        .nodes = arena_alloc(arena, parser.nodes_size * sizeof(parser.nodes[0])),
+        .count = parser.nodes_size,
+    };
+    memcpy(expr.nodes, parser.nodes, parser.nodes_size * sizeof(parser.nodes[0]));
+
+    return expr;
 }
 
-Expr parse_expr_from_sv(Arena *arena, String_View source, File_Location location)
+static Expr parse_whole_expr_from_lexer(Arena *arena, Lexer *lexer, File_Location location)
 {
-    Tokens tokens = {0};
-    tokenize(source, &tokens, location);
+    Expr expr = parse_expr_from_lexer(arena, lexer);
 
-    Tokens_View tv = tokens_as_view(&tokens);
-    return parse_expr_from_tokens(arena, &tv, location);
+    Token token = {0};
+    if (lexer_peek(lexer, &token)) {
+        fprintf(stderr, FL_Fmt": ERROR: unexpected %s after the end of expression\n",
+                FL_Arg(location), token_kind_name(token.kind));
+        basm_exit();
+    }
+
+    return expr;
+}
+
+Expr parse_expr_from_sv(Arena *arena, String_View source, File_Location location)
+{
+    Lexer lexer = lexer_from_sv(source, location);
+    return parse_whole_expr_from_lexer(arena, &lexer, location);
 }
+
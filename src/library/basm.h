@@ -1,17 +1,20 @@
 #ifndef BASM_H_
 #define BASM_H_
 
+#include <setjmp.h>
+
 #include "./sv.h"
 #include "./arena.h"
 #include "./bm.h"
 
-#define BASM_BINDINGS_CAPACITY 1024
-#define BASM_DEFERRED_OPERANDS_CAPACITY 1024
-#define BASM_DEFERRED_ASSERTS_CAPACITY 1024
-#define BASM_STRING_LENGTHS_CAPACITY 1024
+#define BASM_BINDINGS_INDEX_INITIAL_CAPACITY 512
+#define BASM_STRINGS_INDEX_INITIAL_CAPACITY 256
 #define BASM_COMMENT_SYMBOL ';'
 #define BASM_PP_SYMBOL '%'
 #define BASM_MAX_INCLUDE_LEVEL 69
+#define BASM_TABLE_INDEX_NAME "i"
+#define BASM_MACRO_PARAMS_CAPACITY 16
+#define BASM_MAX_EXPANSION_LEVEL 69
 
 typedef struct {
     String_View file_path;
@@ -29,17 +32,43 @@ typedef enum {
 
 const char *binding_kind_as_cstr(Binding_Kind kind);
 
+// NOTE: the address types are integers that have to be relocated
+// when the program or the memory they point into is moved by the
+// linker. See Relocation.
+typedef enum {
+    TYPE_INTEGER = 0,
+    TYPE_FLOAT,
+    TYPE_INST_ADDR,
+    TYPE_MEMORY_ADDR,
+} Type;
+
+const char *type_name(Type type);
+bool type_is_addr(Type type);
+
 typedef enum {
     TOKEN_KIND_STR,
     TOKEN_KIND_CHAR,
     TOKEN_KIND_PLUS,
     TOKEN_KIND_MINUS,
+    TOKEN_KIND_MULT,
+    TOKEN_KIND_DIV,
+    TOKEN_KIND_MOD,
+    TOKEN_KIND_SHL,
+    TOKEN_KIND_SHR,
+    TOKEN_KIND_AND,
+    TOKEN_KIND_OR,
+    TOKEN_KIND_XOR,
     TOKEN_KIND_NUMBER,
     TOKEN_KIND_NAME,
     TOKEN_KIND_OPEN_PAREN,
     TOKEN_KIND_CLOSING_PAREN,
     TOKEN_KIND_COMMA,
     TOKEN_KIND_GT,
+    TOKEN_KIND_LT,
+    TOKEN_KIND_GE,
+    TOKEN_KIND_LE,
+    TOKEN_KIND_EQ,
+    TOKEN_KIND_NE,
 } Token_Kind;
 
 const char *token_kind_name(Token_Kind kind);
@@ -49,23 +78,19 @@ typedef struct {
     String_View text;
 } Token;
 
-#define TOKENS_CAPACITY 1024
-
-typedef struct {
-    Token elems[TOKENS_CAPACITY];
-    size_t count;
-} Tokens;
-
-void tokens_push(Tokens *tokens, Token token);
-void tokenize(String_View source, Tokens *tokens, File_Location location);
-
+// Pull-based lexer. The tokens are produced one at a time right from
+// the source with no intermediate buffer.
 typedef struct {
-    const Token *elems;
-    size_t count;
-} Tokens_View;
+    String_View source;
+    File_Location location;
+    bool peek_full;
+    Token peek_buffer;
+    size_t tokens_count;
+} Lexer;
 
-Tokens_View tokens_as_view(const Tokens *tokens);
-Tokens_View tv_chop_left(Tokens_View *tv, size_t n);
+Lexer lexer_from_sv(String_View source, File_Location location);
+bool lexer_peek(Lexer *lexer, Token *token);
+bool lexer_next(Lexer *lexer, Token *token);
 
 typedef enum {
     EXPR_KIND_BINDING,
@@ -77,11 +102,37 @@ typedef enum {
     EXPR_KIND_FUNCALL,
 } Expr_Kind;
 
-typedef struct Binary_Op Binary_Op;
-typedef struct Funcall Funcall;
-typedef struct Funcall_Arg Funcall_Arg;
+typedef enum {
+    BINARY_OP_PLUS,
+    BINARY_OP_MINUS,
+    BINARY_OP_MULT,
+    BINARY_OP_DIV,
+    BINARY_OP_MOD,
+    BINARY_OP_SHL,
+    BINARY_OP_SHR,
+    BINARY_OP_AND,
+    BINARY_OP_OR,
+    BINARY_OP_XOR,
+    BINARY_OP_GT,
+    BINARY_OP_LT,
+    BINARY_OP_GE,
+    BINARY_OP_LE,
+    BINARY_OP_EQ,
+    BINARY_OP_NE,
+} Binary_Op_Kind;
+
+// The lowest precedence of the binary operators. The higher the
+// precedence the tighter the operator binds its operands.
+#define BINARY_OP_PRECEDENCE_MIN 0
 
-size_t funcall_args_len(Funcall_Arg *args);
+const char *binary_op_kind_name(Binary_Op_Kind kind);
+bool binary_op_of_token(Token_Kind kind, Binary_Op_Kind *op);
+size_t binary_op_precedence(Binary_Op_Kind kind);
+
+typedef struct {
+    String_View name;
+    size_t arity;
+} Funcall;
 
 typedef union {
     String_View as_binding;
@@ -89,48 +140,30 @@ typedef union {
     double as_lit_float;
     char as_lit_char;
     String_View as_lit_str;
-    Binary_Op *as_binary_op;
-    Funcall *as_funcall;
+    Binary_Op_Kind as_binary_op;
+    Funcall as_funcall;
 } Expr_Value;
 
 typedef struct {
     Expr_Kind kind;
     Expr_Value value;
+} Expr_Node;
+
+size_t expr_node_arity(Expr_Node node);
+
+// The nodes of an expression are stored in postfix order in a single
+// contiguous block: the operands of every binary operator and the
+// arguments of every funcall precede it. The root is the last node.
+typedef struct {
+    Expr_Node *nodes;
+    size_t count;
 } Expr;
 
+Expr_Node expr_root(Expr expr);
 void dump_expr(FILE *stream, Expr expr, int level);
 void dump_expr_as_dot(FILE *stream, Expr expr);
 
-typedef enum {
-    BINARY_OP_PLUS,
-    BINARY_OP_GT
-} Binary_Op_Kind;
-
-const char *binary_op_kind_name(Binary_Op_Kind kind);
-void dump_binary_op(FILE *stream, Binary_Op binary_op, int level);
-
-struct Binary_Op {
-    Binary_Op_Kind kind;
-    Expr left;
-    Expr right;
-};
-
-struct Funcall_Arg {
-    Funcall_Arg *next;
-    Expr value;
-};
-
-struct Funcall {
-    String_View name;
-    Funcall_Arg *args;
-};
-
-void dump_funcall_args(FILE *stream, Funcall_Arg *args, int level);
-Funcall_Arg *parse_funcall_args(Arena *arena, Tokens_View *tokens, File_Location location);
-Expr parse_sum_from_tokens(Arena *arena, Tokens_View *tokens, File_Location location);
-Expr parse_gt_from_tokens(Arena *arena, Tokens_View *tokens, File_Location location);
-Expr parse_primary_from_tokens(Arena *arena, Tokens_View *tokens, File_Location location);
-Expr parse_expr_from_tokens(Arena *arena, Tokens_View *tokens, File_Location location);
+Expr parse_expr_from_lexer(Arena *arena, Lexer *lexer);
 Expr parse_expr_from_sv(Arena *arena, String_View source, File_Location location);
 
 typedef enum {
@@ -143,9 +176,16 @@ typedef struct {
     Binding_Kind kind;
     String_View name;
     Word value;
+    Type type;
     Expr expr;
     Binding_Status status;
     File_Location location;
+    // The optimizer removed whatever the binding points to
+    bool eliminated;
+    // The name was bound by the text of a macro, `%rep` or `%unroll`
+    // expanded at expansion_location
+    bool expanded;
+    File_Location expansion_location;
 } Binding;
 
 typedef struct {
@@ -165,46 +205,359 @@ typedef struct {
 } Deferred_Assert;
 
 typedef struct {
-    Binding bindings[BASM_BINDINGS_CAPACITY];
+    Word word;
+    Type type;
+} Typed_Word;
+
+// `%inline name` asks the optimizer to inline the calls of the function
+typedef struct {
+    String_View name;
+    File_Location location;
+} Inline_Hint;
+
+// `%macro name(params) ... %endmacro`. The body is pasted in place of
+// every `name(args)` statement with the params replaced by the args.
+typedef struct {
+    String_View name;
+    String_View params[BASM_MACRO_PARAMS_CAPACITY];
+    size_t params_count;
+    String_View body;
+    // The location of the %macro line
+    File_Location location;
+} Macro;
+
+// `%sig name in -> out` declares that the function takes in values from
+// the stack and leaves out values. basm_verify_signatures() proves it.
+// The signatures of the natives are trusted by basm and checked by the
+// VM when it runs them.
+typedef struct {
+    String_View name;
+    uint64_t in;
+    uint64_t out;
+    File_Location location;
+} Signature_Hint;
+
+// How many times the instruction the label points to was executed.
+// Written by `bme -prof` and read by basm_load_profile().
+typedef struct {
+    String_View label;
+    uint64_t count;
+} Profile_Entry;
+
+// The operand of the instruction at addr is an address of the given
+// type relative to the beginning of the object file it is located in
+typedef struct {
+    Inst_Addr addr;
+    Type type;
+} Relocation;
+
+typedef struct {
+    String_View canonical_path;
+    String_View source;
+    // Set by `%pragma once`. The following includes of the file are skipped.
+    bool once;
+} Included_File;
+
+// The sources of the files shared by several translations, so the
+// common includes of a batch are read only once. Guarded by the lock
+// when the translations run in parallel.
+typedef struct {
+    Arena arena;
+
+    Included_File *files;
+    size_t files_size;
+    size_t files_capacity;
+    // The bytes of the forgotten files that are still in the arena
+    size_t forgotten_size;
+
+    void (*lock)(void *data);
+    void (*unlock)(void *data);
+    void *lock_data;
+} Basm_Include_Cache;
+
+typedef enum {
+    BASM_PHASE_READ = 0,
+    BASM_PHASE_FIRST_PASS,
+    BASM_PHASE_SECOND_PASS,
+    BASM_PHASE_OPTIMIZE,
+    BASM_PHASE_VERIFY,
+    BASM_PHASE_SAVE,
+    NUMBER_OF_BASM_PHASES,
+} Basm_Phase;
+
+const char *basm_phase_name(Basm_Phase phase);
+
+// Milliseconds since an arbitrary point in time
+double basm_clock(void);
+
+// See `basm -time-report`. The time of the first pass does not include
+// the time of reading the files.
+typedef struct {
+    double phase_times[NUMBER_OF_BASM_PHASES];
+    size_t lines_count;
+    size_t tokens_count;
+    size_t deferred_operands_count;
+} Basm_Stats;
+
+typedef struct {
+    Binding *bindings;
     size_t bindings_size;
+    size_t bindings_capacity;
+
+    // Open addressing hash table that maps the names of the bindings to
+    // their positions in the bindings array. 0 marks an empty slot, so
+    // the slots store the positions plus one.
+    size_t *bindings_index;
+    size_t bindings_index_capacity;
 
-    Deferred_Operand deferred_operands[BASM_DEFERRED_OPERANDS_CAPACITY];
+    Deferred_Operand *deferred_operands;
     size_t deferred_operands_size;
+    size_t deferred_operands_capacity;
 
-    Deferred_Assert deferred_asserts[BASM_DEFERRED_ASSERTS_CAPACITY];
+    Deferred_Assert *deferred_asserts;
     size_t deferred_asserts_size;
+    size_t deferred_asserts_capacity;
 
-    Inst program[BM_PROGRAM_CAPACITY];
+    Inst *program;
     uint64_t program_size;
+    size_t program_capacity;
     Inst_Addr entry;
     bool has_entry;
     File_Location entry_location;
     String_View deferred_entry_binding_name;
 
-    String_Length string_lengths[BASM_STRING_LENGTHS_CAPACITY];
+    String_Length *string_lengths;
     size_t string_lengths_size;
-
-    uint8_t memory[BM_MEMORY_CAPACITY];
+    size_t string_lengths_capacity;
+
+    // Open addressing hash table that maps the addresses of the strings
+    // in memory to their positions in the string_lengths array. Same
+    // convention as bindings_index.
+    size_t *string_lengths_index;
+    size_t string_lengths_index_capacity;
+
+    // Intern pool of the string literals. Open addressing hash table
+    // that maps the text of a literal to the position of its
+    // String_Length. The text itself is compared against the memory.
+    // Only used after `%pragma intern_strings`: the literals are mutable
+    // memory, so sharing them can change what the program does.
+    bool intern_strings;
+    size_t *strings_index;
+    size_t strings_index_size;
+    size_t strings_index_capacity;
+
+    // NOTE: memory_capacity is the capacity of the memory the BM program
+    // asks for and memory_buffer_capacity is the amount of bytes
+    // allocated for the memory section during the translation
+    uint8_t *memory;
     size_t memory_size;
     size_t memory_capacity;
+    size_t memory_buffer_capacity;
+
+    // The operand stack of basm_expr_eval(). Shared by the nested
+    // evaluations of the bindings an expression refers to.
+    Typed_Word *eval_stack;
+    size_t eval_stack_size;
+    size_t eval_stack_capacity;
 
     Arena arena;
 
     size_t include_level;
     File_Location include_location;
+
+    Basm_Stats stats;
+
+    // Every file that has been read during the translation. Each file is
+    // read only once no matter how many times it is included.
+    Included_File *included_files;
+    size_t included_files_size;
+    size_t included_files_capacity;
+
+    // Optional. Takes the sources of the included files from the cache
+    // instead of reading them again.
+    Basm_Include_Cache *include_cache;
+
+    // Translate the source into a relocatable object file instead of a
+    // complete program. See basm_save_to_object_file().
+    bool relocatable;
+
+    Relocation *relocations;
+    size_t relocations_size;
+    size_t relocations_capacity;
+
+    // Deferred operands that refer to the bindings defined in the other
+    // object files. Only present when relocatable is set.
+    Deferred_Operand *imports;
+    size_t imports_size;
+    size_t imports_capacity;
+
+    // Link a shared module instead of a program. The labels are exported
+    // and the addresses are relocated when the module is mapped.
+    bool shared;
+
+    // Run basm_optimize() on the program. Makes the translation track the
+    // addresses like in the relocatable mode.
+    bool optimize;
+
+    // Some of the tables store addresses of the memory. The optimizer
+    // can't move the data around then.
+    bool memory_has_addrs;
+
+    Inline_Hint *inline_hints;
+    size_t inline_hints_size;
+    size_t inline_hints_capacity;
+
+    // The optimizer lays the hot code out first. See basm_load_profile().
+    Profile_Entry *profile;
+    size_t profile_size;
+    size_t profile_capacity;
+
+    Signature_Hint *signature_hints;
+    size_t signature_hints_size;
+    size_t signature_hints_capacity;
+
+    // The verified signatures saved into the program
+    Bm_Signature *signatures;
+    size_t signatures_size;
+    size_t signatures_capacity;
+    Bm_Native_Signature *native_signatures;
+    size_t native_signatures_size;
+    size_t native_signatures_capacity;
+
+    Macro *macros;
+    size_t macros_size;
+    size_t macros_capacity;
+
+    size_t expansion_level;
+    // Where the innermost expansion being translated was requested
+    File_Location expansion_location;
+    // Numbers the expansions so every one of them gets its own local
+    // labels
+    size_t expansions_count;
+
+    // The shared modules the program imports from and the stubs of the
+    // imported functions. See basm_link_module().
+    String_View *modules;
+    size_t modules_size;
+    size_t modules_capacity;
+
+    Bm_Import *module_imports;
+    size_t module_imports_size;
+    size_t module_imports_capacity;
+
+    // The value of the index variable of the %table directive that is
+    // currently being generated. See BASM_TABLE_INDEX_NAME. It's only set
+    // while the element expression itself is evaluated, not the bindings
+    // it refers to.
+    bool has_table_index;
+    uint64_t table_index;
 } Basm;
 
 Binding *basm_resolve_binding(Basm *basm, String_View name);
+Binding *basm_push_binding(Basm *basm, String_View name, Binding_Kind kind, File_Location location);
 void basm_bind_expr(Basm *basm, String_View name, Expr expr, Binding_Kind kind, File_Location location);
-void basm_bind_value(Basm *basm, String_View name, Word value, Binding_Kind kind, File_Location location);
+void basm_bind_value(Basm *basm, String_View name, Word value, Type type, Binding_Kind kind, File_Location location);
 void basm_push_deferred_operand(Basm *basm, Inst_Addr addr, Expr expr, File_Location location);
+void basm_push_deferred_assert(Basm *basm, Expr expr, File_Location location);
+void basm_push_inline_hint(Basm *basm, String_View name, File_Location location);
+void basm_push_signature_hint(Basm *basm, Signature_Hint hint);
+Macro *basm_resolve_macro(Basm *basm, String_View name);
+void basm_push_relocation(Basm *basm, Inst_Addr addr, Type type);
+bool basm_tracks_relocations(const Basm *basm);
+void basm_push_import(Basm *basm, Deferred_Operand import);
+void basm_push_string_length(Basm *basm, Inst_Addr addr, uint64_t length);
+Inst *basm_push_inst(Basm *basm, Inst_Type type);
 void basm_save_to_file(Basm *basm, const char *output_file_path);
+void basm_save_symbols_to_file(Basm *basm, const char *file_path);
+void basm_save_dependencies_to_file(Basm *basm, const char *target, const char *file_path);
+void basm_save_to_object_file(Basm *basm, const char *file_path);
+void basm_link_object_file(Basm *basm, const char *file_path);
+void basm_link_module(Basm *basm, const char *file_path);
+void basm_resolve_deferred_operands(Basm *basm);
+void basm_load_profile(Basm *basm, const char *file_path);
+
+// Makes the following translations read the file again. Moves the rest
+// of the sources into a new arena once the forgotten ones take more
+// memory than them, so the sources that are still in use by any
+// translation become invalid. Must not be called during a translation.
+void basm_include_cache_forget(Basm_Include_Cache *cache, String_View canonical_path);
 Word basm_push_string_to_memory(Basm *basm, String_View sv);
+void basm_push_word_to_memory(Basm *basm, Word word, size_t size);
 bool basm_string_length_by_addr(Basm *basm, Inst_Addr addr, Word *length);
 void basm_translate_source(Basm *basm,
                            String_View input_file_path);
-Word basm_expr_eval(Basm *basm, Expr expr, File_Location location);
-Word basm_binding_eval(Basm *basm, Binding *binding, File_Location location);
+Word basm_expr_eval(Basm *basm, Expr expr, File_Location location, Type *type);
+Word basm_binding_eval(Basm *basm, Binding *binding, File_Location location, Type *type);
+
+// Peephole optimizer. Inlines small functions, folds constants, removes
+// dead code, threads jumps and reduces strength. Removes the functions
+// and the data that can't be reached from the entry point. Lays the hot
+// code out first if there is a profile. Updates the labels and the entry
+// point.
+void basm_optimize(Basm *basm);
+
+// Proves that the functions with the signatures never take more values
+// from the stack than they are given and never need more than the stack
+// has, and that they leave the declared amount of values. The functions
+// can only call the other functions with the signatures and can't be
+// recursive. Fills basm->signatures and basm->native_signatures.
+void basm_verify_signatures(Basm *basm);
+
+// The errors of the translation are reported to stderr and end with
+// basm_exit(). It jumps to *basm_error_handler if the current thread
+// has set it and exits the process otherwise. The Basm that failed can
+// only be cleaned and reused after that.
+extern _Thread_local jmp_buf *basm_error_handler;
+_Noreturn void basm_exit(void);
+
+#define BASM_OBJECT_MAGIC 0x6F62
+#define BASM_OBJECT_VERSION 1
+
+// Layout of a relocatable object file:
+//   Basm_Object_Meta
+//   Inst[program_size]
+//   uint8_t[memory_size]
+//   Basm_Object_Symbol[symbols_count], each followed by its name
+//   Basm_Object_Relocation[relocations_count]
+//   Basm_Object_Import[imports_count], each followed by its file path and name
+PACK(struct Basm_Object_Meta {
+    uint16_t magic;
+    uint16_t version;
+    uint64_t program_size;
+    uint64_t memory_size;
+    uint8_t has_entry;
+    uint64_t entry;
+    uint64_t symbols_count;
+    uint64_t relocations_count;
+    uint64_t imports_count;
+});
+
+typedef struct Basm_Object_Meta Basm_Object_Meta;
+
+PACK(struct Basm_Object_Symbol {
+    uint8_t kind;
+    uint8_t type;
+    uint64_t value;
+    uint64_t name_size;
+});
+
+typedef struct Basm_Object_Symbol Basm_Object_Symbol;
+
+PACK(struct Basm_Object_Relocation {
+    uint64_t addr;
+    uint8_t type;
+});
+
+typedef struct Basm_Object_Relocation Basm_Object_Relocation;
+
+PACK(struct Basm_Object_Import {
+    uint64_t addr;
+    uint64_t line_number;
+    uint64_t file_path_size;
+    uint64_t name_size;
+});
+
+typedef struct Basm_Object_Import Basm_Object_Import;
 
 void bm_load_standard_natives(Bm *bm);
 
@@ -161,13 +161,167 @@ bool inst_has_operand(Inst_Type type)
     }
 }
 
+bool inst_stack_effect(Inst_Type inst_type, uint64_t *pops, uint64_t *pushes)
+{
+    switch (inst_type) {
+    case INST_NOP:
+        *pops = 0;
+        *pushes = 0;
+        return true;
+    case INST_PUSH:
+        *pops = 0;
+        *pushes = 1;
+        return true;
+    case INST_DROP:
+        *pops = 1;
+        *pushes = 0;
+        return true;
+    case INST_NOT:
+    case INST_NOTB:
+    case INST_READ8:
+    case INST_READ16:
+    case INST_READ32:
+    case INST_READ64:
+    case INST_I2F:
+    case INST_U2F:
+    case INST_F2I:
+    case INST_F2U:
+        *pops = 1;
+        *pushes = 1;
+        return true;
+    case INST_PLUSI:
+    case INST_MINUSI:
+    case INST_MULTI:
+    case INST_DIVI:
+    case INST_MODI:
+    case INST_MULTU:
+    case INST_DIVU:
+    case INST_MODU:
+    case INST_PLUSF:
+    case INST_MINUSF:
+    case INST_MULTF:
+    case INST_DIVF:
+    case INST_EQI:
+    case INST_GEI:
+    case INST_GTI:
+    case INST_LEI:
+    case INST_LTI:
+    case INST_NEI:
+    case INST_EQU:
+    case INST_GEU:
+    case INST_GTU:
+    case INST_LEU:
+    case INST_LTU:
+    case INST_NEU:
+    case INST_EQF:
+    case INST_GEF:
+    case INST_GTF:
+    case INST_LEF:
+    case INST_LTF:
+    case INST_NEF:
+    case INST_ANDB:
+    case INST_ORB:
+    case INST_XOR:
+    case INST_SHR:
+    case INST_SHL:
+        *pops = 2;
+        *pushes = 1;
+        return true;
+    case INST_WRITE8:
+    case INST_WRITE16:
+    case INST_WRITE32:
+    case INST_WRITE64:
+        *pops = 2;
+        *pushes = 0;
+        return true;
+    case INST_DUP:
+    case INST_SWAP:
+    case INST_JMP:
+    case INST_JMP_IF:
+    case INST_RET:
+    case INST_CALL:
+    case INST_NATIVE:
+    case INST_HALT:
+    case NUMBER_OF_INSTS:
+        return false;
+    default:
+        assert(false && "inst_stack_effect: unreachable");
+        exit(1);
+    }
+}
+
+// NOTE: INST_NAME_HASH is a perfect hash of the names of the instructions.
+// It only looks at the first two characters, the last character and
+// the length of the name. The coefficients were found by a brute force
+// search. The table is built from inst_name() on the first lookup. If a
+// new instruction collides with an existing one the assertions of
+// inst_name_table_build() fail and the coefficients have to be searched
+// again.
+#define INST_NAME_HASH_CAPACITY 128
+#define INST_NAME_HASH(first, second, last, length) \
+    (((size_t) (first) * 18 + (size_t) (second) * 7 + (size_t) (last) * 9 + (size_t) (length) * 2) % INST_NAME_HASH_CAPACITY)
+
+typedef struct {
+    Inst_Type type;
+    // NULL if the slot is empty
+    const char *name;
+    size_t name_length;
+} Inst_Name_Slot;
+
+// NOTE: every thread builds its own copy of the table, so the
+// assemblers running in parallel don't need a lock
+static _Thread_local Inst_Name_Slot inst_name_table[INST_NAME_HASH_CAPACITY];
+static _Thread_local bool inst_name_table_built = false;
+
+static size_t inst_name_hash(const char *name, size_t length)
+{
+    assert(length >= 2);
+    return INST_NAME_HASH((uint8_t) name[0], (uint8_t) name[1], (uint8_t) name[length - 1], length);
+}
+
+static void inst_name_table_build(void)
+{
+    for (Inst_Type type = 0; type < NUMBER_OF_INSTS; ++type) {
+        const char *name = inst_name(type);
+        const size_t name_length = strlen(name);
+        Inst_Name_Slot *slot = &inst_name_table[inst_name_hash(name, name_length)];
+        assert(slot->name == NULL && "inst_name_table_build: the names of the instructions collide");
+        *slot = (Inst_Name_Slot) {
+            .type = type,
+            .name = name,
+            .name_length = name_length,
+        };
+    }
+
+    for (Inst_Type type = 0; type < NUMBER_OF_INSTS; ++type) {
+        const char *name = inst_name(type);
+        const Inst_Name_Slot *slot = &inst_name_table[inst_name_hash(name, strlen(name))];
+        assert(slot->type == type && "inst_name_table_build: the instruction is not found by its name");
+        (void) slot;
+    }
+
+    inst_name_table_built = true;
+}
+
 bool inst_by_name(String_View name, Inst_Type *output)
 {
-    for (Inst_Type type = (Inst_Type) 0; type < NUMBER_OF_INSTS; type += 1) {
-        if (sv_eq(sv_from_cstr(inst_name(type)), name)) {
-            *output = type;
-            return true;
-        }
+    if (!inst_name_table_built) {
+        inst_name_table_build();
+    }
+
+    if (name.count < 2) {
+        return false;
+    }
+
+    const Inst_Name_Slot *slot = &inst_name_table[inst_name_hash(name.data, name.count)];
+
+    // NOTE: the names that are not instructions mostly land on the empty
+    // slots or differ in length and never reach memcmp()
+    if (slot->name != NULL &&
+            slot->name_length == name.count &&
+            memcmp(slot->name, name.data, name.count) == 0) {
+        *output = slot->type;
+        return true;
     }
 
     return false;
@@ -327,6 +481,8 @@ const char *err_as_cstr(Err err)
         return "ERR_ILLEGAL_MEMORY_ACCESS";
     case ERR_NULL_NATIVE:
         return "ERR_NULL_NATIVE";
+    case ERR_UNRESOLVED_IMPORT:
+        return "ERR_UNRESOLVED_IMPORT";
     default:
         assert(false && "err_as_cstr: Unreachable");
         exit(1);
@@ -336,7 +492,9 @@ const char *err_as_cstr(Err err)
 Err bm_execute_program(Bm *bm, int limit)
 {
     while (limit != 0 && !bm->halt) {
-        Err err = bm_execute_inst(bm);
+        Err err = bm->verified_frames > 0
+                  ? bm_execute_verified_inst(bm)
+                  : bm_execute_inst(bm);
         if (err != ERR_OK) {
             return err;
         }
@@ -371,9 +529,33 @@ Err bm_execute_program(Bm *bm, int limit)
     } while (false)
 
 
+// Starts skipping the stack checks if the called function is verified
+// and there is enough room on the stack for it
+static void bm_enter_call(Bm *bm)
+{
+    if (bm->verified_frames > 0) {
+        bm->verified_frames += 1;
+        return;
+    }
+
+    if (bm->ip < BM_PROGRAM_CAPACITY && bm->signatures_index[bm->ip] > 0) {
+        const Bm_Signature *signature = &bm->signatures[bm->signatures_index[bm->ip] - 1];
+        // NOTE: the return address is already on the stack
+        if (bm->stack_size > signature->in &&
+                bm->stack_size - 1 - signature->in + signature->depth <= BM_STACK_CAPACITY) {
+            bm->verified_frames = 1;
+        }
+    }
+}
+
 Err bm_execute_inst(Bm *bm)
 {
     if (bm->ip >= bm->program_size) {
+        // NOTE: the unbound import stubs jump outside of the program, so
+        // the lazy binding costs nothing to the rest of the instructions
+        if (bm->ip - BM_LAZY_BIND_ADDR < bm->imports_size) {
+            return bm_bind_import(bm, bm->ip - BM_LAZY_BIND_ADDR);
+        }
         return ERR_ILLEGAL_INST_ACCESS;
     }
 
@@ -475,6 +657,9 @@ Err bm_execute_inst(Bm *bm)
 
         bm->ip = bm->stack[bm->stack_size - 1].as_u64;
         bm->stack_size -= 1;
+        if (bm->verified_frames > 0) {
+            bm->verified_frames -= 1;
+        }
         break;
 
     case INST_CALL:
@@ -484,6 +669,7 @@ Err bm_execute_inst(Bm *bm)
 
         bm->stack[bm->stack_size++].as_u64 = bm->ip + 1;
         bm->ip = inst.operand.as_u64;
+        bm_enter_call(bm);
         break;
 
     case INST_NATIVE:
@@ -790,6 +976,392 @@ Err bm_execute_inst(Bm *bm)
     return ERR_OK;
 }
 
+#define VERIFIED_BINARY_OP(bm, in, out, op)                             \
+    do {                                                                \
+        (bm)->stack[(bm)->stack_size - 2].as_##out = (bm)->stack[(bm)->stack_size - 2].as_##in op (bm)->stack[(bm)->stack_size - 1].as_##in; \
+        (bm)->stack_size -= 1;                                          \
+        (bm)->ip += 1;                                                  \
+    } while (false)
+
+// Executes an instruction of a function verified by basm without the
+// stack checks. The instructions that are not about the stack go through
+// bm_execute_inst().
+Err bm_execute_verified_inst(Bm *bm)
+{
+    assert(bm->verified_frames > 0);
+    assert(bm->ip < bm->program_size);
+
+    const Inst inst = bm->program[bm->ip];
+
+    switch (inst.type) {
+    case INST_NOP:
+        bm->ip += 1;
+        return ERR_OK;
+
+    case INST_PUSH:
+        bm->stack[bm->stack_size++] = inst.operand;
+        bm->ip += 1;
+        return ERR_OK;
+
+    case INST_DROP:
+        bm->stack_size -= 1;
+        bm->ip += 1;
+        return ERR_OK;
+
+    case INST_DUP:
+        bm->stack[bm->stack_size] = bm->stack[bm->stack_size - 1 - inst.operand.as_u64];
+        bm->stack_size += 1;
+        bm->ip += 1;
+        return ERR_OK;
+
+    case INST_SWAP: {
+        const uint64_t a = bm->stack_size - 1;
+        const uint64_t b = bm->stack_size - 1 - inst.operand.as_u64;
+
+        const Word t = bm->stack[a];
+        bm->stack[a] = bm->stack[b];
+        bm->stack[b] = t;
+        bm->ip += 1;
+    }
+    return ERR_OK;
+
+    case INST_PLUSI:
+        VERIFIED_BINARY_OP(bm, u64, u64, +);
+        return ERR_OK;
+
+    case INST_MINUSI:
+        VERIFIED_BINARY_OP(bm, u64, u64, -);
+        return ERR_OK;
+
+    case INST_MULTI:
+        VERIFIED_BINARY_OP(bm, i64, i64, *);
+        return ERR_OK;
+
+    case INST_MULTU:
+        VERIFIED_BINARY_OP(bm, u64, u64, *);
+        return ERR_OK;
+
+    case INST_PLUSF:
+        VERIFIED_BINARY_OP(bm, f64, f64, +);
+        return ERR_OK;
+
+    case INST_MINUSF:
+        VERIFIED_BINARY_OP(bm, f64, f64, -);
+        return ERR_OK;
+
+    case INST_MULTF:
+        VERIFIED_BINARY_OP(bm, f64, f64, *);
+        return ERR_OK;
+
+    case INST_DIVF:
+        VERIFIED_BINARY_OP(bm, f64, f64, /);
+        return ERR_OK;
+
+    case INST_EQF:
+        VERIFIED_BINARY_OP(bm, f64, u64, ==);
+        return ERR_OK;
+
+    case INST_GEF:
+        VERIFIED_BINARY_OP(bm, f64, u64, >=);
+        return ERR_OK;
+
+    case INST_GTF:
+        VERIFIED_BINARY_OP(bm, f64, u64, >);
+        return ERR_OK;
+
+    case INST_LEF:
+        VERIFIED_BINARY_OP(bm, f64, u64, <=);
+        return ERR_OK;
+
+    case INST_LTF:
+        VERIFIED_BINARY_OP(bm, f64, u64, <);
+        return ERR_OK;
+
+    case INST_NEF:
+        VERIFIED_BINARY_OP(bm, f64, u64, !=);
+        return ERR_OK;
+
+    case INST_EQI:
+        VERIFIED_BINARY_OP(bm, i64, u64, ==);
+        return ERR_OK;
+
+    case INST_GEI:
+        VERIFIED_BINARY_OP(bm, i64, u64, >=);
+        return ERR_OK;
+
+    case INST_GTI:
+        VERIFIED_BINARY_OP(bm, i64, u64, >);
+        return ERR_OK;
+
+    case INST_LEI:
+        VERIFIED_BINARY_OP(bm, i64, u64, <=);
+        return ERR_OK;
+
+    case INST_LTI:
+        VERIFIED_BINARY_OP(bm, i64, u64, <);
+        return ERR_OK;
+
+    case INST_NEI:
+        VERIFIED_BINARY_OP(bm, i64, u64, !=);
+        return ERR_OK;
+
+    case INST_EQU:
+        VERIFIED_BINARY_OP(bm, u64, u64, ==);
+        return ERR_OK;
+
+    case INST_GEU:
+        VERIFIED_BINARY_OP(bm, u64, u64, >=);
+        return ERR_OK;
+
+    case INST_GTU:
+        VERIFIED_BINARY_OP(bm, u64, u64, >);
+        return ERR_OK;
+
+    case INST_LEU:
+        VERIFIED_BINARY_OP(bm, u64, u64, <=);
+        return ERR_OK;
+
+    case INST_LTU:
+        VERIFIED_BINARY_OP(bm, u64, u64, <);
+        return ERR_OK;
+
+    case INST_NEU:
+        VERIFIED_BINARY_OP(bm, u64, u64, !=);
+        return ERR_OK;
+
+    case INST_ANDB:
+        VERIFIED_BINARY_OP(bm, u64, u64, &);
+        return ERR_OK;
+
+    case INST_ORB:
+        VERIFIED_BINARY_OP(bm, u64, u64, |);
+        return ERR_OK;
+
+    case INST_XOR:
+        VERIFIED_BINARY_OP(bm, u64, u64, ^);
+        return ERR_OK;
+
+    case INST_SHR:
+        VERIFIED_BINARY_OP(bm, u64, u64, >>);
+        return ERR_OK;
+
+    case INST_SHL:
+        VERIFIED_BINARY_OP(bm, u64, u64, <<);
+        return ERR_OK;
+
+    case INST_NOT:
+        bm->stack[bm->stack_size - 1].as_u64 = !bm->stack[bm->stack_size - 1].as_u64;
+        bm->ip += 1;
+        return ERR_OK;
+
+    case INST_JMP:
+        bm->ip = inst.operand.as_u64;
+        return ERR_OK;
+
+    case INST_JMP_IF:
+        bm->stack_size -= 1;
+        bm->ip = bm->stack[bm->stack_size].as_u64 ? inst.operand.as_u64 : bm->ip + 1;
+        return ERR_OK;
+
+    case INST_CALL:
+        bm->stack[bm->stack_size++].as_u64 = bm->ip + 1;
+        bm->ip = inst.operand.as_u64;
+        bm->verified_frames += 1;
+        return ERR_OK;
+
+    case INST_RET:
+        bm->stack_size -= 1;
+        bm->ip = bm->stack[bm->stack_size].as_u64;
+        bm->verified_frames -= 1;
+        return ERR_OK;
+
+    case INST_NATIVE: {
+        const uint64_t stack_size = bm->stack_size;
+        const Err err = bm_execute_inst(bm);
+        // NOTE: the signatures of the natives are not verified. If the
+        // native doesn't keep to its signature nothing is known about the
+        // stack anymore, so the checks are back on until the next call
+        // of a verified function. bm_enter_call() checks that it has
+        // enough room on the stack.
+        if (err == ERR_OK && bm->verified_frames > 0) {
+            const Bm_Native_Signature *signature = &bm->native_signatures[bm->native_signatures_index[inst.operand.as_u64] - 1];
+            if (stack_size < signature->in ||
+                    bm->stack_size != stack_size - signature->in + signature->out) {
+                bm->verified_frames = 0;
+            }
+        }
+        return err;
+    }
+
+    // NOTE: the division by zero and the memory accesses are still
+    // checked
+    case INST_DIVI:
+    case INST_DIVU:
+    case INST_MODI:
+    case INST_MODU:
+    case INST_HALT:
+    case INST_NOTB:
+    case INST_READ8:
+    case INST_READ16:
+    case INST_READ32:
+    case INST_READ64:
+    case INST_WRITE8:
+    case INST_WRITE16:
+    case INST_WRITE32:
+    case INST_WRITE64:
+    case INST_I2F:
+    case INST_U2F:
+    case INST_F2I:
+    case INST_F2U:
+        return bm_execute_inst(bm);
+
+    case NUMBER_OF_INSTS:
+    default:
+        assert(false && "bm_execute_verified_inst: unreachable");
+        exit(1);
+    }
+}
+
+// The stack of a function at an instruction relative to the values below
+// its arguments
+typedef struct {
+    bool visited;
+    uint64_t depth;
+    // Where the return address is
+    uint64_t ret;
+} Bm_Verifier_State;
+
+const char *bm_verify_function(const Inst *program, size_t program_size,
+                               Bm_Signature *signature,
+                               Bm_Callee_Signature callee_signature, void *data,
+                               Inst_Addr *at)
+{
+    const size_t n = program_size;
+    const Inst_Addr entry = signature->addr;
+    assert(entry < n);
+
+    Bm_Verifier_State *states = calloc(n + 1, sizeof(states[0]));
+    Inst_Addr *worklist = calloc(n + 1, sizeof(worklist[0]));
+    if (states == NULL || worklist == NULL) {
+        fprintf(stderr, "ERROR: could not allocate memory: %s\n", strerror(errno));
+        exit(1);
+    }
+    size_t worklist_size = 0;
+    const char *reason = NULL;
+
+    states[entry] = (Bm_Verifier_State) {
+        .visited = true,
+        .depth = signature->in + 1,
+        .ret = signature->in,
+    };
+    worklist[worklist_size++] = entry;
+    uint64_t max_depth = signature->in + 1;
+    *at = entry;
+
+    while (reason == NULL && worklist_size > 0) {
+        const Inst_Addr i = worklist[--worklist_size];
+        const Inst inst = program[i];
+        Bm_Verifier_State state = states[i];
+        Inst_Addr successors[2] = {i + 1, 0};
+        size_t successors_count = 1;
+        uint64_t pops = 0;
+        uint64_t pushes = 0;
+        *at = i;
+
+        if (inst.type == INST_RET) {
+            if (state.depth != signature->out + 1) {
+                reason = "the amount of values on the stack does not match the signature";
+            } else if (state.ret != state.depth - 1) {
+                reason = "the return address is not on top of the stack";
+            }
+            successors_count = 0;
+        } else if (inst.type == INST_HALT) {
+            successors_count = 0;
+        } else if (inst.type == INST_JMP) {
+            successors[0] = inst.operand.as_u64;
+        } else if (inst.type == INST_JMP_IF) {
+            if (state.depth - 1 <= state.ret) {
+                reason = "the condition is the return address";
+            }
+            state.depth -= 1;
+            successors[1] = inst.operand.as_u64;
+            successors_count = 2;
+        } else if (inst.type == INST_DUP) {
+            if (inst.operand.as_u64 >= state.depth) {
+                reason = "dup reaches below the arguments";
+            }
+            state.depth += 1;
+        } else if (inst.type == INST_SWAP) {
+            const uint64_t a = state.depth - 1;
+            if (inst.operand.as_u64 > a) {
+                reason = "swap reaches below the arguments";
+            } else {
+                const uint64_t b = a - inst.operand.as_u64;
+                if (state.ret == a) {
+                    state.ret = b;
+                } else if (state.ret == b) {
+                    state.ret = a;
+                }
+            }
+        } else if (inst.type == INST_CALL || inst.type == INST_NATIVE) {
+            Bm_Signature callee = {0};
+            reason = callee_signature(data, inst, &callee);
+            if (reason == NULL) {
+                if (inst.type == INST_NATIVE) {
+                    // NOTE: the signatures of the natives are trusted
+                    callee.depth = callee.in > callee.out ? callee.in : callee.out;
+                }
+
+                if (state.depth < callee.in || state.depth - callee.in <= state.ret) {
+                    reason = "the arguments of the call include the return address";
+                } else {
+                    const uint64_t base = state.depth - callee.in;
+                    if (max_depth < base + callee.depth) {
+                        max_depth = base + callee.depth;
+                    }
+                    state.depth = base + callee.out;
+                }
+            }
+        } else if (inst_stack_effect(inst.type, &pops, &pushes)) {
+            if (state.depth < pops || state.depth - pops <= state.ret) {
+                reason = "takes the return address from the stack";
+            }
+            state.depth = state.depth - pops + pushes;
+        } else {
+            reason = "unsupported instruction";
+        }
+
+        if (max_depth < state.depth) {
+            max_depth = state.depth;
+        }
+
+        for (size_t j = 0; reason == NULL && j < successors_count; ++j) {
+            const Inst_Addr successor = successors[j];
+            if (successor >= n) {
+                reason = "jumps outside of the program";
+            } else if (!states[successor].visited) {
+                states[successor] = state;
+                states[successor].visited = true;
+                worklist[worklist_size++] = successor;
+            } else if (states[successor].depth != state.depth || states[successor].ret != state.ret) {
+                *at = successor;
+                reason = "the paths with different stacks meet";
+            }
+        }
+    }
+
+    if (reason == NULL && max_depth > BM_STACK_CAPACITY) {
+        *at = entry;
+        reason = "the function does not fit into the stack";
+    }
+
+    free(states);
+    free(worklist);
+
+    signature->depth = max_depth;
+    return reason;
+}
+
 void bm_push_native(Bm *bm, Bm_Native native)
 {
     assert(bm->natives_size < BM_NATIVES_CAPACITY);
@@ -812,6 +1384,66 @@ void bm_dump_stack(FILE *stream, const Bm *bm)
     }
 }
 
+static void bm_file_read(void *data, size_t size, size_t count, FILE *f, const char *file_path)
+{
+    if (fread(data, size, count, f) != count) {
+        fprintf(stderr, "ERROR: %s: unexpected end of the BM file\n", file_path);
+        exit(1);
+    }
+}
+
+static void *bm_file_alloc(size_t size)
+{
+    void *data = malloc(size);
+    if (size > 0 && data == NULL) {
+        fprintf(stderr, "ERROR: could not allocate memory: %s\n", strerror(errno));
+        exit(1);
+    }
+    return data;
+}
+
+static String_View bm_file_read_string(Bm *bm, uint64_t count, FILE *f, const char *file_path)
+{
+    if (count >= BM_STRINGS_CAPACITY - bm->strings_size) {
+        fprintf(stderr, "ERROR: %s: the names of the imports are too long\n", file_path);
+        exit(1);
+    }
+
+    char *data = bm->strings + bm->strings_size;
+    bm_file_read(data, sizeof(data[0]), count, f, file_path);
+    data[count] = '\0';
+    bm->strings_size += count + 1;
+
+    return (String_View) {
+        .count = count,
+        .data = data,
+    };
+}
+
+static const char *bm_callee_signature(void *data, Inst inst, Bm_Signature *callee)
+{
+    const Bm *bm = data;
+
+    if (inst.type == INST_CALL) {
+        const Inst_Addr target = inst.operand.as_u64;
+        if (target >= bm->program_size || bm->signatures_index[target] == 0) {
+            return "calls a function without a signature";
+        }
+        *callee = bm->signatures[bm->signatures_index[target] - 1];
+        return NULL;
+    }
+
+    assert(inst.type == INST_NATIVE);
+    const uint64_t native = inst.operand.as_u64;
+    if (native >= BM_NATIVES_CAPACITY || bm->native_signatures_index[native] == 0) {
+        return "invokes a native function without a signature";
+    }
+    const Bm_Native_Signature *signature = &bm->native_signatures[bm->native_signatures_index[native] - 1];
+    callee->in = signature->in;
+    callee->out = signature->out;
+    return NULL;
+}
+
 void bm_load_program_from_file(Bm *bm, const char *file_path)
 {
     memset(bm, 0, sizeof(*bm));
@@ -898,7 +1530,309 @@ void bm_load_program_from_file(Bm *bm, const char *file_path)
         exit(1);
     }
 
+    bm->memory_capacity = meta.memory_capacity;
+
+    if (meta.exports_count > 0 || meta.relocations_count > 0) {
+        fprintf(stderr, "ERROR: %s is a shared module. It can't be executed on its own.\n",
+                file_path);
+        exit(1);
+    }
+
+    if (meta.modules_count > BM_MODULES_CAPACITY || meta.imports_count > BM_IMPORTS_CAPACITY) {
+        fprintf(stderr, "ERROR: %s: the program imports from too many modules or too many functions\n",
+                file_path);
+        exit(1);
+    }
+
+    for (uint64_t i = 0; i < meta.modules_count; ++i) {
+        Bm_File_Module module = {0};
+        bm_file_read(&module, sizeof(module), 1, f, file_path);
+        bm->mappings[bm->mappings_size++].file_path = bm_file_read_string(bm, module.file_path_size, f, file_path);
+    }
+
+    for (uint64_t i = 0; i < meta.imports_count; ++i) {
+        Bm_File_Import import = {0};
+        bm_file_read(&import, sizeof(import), 1, f, file_path);
+
+        if (import.module >= bm->mappings_size || import.stub >= bm->program_size) {
+            fprintf(stderr, "ERROR: %s: invalid import %"PRIu64"\n", file_path, i);
+            exit(1);
+        }
+
+        bm->imports[bm->imports_size++] = (Bm_Import) {
+            .name = bm_file_read_string(bm, import.name_size, f, file_path),
+            .module = import.module,
+            .stub = import.stub,
+        };
+    }
+
+    if (meta.signatures_count > BM_SIGNATURES_CAPACITY) {
+        fprintf(stderr, "ERROR: %s: the program has too many signatures\n",
+                file_path);
+        exit(1);
+    }
+
+    for (uint64_t i = 0; i < meta.signatures_count; ++i) {
+        Bm_File_Signature signature = {0};
+        bm_file_read(&signature, sizeof(signature), 1, f, file_path);
+
+        if (signature.addr >= bm->program_size ||
+                signature.depth > BM_STACK_CAPACITY ||
+                signature.in >= signature.depth ||
+                signature.out >= signature.depth) {
+            fprintf(stderr, "ERROR: %s: invalid signature %"PRIu64"\n", file_path, i);
+            exit(1);
+        }
+
+        bm->signatures[bm->signatures_size++] = (Bm_Signature) {
+            .addr = signature.addr,
+            .in = signature.in,
+            .out = signature.out,
+            .depth = signature.depth,
+        };
+        bm->signatures_index[signature.addr] = (uint16_t) bm->signatures_size;
+    }
+
+    if (meta.native_signatures_count > BM_NATIVES_CAPACITY) {
+        fprintf(stderr, "ERROR: %s: the program has too many signatures of natives\n",
+                file_path);
+        exit(1);
+    }
+
+    for (uint64_t i = 0; i < meta.native_signatures_count; ++i) {
+        Bm_File_Native_Signature signature = {0};
+        bm_file_read(&signature, sizeof(signature), 1, f, file_path);
+
+        if (signature.native >= BM_NATIVES_CAPACITY ||
+                bm->native_signatures_index[signature.native] != 0 ||
+                signature.in >= BM_STACK_CAPACITY ||
+                signature.out >= BM_STACK_CAPACITY) {
+            fprintf(stderr, "ERROR: %s: invalid signature of native %"PRIu64"\n", file_path, i);
+            exit(1);
+        }
+
+        bm->native_signatures[bm->native_signatures_size++] = (Bm_Native_Signature) {
+            .native = signature.native,
+            .in = signature.in,
+            .out = signature.out,
+        };
+        bm->native_signatures_index[signature.native] = (uint16_t) bm->native_signatures_size;
+    }
+
+    fclose(f);
+
+    // NOTE: the VM skips the stack checks in the verified functions, so
+    // it doesn't take the signatures from the file on trust
+    for (size_t i = 0; i < bm->signatures_size; ++i) {
+        Bm_Signature signature = bm->signatures[i];
+        Inst_Addr at = 0;
+        const char *reason = bm_verify_function(bm->program, bm->program_size,
+                                                &signature, bm_callee_signature, bm, &at);
+        // NOTE: the depth of the callees is taken from their signatures.
+        // A recursive function needs more than the depth of its own
+        // signature, so the recursion never passes this check.
+        if (reason == NULL && signature.depth > bm->signatures[i].depth) {
+            at = signature.addr;
+            reason = "the function needs more of the stack than its signature says";
+        }
+        if (reason != NULL) {
+            fprintf(stderr, "ERROR: %s: invalid signature %zu: %s at instruction %"PRIu64"\n",
+                    file_path, i, reason, at);
+            exit(1);
+        }
+    }
+}
+
+// NOTE: the modules are never unloaded. A long-running host loads each
+// of them once and maps the same copy into all of its programs.
+static Bm_Module bm_modules[BM_MODULES_CAPACITY];
+static size_t bm_modules_size = 0;
+
+const Bm_Module *bm_module_load(const char *file_path)
+{
+    for (size_t i = 0; i < bm_modules_size; ++i) {
+        if (strcmp(bm_modules[i].file_path, file_path) == 0) {
+            return &bm_modules[i];
+        }
+    }
+
+    if (bm_modules_size >= BM_MODULES_CAPACITY) {
+        fprintf(stderr, "ERROR: %s: too many modules are loaded. The capacity is %d\n",
+                file_path, BM_MODULES_CAPACITY);
+        exit(1);
+    }
+
+    FILE *f = fopen(file_path, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "ERROR: Could not open file `%s`: %s\n",
+                file_path, strerror(errno));
+        exit(1);
+    }
+
+    Bm_File_Meta meta = {0};
+    bm_file_read(&meta, sizeof(meta), 1, f, file_path);
+
+    if (meta.magic != BM_FILE_MAGIC || meta.version != BM_FILE_VERSION) {
+        fprintf(stderr, "ERROR: %s does not appear to be a valid BM file of version %d\n",
+                file_path, BM_FILE_VERSION);
+        exit(1);
+    }
+
+    if (meta.modules_count > 0 || meta.imports_count > 0) {
+        fprintf(stderr, "ERROR: %s: a shared module can't import from other modules\n",
+                file_path);
+        exit(1);
+    }
+
+    if (meta.memory_size > meta.memory_capacity) {
+        fprintf(stderr,
+                "ERROR: %s: memory size %"PRIu64" is greater than declared memory capacity %"PRIu64"\n",
+                file_path,
+                meta.memory_size,
+                meta.memory_capacity);
+        exit(1);
+    }
+
+    Bm_Module *module = &bm_modules[bm_modules_size];
+    memset(module, 0, sizeof(*module));
+
+    module->file_path = bm_file_alloc(strlen(file_path) + 1);
+    strcpy(module->file_path, file_path);
+
+    module->program_size = meta.program_size;
+    module->program = bm_file_alloc(sizeof(module->program[0]) * meta.program_size);
+    bm_file_read(module->program, sizeof(module->program[0]), meta.program_size, f, file_path);
+
+    module->memory_size = meta.memory_size;
+    module->memory_capacity = meta.memory_capacity;
+    module->memory = bm_file_alloc(sizeof(module->memory[0]) * meta.memory_size);
+    bm_file_read(module->memory, sizeof(module->memory[0]), meta.memory_size, f, file_path);
+
+    module->exports = bm_file_alloc(sizeof(module->exports[0]) * meta.exports_count);
+    for (uint64_t i = 0; i < meta.exports_count; ++i) {
+        Bm_File_Export export = {0};
+        bm_file_read(&export, sizeof(export), 1, f, file_path);
+
+        char *name = bm_file_alloc(export.name_size);
+        bm_file_read(name, sizeof(name[0]), export.name_size, f, file_path);
+
+        if (export.addr >= meta.program_size) {
+            fprintf(stderr, "ERROR: %s: export `%.*s` points outside of the module\n",
+                    file_path, (int) export.name_size, name);
+            exit(1);
+        }
+
+        module->exports[module->exports_size++] = (Bm_Export) {
+            .name = {
+                .count = export.name_size,
+                .data = name,
+            },
+            .addr = export.addr,
+        };
+    }
+
+    module->relocations = bm_file_alloc(sizeof(module->relocations[0]) * meta.relocations_count);
+    for (uint64_t i = 0; i < meta.relocations_count; ++i) {
+        Bm_File_Relocation relocation = {0};
+        bm_file_read(&relocation, sizeof(relocation), 1, f, file_path);
+
+        if (relocation.addr >= meta.program_size || relocation.kind > BM_RELOCATION_MEMORY_ADDR) {
+            fprintf(stderr, "ERROR: %s: invalid relocation of the instruction %"PRIu64"\n",
+                    file_path, relocation.addr);
+            exit(1);
+        }
+
+        module->relocations[module->relocations_size++] = (Bm_Relocation) {
+            .addr = relocation.addr,
+            .kind = (Bm_Relocation_Kind) relocation.kind,
+        };
+    }
+
     fclose(f);
+
+    bm_modules_size += 1;
+    return module;
+}
+
+bool bm_module_find_export(const Bm_Module *module, String_View name, Inst_Addr *addr)
+{
+    for (size_t i = 0; i < module->exports_size; ++i) {
+        if (sv_eq(module->exports[i].name, name)) {
+            *addr = module->exports[i].addr;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void bm_map_module(Bm *bm, Bm_Mapping *mapping)
+{
+    // NOTE: the file paths in bm->strings are NUL-terminated
+    const Bm_Module *module = bm_module_load(mapping->file_path.data);
+
+    if (module->program_size > BM_PROGRAM_CAPACITY - bm->program_size) {
+        fprintf(stderr, "ERROR: %s: the module does not fit into the program memory of the BM\n",
+                module->file_path);
+        exit(1);
+    }
+
+    if (module->memory_capacity > BM_MEMORY_CAPACITY - bm->memory_capacity - bm->memory_mapped_size) {
+        fprintf(stderr, "ERROR: %s: the module does not fit into the memory of the BM\n",
+                module->file_path);
+        exit(1);
+    }
+
+    mapping->module = module;
+    mapping->program_base = bm->program_size;
+    bm->memory_mapped_size += module->memory_capacity;
+    mapping->memory_base = BM_MEMORY_CAPACITY - bm->memory_mapped_size;
+
+    memcpy(bm->program + mapping->program_base, module->program,
+           sizeof(module->program[0]) * module->program_size);
+    bm->program_size += module->program_size;
+
+    memcpy(bm->memory + mapping->memory_base, module->memory,
+           sizeof(module->memory[0]) * module->memory_size);
+
+    for (size_t i = 0; i < module->relocations_size; ++i) {
+        Inst *inst = &bm->program[mapping->program_base + module->relocations[i].addr];
+        switch (module->relocations[i].kind) {
+        case BM_RELOCATION_INST_ADDR:
+            inst->operand.as_u64 += mapping->program_base;
+            break;
+        case BM_RELOCATION_MEMORY_ADDR:
+            inst->operand.as_u64 += mapping->memory_base;
+            break;
+        default:
+            assert(false && "bm_map_module: unreachable");
+            exit(1);
+        }
+    }
+}
+
+// Binds the import on its first call. The stub of the import is
+// patched to jump right into the module, so the following calls don't
+// go through here anymore.
+Err bm_bind_import(Bm *bm, size_t index)
+{
+    assert(index < bm->imports_size);
+    const Bm_Import *import = &bm->imports[index];
+
+    Bm_Mapping *mapping = &bm->mappings[import->module];
+    if (mapping->module == NULL) {
+        bm_map_module(bm, mapping);
+    }
+
+    Inst_Addr addr = 0;
+    if (!bm_module_find_export(mapping->module, import->name, &addr)) {
+        return ERR_UNRESOLVED_IMPORT;
+    }
+
+    bm->program[import->stub].operand = word_u64(mapping->program_base + addr);
+    bm->ip = mapping->program_base + addr;
+
+    return ERR_OK;
 }
 
 void bm_load_standard_natives(Bm *bm)
@@ -28,6 +28,14 @@
 #define BM_PROGRAM_CAPACITY 1024
 #define BM_NATIVES_CAPACITY 1024
 #define BM_MEMORY_CAPACITY (640 * 1000)
+#define BM_MODULES_CAPACITY 16
+#define BM_IMPORTS_CAPACITY 256
+#define BM_STRINGS_CAPACITY (16 * 1024)
+#define BM_SIGNATURES_CAPACITY 256
+
+// The stub of the import i jumps to BM_LAZY_BIND_ADDR + i until the
+// import is bound on its first call. See bm_bind_import().
+#define BM_LAZY_BIND_ADDR (UINT64_C(1) << 63)
 
 typedef enum {
     ERR_OK = 0,
@@ -38,7 +46,8 @@ typedef enum {
     ERR_ILLEGAL_OPERAND,
     ERR_ILLEGAL_MEMORY_ACCESS,
     ERR_DIV_BY_ZERO,
-    ERR_NULL_NATIVE
+    ERR_NULL_NATIVE,
+    ERR_UNRESOLVED_IMPORT,
 } Err;
 
 const char *err_as_cstr(Err err);
@@ -115,6 +124,10 @@ typedef enum {
 
 const char *inst_name(Inst_Type type);
 bool inst_has_operand(Inst_Type type);
+// How many values the instruction takes from the stack and puts back.
+// False for the instructions that transfer the control or whose effect
+// on the stack depends on the operand.
+bool inst_stack_effect(Inst_Type inst_type, uint64_t *pops, uint64_t *pushes);
 bool inst_by_name(String_View name, Inst_Type *output);
 
 typedef uint64_t Inst_Addr;
@@ -140,6 +153,94 @@ typedef struct {
     Word operand;
 } Inst;
 
+// A shared module loaded from a file. Loaded once per process no
+// matter how many programs import from it. See bm_module_load().
+typedef struct {
+    String_View name;
+    Inst_Addr addr;
+} Bm_Export;
+
+typedef enum {
+    BM_RELOCATION_INST_ADDR = 0,
+    BM_RELOCATION_MEMORY_ADDR,
+} Bm_Relocation_Kind;
+
+typedef struct {
+    Inst_Addr addr;
+    Bm_Relocation_Kind kind;
+} Bm_Relocation;
+
+typedef struct {
+    char *file_path;
+
+    Inst *program;
+    uint64_t program_size;
+
+    uint8_t *memory;
+    uint64_t memory_size;
+    uint64_t memory_capacity;
+
+    Bm_Export *exports;
+    size_t exports_size;
+
+    Bm_Relocation *relocations;
+    size_t relocations_size;
+} Bm_Module;
+
+const Bm_Module *bm_module_load(const char *file_path);
+bool bm_module_find_export(const Bm_Module *module, String_View name, Inst_Addr *addr);
+
+// A module the program imports from and where it is mapped into the
+// program. module is NULL until the module is mapped.
+typedef struct {
+    String_View file_path;
+    const Bm_Module *module;
+    Inst_Addr program_base;
+    Memory_Addr memory_base;
+} Bm_Mapping;
+
+typedef struct {
+    String_View name;
+    uint64_t module;
+    Inst_Addr stub;
+} Bm_Import;
+
+// The stack effect of a function proven by basm. The function takes in
+// values and leaves out values in their place. It never needs more than
+// depth values above the ones below its arguments counting the return
+// address and the functions it calls.
+typedef struct {
+    Inst_Addr addr;
+    uint64_t in;
+    uint64_t out;
+    uint64_t depth;
+} Bm_Signature;
+
+// The stack effect of a native function. The natives can't be verified,
+// so the VM checks it every time a verified function invokes the native.
+typedef struct {
+    uint64_t native;
+    uint64_t in;
+    uint64_t out;
+} Bm_Native_Signature;
+
+// Finds the signature of the function called or the native invoked by
+// the instruction. Returns the reason why it can't be verified or NULL.
+// Only in and out matter for the natives.
+typedef const char *(*Bm_Callee_Signature)(void *data, Inst inst, Bm_Signature *callee);
+
+// Proves that the function at signature->addr never takes more values
+// from the stack than signature->in and leaves signature->out values in
+// their place. Follows every path of the function from its entry keeping
+// track of how many values it has on the stack and where its return
+// address is. Sets signature->depth and returns NULL if the signature
+// holds. Otherwise returns the reason why it doesn't and sets *at to the
+// offending instruction.
+const char *bm_verify_function(const Inst *program, size_t program_size,
+                               Bm_Signature *signature,
+                               Bm_Callee_Signature callee_signature, void *data,
+                               Inst_Addr *at);
+
 typedef struct Bm Bm;
 
 typedef Err (*Bm_Native)(Bm*);
@@ -156,19 +257,63 @@ struct Bm {
     size_t natives_size;
 
     uint8_t memory[BM_MEMORY_CAPACITY];
+    uint64_t memory_capacity;
+
+    Bm_Import imports[BM_IMPORTS_CAPACITY];
+    size_t imports_size;
+
+    // The modules are mapped on the first call to any of their imports.
+    // Their memory is taken from the end of the BM memory downwards.
+    Bm_Mapping mappings[BM_MODULES_CAPACITY];
+    size_t mappings_size;
+    uint64_t memory_mapped_size;
+
+    // Storage for the names of the imports and the modules
+    char strings[BM_STRINGS_CAPACITY];
+    size_t strings_size;
+
+    Bm_Signature signatures[BM_SIGNATURES_CAPACITY];
+    size_t signatures_size;
+    // The position of the signature of the function at every address
+    // plus one. 0 if the function has no signature.
+    uint16_t signatures_index[BM_PROGRAM_CAPACITY];
+    Bm_Native_Signature native_signatures[BM_NATIVES_CAPACITY];
+    size_t native_signatures_size;
+    // The position of the signature of every native plus one
+    uint16_t native_signatures_index[BM_NATIVES_CAPACITY];
+    // The amount of the calls of the verified functions the VM is in.
+    // The stack checks are skipped while it's not 0. See
+    // bm_execute_verified_inst().
+    uint64_t verified_frames;
 
     bool halt;
 };
 
 Err bm_execute_inst(Bm *bm);
+Err bm_execute_verified_inst(Bm *bm);
 Err bm_execute_program(Bm *bm, int limit);
 void bm_push_native(Bm *bm, Bm_Native native);
 void bm_dump_stack(FILE *stream, const Bm *bm);
 void bm_load_program_from_file(Bm *bm, const char *file_path);
+Err bm_bind_import(Bm *bm, size_t index);
 void bm_load_standard_natives(Bm *bm);
 
 #define BM_FILE_MAGIC 0x6D62
-#define BM_FILE_VERSION 5
+#define BM_FILE_VERSION 8
+
+// Layout of a BM file:
+//   Bm_File_Meta
+//   Inst[program_size]
+//   uint8_t[memory_size]
+//   Bm_File_Export[exports_count], each followed by its name
+//   Bm_File_Relocation[relocations_count]
+//   Bm_File_Module[modules_count], each followed by its file path
+//   Bm_File_Import[imports_count], each followed by its name
+//   Bm_File_Signature[signatures_count]
+//   Bm_File_Native_Signature[native_signatures_count]
+//
+// Only shared modules have exports and relocations. Only programs
+// have modules, imports and signatures.
 
 PACK(struct Bm_File_Meta {
     uint16_t magic;
@@ -177,10 +322,61 @@ PACK(struct Bm_File_Meta {
     uint64_t entry;
     uint64_t memory_size;
     uint64_t memory_capacity;
+    uint64_t exports_count;
+    uint64_t relocations_count;
+    uint64_t modules_count;
+    uint64_t imports_count;
+    uint64_t signatures_count;
+    uint64_t native_signatures_count;
 });
 
 typedef struct Bm_File_Meta Bm_File_Meta;
 
+PACK(struct Bm_File_Export {
+    uint64_t addr;
+    uint64_t name_size;
+});
+
+typedef struct Bm_File_Export Bm_File_Export;
+
+PACK(struct Bm_File_Relocation {
+    uint64_t addr;
+    uint8_t kind;
+});
+
+typedef struct Bm_File_Relocation Bm_File_Relocation;
+
+PACK(struct Bm_File_Module {
+    uint64_t file_path_size;
+});
+
+typedef struct Bm_File_Module Bm_File_Module;
+
+PACK(struct Bm_File_Import {
+    uint64_t module;
+    uint64_t stub;
+    uint64_t name_size;
+});
+
+typedef struct Bm_File_Import Bm_File_Import;
+
+PACK(struct Bm_File_Signature {
+    uint64_t addr;
+    uint64_t in;
+    uint64_t out;
+    uint64_t depth;
+});
+
+typedef struct Bm_File_Signature Bm_File_Signature;
+
+PACK(struct Bm_File_Native_Signature {
+    uint64_t native;
+    uint64_t in;
+    uint64_t out;
+});
+
+typedef struct Bm_File_Native_Signature Bm_File_Native_Signature;
+
 Err native_write(Bm *bm);
 
 #endif // BM_H_
@@ -0,0 +1,1049 @@
+#include "./basm.h"
+
+// NOTE: the passes are repeated until nothing changes. The limit only
+// matters for the programs that jump around in circles.
+#define BASM_OPTIMIZER_MAX_PASSES 16
+
+// The longest sequence of instructions a peephole pattern looks at
+#define BASM_OPTIMIZER_WINDOW 3
+
+// The functions that take at most that many instructions once inlined
+// are inlined without asking
+#define BASM_INLINE_THRESHOLD 8
+
+static bool inst_operand_is_inst_addr(Inst_Type inst_type, Type type)
+{
+    return inst_type == INST_JMP
+           || inst_type == INST_JMP_IF
+           || inst_type == INST_CALL
+           || type == TYPE_INST_ADDR;
+}
+
+static bool inst_is_unconditional_jump(Inst_Type inst_type)
+{
+    return inst_type == INST_JMP
+           || inst_type == INST_RET
+           || inst_type == INST_HALT;
+}
+
+static bool is_power_of_two(uint64_t x, uint64_t *log2)
+{
+    if (x == 0 || (x & (x - 1)) != 0) {
+        return false;
+    }
+
+    *log2 = 0;
+    while (x > 1) {
+        x >>= 1;
+        *log2 += 1;
+    }
+    return true;
+}
+
+// Computes `a b op` the same way the BM does. Returns false for the
+// operations that fail or are undefined at runtime, so they stay there.
+static bool fold_binary_op(Inst_Type inst_type, Word a, Word b, Word *result)
+{
+    switch (inst_type) {
+    case INST_PLUSI:
+        *result = word_u64(a.as_u64 + b.as_u64);
+        return true;
+    case INST_MINUSI:
+        *result = word_u64(a.as_u64 - b.as_u64);
+        return true;
+    case INST_MULTI:
+    case INST_MULTU:
+        // NOTE: the signed product has the same bits as the unsigned one
+        *result = word_u64(a.as_u64 * b.as_u64);
+        return true;
+    case INST_DIVI:
+    case INST_MODI:
+        if (b.as_i64 == 0 || (a.as_i64 == INT64_MIN && b.as_i64 == -1)) {
+            return false;
+        }
+        *result = word_i64(inst_type == INST_DIVI ? a.as_i64 / b.as_i64 : a.as_i64 % b.as_i64);
+        return true;
+    case INST_DIVU:
+    case INST_MODU:
+        if (b.as_u64 == 0) {
+            return false;
+        }
+        *result = word_u64(inst_type == INST_DIVU ? a.as_u64 / b.as_u64 : a.as_u64 % b.as_u64);
+        return true;
+    case INST_PLUSF:
+        *result = word_f64(a.as_f64 + b.as_f64);
+        return true;
+    case INST_MINUSF:
+        *result = word_f64(a.as_f64 - b.as_f64);
+        return true;
+    case INST_MULTF:
+        *result = word_f64(a.as_f64 * b.as_f64);
+        return true;
+    case INST_DIVF:
+        *result = word_f64(a.as_f64 / b.as_f64);
+        return true;
+    case INST_EQI:
+        *result = word_u64(a.as_i64 == b.as_i64);
+        return true;
+    case INST_GEI:
+        *result = word_u64(a.as_i64 >= b.as_i64);
+        return true;
+    case INST_GTI:
+        *result = word_u64(a.as_i64 > b.as_i64);
+        return true;
+    case INST_LEI:
+        *result = word_u64(a.as_i64 <= b.as_i64);
+        return true;
+    case INST_LTI:
+        *result = word_u64(a.as_i64 < b.as_i64);
+        return true;
+    case INST_NEI:
+        *result = word_u64(a.as_i64 != b.as_i64);
+        return true;
+    case INST_EQU:
+        *result = word_u64(a.as_u64 == b.as_u64);
+        return true;
+    case INST_GEU:
+        *result = word_u64(a.as_u64 >= b.as_u64);
+        return true;
+    case INST_GTU:
+        *result = word_u64(a.as_u64 > b.as_u64);
+        return true;
+    case INST_LEU:
+        *result = word_u64(a.as_u64 <= b.as_u64);
+        return true;
+    case INST_LTU:
+        *result = word_u64(a.as_u64 < b.as_u64);
+        return true;
+    case INST_NEU:
+        *result = word_u64(a.as_u64 != b.as_u64);
+        return true;
+    case INST_EQF:
+        *result = word_u64(a.as_f64 == b.as_f64);
+        return true;
+    case INST_GEF:
+        *result = word_u64(a.as_f64 >= b.as_f64);
+        return true;
+    case INST_GTF:
+        *result = word_u64(a.as_f64 > b.as_f64);
+        return true;
+    case INST_LEF:
+        *result = word_u64(a.as_f64 <= b.as_f64);
+        return true;
+    case INST_LTF:
+        *result = word_u64(a.as_f64 < b.as_f64);
+        return true;
+    case INST_NEF:
+        *result = word_u64(a.as_f64 != b.as_f64);
+        return true;
+    case INST_ANDB:
+        *result = word_u64(a.as_u64 & b.as_u64);
+        return true;
+    case INST_ORB:
+        *result = word_u64(a.as_u64 | b.as_u64);
+        return true;
+    case INST_XOR:
+        *result = word_u64(a.as_u64 ^ b.as_u64);
+        return true;
+    case INST_SHR:
+    case INST_SHL:
+        if (b.as_u64 >= 64) {
+            return false;
+        }
+        *result = word_u64(inst_type == INST_SHR ? a.as_u64 >> b.as_u64 : a.as_u64 << b.as_u64);
+        return true;
+    case INST_NOP:
+    case INST_PUSH:
+    case INST_DROP:
+    case INST_DUP:
+    case INST_SWAP:
+    case INST_JMP:
+    case INST_JMP_IF:
+    case INST_RET:
+    case INST_CALL:
+    case INST_NATIVE:
+    case INST_HALT:
+    case INST_NOT:
+    case INST_NOTB:
+    case INST_READ8:
+    case INST_READ16:
+    case INST_READ32:
+    case INST_READ64:
+    case INST_WRITE8:
+    case INST_WRITE16:
+    case INST_WRITE32:
+    case INST_WRITE64:
+    case INST_I2F:
+    case INST_U2F:
+    case INST_F2I:
+    case INST_F2U:
+    case NUMBER_OF_INSTS:
+        return false;
+    default:
+        assert(false && "fold_binary_op: unreachable");
+        exit(1);
+    }
+}
+
+// NOTE: f2i and f2u are not folded. Their result is undefined for the
+// floats that don't fit into the integers.
+static bool fold_unary_op(Inst_Type inst_type, Word a, Word *result)
+{
+    switch (inst_type) {
+    case INST_NOT:
+        *result = word_u64(!a.as_u64);
+        return true;
+    case INST_NOTB:
+        *result = word_u64(~a.as_u64);
+        return true;
+    case INST_I2F:
+        *result = word_f64((double) a.as_i64);
+        return true;
+    case INST_U2F:
+        *result = word_f64((double) a.as_u64);
+        return true;
+    case INST_NOP:
+    case INST_PUSH:
+    case INST_DROP:
+    case INST_DUP:
+    case INST_SWAP:
+    case INST_PLUSI:
+    case INST_MINUSI:
+    case INST_MULTI:
+    case INST_DIVI:
+    case INST_MODI:
+    case INST_MULTU:
+    case INST_DIVU:
+    case INST_MODU:
+    case INST_PLUSF:
+    case INST_MINUSF:
+    case INST_MULTF:
+    case INST_DIVF:
+    case INST_JMP:
+    case INST_JMP_IF:
+    case INST_RET:
+    case INST_CALL:
+    case INST_NATIVE:
+    case INST_HALT:
+    case INST_EQI:
+    case INST_GEI:
+    case INST_GTI:
+    case INST_LEI:
+    case INST_LTI:
+    case INST_NEI:
+    case INST_EQU:
+    case INST_GEU:
+    case INST_GTU:
+    case INST_LEU:
+    case INST_LTU:
+    case INST_NEU:
+    case INST_EQF:
+    case INST_GEF:
+    case INST_GTF:
+    case INST_LEF:
+    case INST_LTF:
+    case INST_NEF:
+    case INST_ANDB:
+    case INST_ORB:
+    case INST_XOR:
+    case INST_SHR:
+    case INST_SHL:
+    case INST_READ8:
+    case INST_READ16:
+    case INST_READ32:
+    case INST_READ64:
+    case INST_WRITE8:
+    case INST_WRITE16:
+    case INST_WRITE32:
+    case INST_WRITE64:
+    case INST_F2I:
+    case INST_F2U:
+    case NUMBER_OF_INSTS:
+        return false;
+    default:
+        assert(false && "fold_unary_op: unreachable");
+        exit(1);
+    }
+}
+
+// Replaces `push 2^k; op` with a cheaper equivalent. The division of
+// the signed integers rounds differently than the shift, so it's left alone.
+static bool reduce_strength(Inst_Type inst_type, uint64_t operand, Inst *push, Inst *op)
+{
+    uint64_t k = 0;
+    if (!is_power_of_two(operand, &k)) {
+        return false;
+    }
+
+    switch (inst_type) {
+    case INST_MULTI:
+    case INST_MULTU:
+        *push = (Inst) {.type = INST_PUSH, .operand = word_u64(k)};
+        *op = (Inst) {.type = INST_SHL};
+        return true;
+    case INST_DIVU:
+        *push = (Inst) {.type = INST_PUSH, .operand = word_u64(k)};
+        *op = (Inst) {.type = INST_SHR};
+        return true;
+    case INST_MODU:
+        *push = (Inst) {.type = INST_PUSH, .operand = word_u64(operand - 1)};
+        *op = (Inst) {.type = INST_ANDB};
+        return true;
+    case INST_NOP:
+    case INST_PUSH:
+    case INST_DROP:
+    case INST_DUP:
+    case INST_SWAP:
+    case INST_PLUSI:
+    case INST_MINUSI:
+    case INST_DIVI:
+    case INST_MODI:
+    case INST_PLUSF:
+    case INST_MINUSF:
+    case INST_MULTF:
+    case INST_DIVF:
+    case INST_JMP:
+    case INST_JMP_IF:
+    case INST_RET:
+    case INST_CALL:
+    case INST_NATIVE:
+    case INST_HALT:
+    case INST_NOT:
+    case INST_EQI:
+    case INST_GEI:
+    case INST_GTI:
+    case INST_LEI:
+    case INST_LTI:
+    case INST_NEI:
+    case INST_EQU:
+    case INST_GEU:
+    case INST_GTU:
+    case INST_LEU:
+    case INST_LTU:
+    case INST_NEU:
+    case INST_EQF:
+    case INST_GEF:
+    case INST_GTF:
+    case INST_LEF:
+    case INST_LTF:
+    case INST_NEF:
+    case INST_ANDB:
+    case INST_ORB:
+    case INST_XOR:
+    case INST_SHR:
+    case INST_SHL:
+    case INST_NOTB:
+    case INST_READ8:
+    case INST_READ16:
+    case INST_READ32:
+    case INST_READ64:
+    case INST_WRITE8:
+    case INST_WRITE16:
+    case INST_WRITE32:
+    case INST_WRITE64:
+    case INST_I2F:
+    case INST_U2F:
+    case INST_F2I:
+    case INST_F2U:
+    case NUMBER_OF_INSTS:
+        return false;
+    default:
+        assert(false && "reduce_strength: unreachable");
+        exit(1);
+    }
+}
+
+// The address of the instruction the chain of jumps starting at addr
+// eventually gets to
+static Inst_Addr thread_jump(const Inst *program, size_t program_size, Inst_Addr addr)
+{
+    for (size_t hops = 0; hops < program_size; ++hops) {
+        if (addr >= program_size || program[addr].type != INST_JMP) {
+            break;
+        }
+        addr = program[addr].operand.as_u64;
+    }
+    return addr;
+}
+
+static void *basm_optimizer_alloc(Basm *basm, size_t size)
+{
+    void *data = arena_alloc(&basm->arena, size);
+    memset(data, 0, size);
+    return data;
+}
+
+// The instructions that anything can jump to. A peephole pattern may
+// start at such an instruction, but can't span over one.
+static bool *basm_find_jump_targets(Basm *basm, const Type *types)
+{
+    bool *targets = basm_optimizer_alloc(basm, sizeof(targets[0]) * (basm->program_size + 1));
+
+    if (basm->entry <= basm->program_size) {
+        targets[basm->entry] = true;
+    }
+
+    for (size_t i = 0; i < basm->bindings_size; ++i) {
+        const Binding *binding = &basm->bindings[i];
+        if (binding->status == BINDING_EVALUATED &&
+                binding->type == TYPE_INST_ADDR &&
+                binding->value.as_u64 <= basm->program_size) {
+            targets[binding->value.as_u64] = true;
+        }
+    }
+
+    for (size_t i = 0; i < basm->program_size; ++i) {
+        const Inst inst = basm->program[i];
+        if (inst_operand_is_inst_addr(inst.type, types[i]) &&
+                inst.operand.as_u64 <= basm->program_size) {
+            targets[inst.operand.as_u64] = true;
+        }
+    }
+
+    return targets;
+}
+
+// Replaces the program with out and moves every instruction address
+// from the old program to the new one according to addrs. The operands
+// of the instructions marked in fixed are already in the new program.
+static void basm_replace_program(Basm *basm, Type **types,
+                                 Inst *out, Type *out_types, const bool *fixed, size_t out_size,
+                                 const Inst_Addr *addrs)
+{
+    const size_t n = basm->program_size;
+
+    for (size_t j = 0; j < out_size; ++j) {
+        if ((fixed == NULL || !fixed[j]) &&
+                inst_operand_is_inst_addr(out[j].type, out_types[j]) &&
+                out[j].operand.as_u64 <= n) {
+            out[j].operand = word_u64(addrs[out[j].operand.as_u64]);
+        }
+    }
+
+    for (size_t j = 0; j < basm->bindings_size; ++j) {
+        Binding *binding = &basm->bindings[j];
+        if (binding->status == BINDING_EVALUATED &&
+                binding->type == TYPE_INST_ADDR &&
+                binding->value.as_u64 <= n) {
+            binding->value = word_u64(addrs[binding->value.as_u64]);
+        }
+    }
+
+    if (basm->entry <= n) {
+        basm->entry = addrs[basm->entry];
+    }
+
+    basm->program = out;
+    basm->program_size = out_size;
+    basm->program_capacity = out_size;
+    *types = out_types;
+}
+
+// The body of a function prepared to be pasted in place of its calls.
+// Only the functions that don't call anything and end with a single ret
+// can be inlined. Their return address is on top of the stack when they
+// are called. The inlined body doesn't have it, so every instruction
+// that reaches past it is adjusted and the ones that move it around are
+// replaced with the moves of the values between which it sits.
+typedef struct {
+    Inst inst;
+    Type type;
+    // The jumps inside of the body. Their operands are relative to the
+    // beginning of the body.
+    bool local;
+} Inline_Inst;
+
+typedef struct {
+    bool analyzed;
+    const char *error;
+
+    Inline_Inst *insts;
+    size_t size;
+    size_t capacity;
+} Inline_Body;
+
+static void inline_body_push(Basm *basm, Inline_Body *body, Inst inst, Type type, bool local)
+{
+    body->insts = arena_da_reserve(&basm->arena, body->insts,
+                                   sizeof(body->insts[0]),
+                                   &body->capacity,
+                                   body->size + 1);
+    body->insts[body->size++] = (Inline_Inst) {
+        .inst = inst,
+        .type = type,
+        .local = local,
+    };
+}
+
+// `swap k`, `swap k - 1`, ..., `swap 1` or the other way around. Moves the
+// top of the stack k values deep or brings the value k deep to the top.
+static void inline_body_push_rotation(Basm *basm, Inline_Body *body, uint64_t k, bool to_top)
+{
+    for (uint64_t i = 1; i <= k; ++i) {
+        const uint64_t operand = to_top ? i : k + 1 - i;
+        inline_body_push(basm, body, (Inst) {
+            .type = INST_SWAP, .operand = word_u64(operand)
+        }, TYPE_INTEGER, false);
+    }
+}
+
+static void basm_analyze_inline_body(Basm *basm, const Type *types, Inst_Addr start, Inline_Body *body)
+{
+    const size_t n = basm->program_size;
+    const Inst *program = basm->program;
+
+    body->analyzed = true;
+
+    Inst_Addr end = start;
+    while (end < n && program[end].type != INST_RET) {
+        end += 1;
+    }
+
+    if (end >= n) {
+        body->error = "it does not end with ret";
+        return;
+    }
+
+    // NOTE: nothing outside of the function may jump into its middle
+    if (basm->entry > start && basm->entry <= end) {
+        body->error = "the entry point is inside of it";
+        return;
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+        const Inst_Addr target = program[i].operand.as_u64;
+        if ((i < start || i > end) &&
+                inst_operand_is_inst_addr(program[i].type, types[i]) &&
+                target > start && target <= end) {
+            body->error = "something outside of it jumps into its middle";
+            return;
+        }
+    }
+
+    // The distance from the top of the stack to the return address
+    // before each instruction. UINT64_MAX when it's not known yet.
+    const size_t count = end - start + 1;
+    uint64_t *depths = basm_optimizer_alloc(basm, sizeof(depths[0]) * count);
+    size_t *offsets = basm_optimizer_alloc(basm, sizeof(offsets[0]) * count);
+    for (size_t i = 0; i < count; ++i) {
+        depths[i] = UINT64_MAX;
+    }
+
+    uint64_t depth = 0;
+    bool falls_through = true;
+
+    for (Inst_Addr i = start; i <= end; ++i) {
+        if (falls_through) {
+            if (depths[i - start] != UINT64_MAX && depths[i - start] != depth) {
+                body->error = "the return address is at different depths on the different paths";
+                return;
+            }
+        } else if (depths[i - start] != UINT64_MAX) {
+            depth = depths[i - start];
+        } else {
+            body->error = "it has unreachable code";
+            return;
+        }
+        depths[i - start] = depth;
+        offsets[i - start] = body->size;
+        falls_through = true;
+
+        Inst inst = program[i];
+        const uint64_t operand = inst.operand.as_u64;
+        uint64_t pops = 0;
+        uint64_t pushes = 0;
+
+        if (inst.type == INST_RET) {
+            if (depth != 0) {
+                body->error = "the return address is not on top of the stack at ret";
+                return;
+            }
+        } else if (inst.type == INST_SWAP) {
+            if (depth == 0) {
+                inline_body_push_rotation(basm, body, operand == 0 ? 0 : operand - 1, true);
+                depth = operand;
+            } else if (depth == operand) {
+                inline_body_push_rotation(basm, body, operand - 1, false);
+                depth = 0;
+            } else {
+                inst.operand = word_u64(operand > depth ? operand - 1 : operand);
+                inline_body_push(basm, body, inst, types[i], false);
+            }
+        } else if (inst.type == INST_DUP) {
+            if (depth == operand) {
+                body->error = "it copies its return address";
+                return;
+            }
+            inst.operand = word_u64(operand > depth ? operand - 1 : operand);
+            inline_body_push(basm, body, inst, types[i], false);
+            depth += 1;
+        } else if (inst.type == INST_JMP || inst.type == INST_JMP_IF) {
+            if (operand < start || operand > end) {
+                body->error = "it jumps outside of itself";
+                return;
+            }
+
+            if (inst.type == INST_JMP_IF) {
+                if (depth == 0) {
+                    body->error = "it uses its return address";
+                    return;
+                }
+                depth -= 1;
+            }
+
+            if (depths[operand - start] != UINT64_MAX && depths[operand - start] != depth) {
+                body->error = "the return address is at different depths on the different paths";
+                return;
+            }
+            depths[operand - start] = depth;
+            falls_through = inst.type == INST_JMP_IF;
+            inline_body_push(basm, body, inst, TYPE_INTEGER, true);
+        } else if (inst.type == INST_HALT) {
+            falls_through = false;
+            inline_body_push(basm, body, inst, types[i], false);
+        } else if (inst_stack_effect(inst.type, &pops, &pushes)) {
+            if (depth < pops) {
+                body->error = "it uses its return address";
+                return;
+            }
+            depth = depth - pops + pushes;
+            inline_body_push(basm, body, inst, types[i], false);
+        } else {
+            assert(inst.type == INST_CALL || inst.type == INST_NATIVE);
+            body->error = "it is not a leaf function";
+            return;
+        }
+    }
+
+    for (size_t i = 0; i < body->size; ++i) {
+        Inst *inst = &body->insts[i].inst;
+        if (body->insts[i].local) {
+            inst->operand = word_u64(offsets[inst->operand.as_u64 - start]);
+        }
+    }
+}
+
+static Inline_Body *basm_inline_body(Basm *basm, const Type *types, Inline_Body *bodies, Inst_Addr start)
+{
+    assert(start < basm->program_size);
+    if (!bodies[start].analyzed) {
+        basm_analyze_inline_body(basm, types, start, &bodies[start]);
+    }
+    return &bodies[start];
+}
+
+// Replaces the calls of the small leaf functions and of the ones marked
+// with %inline with their bodies
+static void basm_inline_calls(Basm *basm, Type **types)
+{
+    const size_t n = basm->program_size;
+    Inline_Body *bodies = basm_optimizer_alloc(basm, sizeof(bodies[0]) * (n + 1));
+    bool *forced = basm_optimizer_alloc(basm, sizeof(forced[0]) * (n + 1));
+
+    for (size_t i = 0; i < basm->inline_hints_size; ++i) {
+        const Inline_Hint hint = basm->inline_hints[i];
+        const Binding *binding = basm_resolve_binding(basm, hint.name);
+
+        if (binding == NULL || binding->kind != BINDING_LABEL || binding->value.as_u64 >= n) {
+            fprintf(stderr, FL_Fmt": ERROR: `"SV_Fmt"` is not a label of an instruction\n",
+                    FL_Arg(hint.location), SV_Arg(hint.name));
+            basm_exit();
+        }
+
+        const Inline_Body *body = basm_inline_body(basm, *types, bodies, binding->value.as_u64);
+        if (body->error != NULL) {
+            fprintf(stderr, FL_Fmt": ERROR: `"SV_Fmt"` can't be inlined: %s\n",
+                    FL_Arg(hint.location), SV_Arg(hint.name), body->error);
+            basm_exit();
+        }
+
+        forced[binding->value.as_u64] = true;
+    }
+
+    Inst *out = NULL;
+    Type *out_types = NULL;
+    bool *fixed = NULL;
+    size_t out_size = 0;
+    size_t out_capacity = 0;
+    Inst_Addr *addrs = basm_optimizer_alloc(basm, sizeof(addrs[0]) * (n + 1));
+
+    for (size_t i = 0; i < n; ++i) {
+        addrs[i] = out_size;
+
+        const Inst inst = basm->program[i];
+        const Inline_Body *body = NULL;
+        if (inst.type == INST_CALL && inst.operand.as_u64 < n) {
+            body = basm_inline_body(basm, *types, bodies, inst.operand.as_u64);
+            if (body->error != NULL ||
+                    (body->size > BASM_INLINE_THRESHOLD && !forced[inst.operand.as_u64])) {
+                body = NULL;
+            }
+        }
+
+        // NOTE: the three arrays grow together, so they share the capacity
+        const size_t size = body != NULL ? body->size : 1;
+        size_t capacity = out_capacity;
+        out = arena_da_reserve(&basm->arena, out, sizeof(out[0]), &capacity, out_size + size);
+        capacity = out_capacity;
+        out_types = arena_da_reserve(&basm->arena, out_types, sizeof(out_types[0]), &capacity, out_size + size);
+        fixed = arena_da_reserve(&basm->arena, fixed, sizeof(fixed[0]), &out_capacity, out_size + size);
+
+        if (body != NULL) {
+            for (size_t j = 0; j < body->size; ++j) {
+                const Inline_Inst inline_inst = body->insts[j];
+                out[out_size + j] = inline_inst.inst;
+                out_types[out_size + j] = inline_inst.type;
+                fixed[out_size + j] = inline_inst.local;
+                if (inline_inst.local) {
+                    out[out_size + j].operand = word_u64(out_size + inline_inst.inst.operand.as_u64);
+                }
+            }
+        } else {
+            out[out_size] = inst;
+            out_types[out_size] = (*types)[i];
+            fixed[out_size] = false;
+        }
+        out_size += size;
+    }
+    addrs[n] = out_size;
+
+    basm_replace_program(basm, types, out, out_types, fixed, out_size, addrs);
+}
+
+static bool basm_optimize_pass(Basm *basm, Type **types)
+{
+    const size_t n = basm->program_size;
+    const Inst *program = basm->program;
+    const bool *targets = basm_find_jump_targets(basm, *types);
+
+    Inst *out = basm_optimizer_alloc(basm, sizeof(out[0]) * (n + 1));
+    Type *out_types = basm_optimizer_alloc(basm, sizeof(out_types[0]) * (n + 1));
+    size_t out_size = 0;
+    // The new address of every instruction. The removed instructions
+    // are mapped to the instruction that follows them.
+    Inst_Addr *addrs = basm_optimizer_alloc(basm, sizeof(addrs[0]) * (n + 1));
+    bool changed = false;
+
+    size_t i = 0;
+    while (i < n) {
+        size_t window = 1;
+        while (window < BASM_OPTIMIZER_WINDOW && i + window < n && !targets[i + window]) {
+            window += 1;
+        }
+
+        for (size_t j = 0; j < window; ++j) {
+            addrs[i + j] = out_size;
+        }
+
+        Inst inst = program[i];
+        const Type type = (*types)[i];
+        const bool literal = inst.type == INST_PUSH && type == TYPE_INTEGER;
+        Word result = {0};
+
+        if (window >= 2 && (inst.type == INST_PUSH || inst.type == INST_DUP) &&
+                program[i + 1].type == INST_DROP) {
+            i += 2;
+            changed = true;
+            continue;
+        }
+
+        if (window >= 2 && inst.type == INST_SWAP && program[i + 1].type == INST_SWAP &&
+                inst.operand.as_u64 == program[i + 1].operand.as_u64) {
+            i += 2;
+            changed = true;
+            continue;
+        }
+
+        if (window >= 3 && literal &&
+                program[i + 1].type == INST_PUSH && (*types)[i + 1] == TYPE_INTEGER &&
+                fold_binary_op(program[i + 2].type, inst.operand, program[i + 1].operand, &result)) {
+            out_types[out_size] = TYPE_INTEGER;
+            out[out_size++] = (Inst) {.type = INST_PUSH, .operand = result};
+            i += 3;
+            changed = true;
+            continue;
+        }
+
+        if (window >= 2 && literal && fold_unary_op(program[i + 1].type, inst.operand, &result)) {
+            out_types[out_size] = TYPE_INTEGER;
+            out[out_size++] = (Inst) {.type = INST_PUSH, .operand = result};
+            i += 2;
+            changed = true;
+            continue;
+        }
+
+        if (window >= 2 && literal &&
+                reduce_strength(program[i + 1].type, inst.operand.as_u64, &out[out_size], &out[out_size + 1])) {
+            out_types[out_size] = TYPE_INTEGER;
+            out_types[out_size + 1] = TYPE_INTEGER;
+            addrs[i + 1] = out_size + 1;
+            out_size += 2;
+            i += 2;
+            changed = true;
+            continue;
+        }
+
+        if (inst.type == INST_JMP || inst.type == INST_JMP_IF || inst.type == INST_CALL) {
+            const Inst_Addr target = thread_jump(program, n, inst.operand.as_u64);
+            if (target != inst.operand.as_u64) {
+                inst.operand = word_u64(target);
+                changed = true;
+            }
+        }
+
+        if (inst.type == INST_JMP && inst.operand.as_u64 == i + 1) {
+            i += 1;
+            changed = true;
+            continue;
+        }
+
+        out_types[out_size] = type;
+        out[out_size++] = inst;
+        i += 1;
+
+        // NOTE: only a jump can get to the instructions after an
+        // unconditional one, so everything up to the next jump target is dead
+        if (inst_is_unconditional_jump(inst.type)) {
+            while (i < n && !targets[i]) {
+                addrs[i] = out_size;
+                i += 1;
+                changed = true;
+            }
+        }
+    }
+    addrs[n] = out_size;
+
+    basm_replace_program(basm, types, out, out_types, NULL, out_size, addrs);
+
+    return changed;
+}
+
+// NOTE: the bytes that don't belong to any string or table are kept
+static void basm_eliminate_dead_memory(Basm *basm, const Type *types)
+{
+    const size_t memory_size = basm->memory_size;
+    bool *dead = basm_optimizer_alloc(basm, sizeof(dead[0]) * (memory_size + 1));
+
+    for (size_t i = 0; i < basm->string_lengths_size; ++i) {
+        const String_Length region = basm->string_lengths[i];
+
+        bool used = false;
+        for (size_t j = 0; j < basm->program_size && !used; ++j) {
+            const Memory_Addr addr = basm->program[j].operand.as_u64;
+            used = types[j] == TYPE_MEMORY_ADDR &&
+                   addr >= region.addr &&
+                   (addr < region.addr + region.length || addr == region.addr);
+        }
+
+        if (!used) {
+            memset(dead + region.addr, true, region.length);
+        }
+    }
+
+    // The new address of every byte of the memory
+    Memory_Addr *addrs = basm_optimizer_alloc(basm, sizeof(addrs[0]) * (memory_size + 1));
+    size_t size = 0;
+    for (size_t i = 0; i < memory_size; ++i) {
+        addrs[i] = size;
+        if (!dead[i]) {
+            basm->memory[size++] = basm->memory[i];
+        }
+    }
+    addrs[memory_size] = size;
+
+    for (size_t i = 0; i < basm->program_size; ++i) {
+        Inst *inst = &basm->program[i];
+        if (types[i] == TYPE_MEMORY_ADDR && inst->operand.as_u64 <= memory_size) {
+            inst->operand = word_u64(addrs[inst->operand.as_u64]);
+        }
+    }
+
+    for (size_t i = 0; i < basm->bindings_size; ++i) {
+        Binding *binding = &basm->bindings[i];
+        if (binding->status == BINDING_EVALUATED &&
+                binding->type == TYPE_MEMORY_ADDR &&
+                binding->value.as_u64 <= memory_size) {
+            binding->eliminated = binding->eliminated || dead[binding->value.as_u64];
+            binding->value = word_u64(addrs[binding->value.as_u64]);
+        }
+    }
+
+    basm->memory_capacity -= memory_size - size;
+    basm->memory_size = size;
+}
+
+// Removes the code nothing can get to from the entry point and the
+// strings and the tables that the remaining code doesn't refer to
+static void basm_eliminate_dead_code(Basm *basm, Type **types)
+{
+    const size_t n = basm->program_size;
+    const Inst *program = basm->program;
+
+    bool *reachable = basm_optimizer_alloc(basm, sizeof(reachable[0]) * (n + 1));
+    Inst_Addr *stack = basm_optimizer_alloc(basm, sizeof(stack[0]) * (2 * n + 1));
+    size_t stack_size = 0;
+
+    if (basm->entry < n) {
+        stack[stack_size++] = basm->entry;
+    }
+
+    while (stack_size > 0) {
+        const Inst_Addr i = stack[--stack_size];
+        if (i >= n || reachable[i]) {
+            continue;
+        }
+        reachable[i] = true;
+
+        // NOTE: the labels pushed as values are called or jumped to in
+        // some way the optimizer can't follow, so they are reachable too
+        if (inst_operand_is_inst_addr(program[i].type, (*types)[i])) {
+            stack[stack_size++] = program[i].operand.as_u64;
+        }
+
+        if (!inst_is_unconditional_jump(program[i].type)) {
+            stack[stack_size++] = i + 1;
+        }
+    }
+
+    Inst *out = basm_optimizer_alloc(basm, sizeof(out[0]) * (n + 1));
+    Type *out_types = basm_optimizer_alloc(basm, sizeof(out_types[0]) * (n + 1));
+    Inst_Addr *addrs = basm_optimizer_alloc(basm, sizeof(addrs[0]) * (n + 1));
+    size_t out_size = 0;
+
+    for (size_t i = 0; i < n; ++i) {
+        addrs[i] = out_size;
+        if (reachable[i]) {
+            out[out_size] = program[i];
+            out_types[out_size] = (*types)[i];
+            out_size += 1;
+        }
+    }
+    addrs[n] = out_size;
+
+    for (size_t i = 0; i < basm->bindings_size; ++i) {
+        Binding *binding = &basm->bindings[i];
+        if (binding->kind == BINDING_LABEL && binding->value.as_u64 < n && !reachable[binding->value.as_u64]) {
+            binding->eliminated = true;
+        }
+    }
+
+    basm_replace_program(basm, types, out, out_types, NULL, out_size, addrs);
+
+    if (!basm->memory_has_addrs) {
+        basm_eliminate_dead_memory(basm, *types);
+    }
+}
+
+// Splits the program into the chains of instructions that don't fall
+// through into each other and puts the chains with the higher profile
+// counts first. Every chain can be moved anywhere since it's entered
+// only by the jumps.
+static void basm_layout_program(Basm *basm, Type **types)
+{
+    const size_t n = basm->program_size;
+    const Inst *program = basm->program;
+    if (basm->profile_size == 0 || n == 0) {
+        return;
+    }
+
+    uint64_t *counts = basm_optimizer_alloc(basm, sizeof(counts[0]) * (n + 1));
+    for (size_t i = 0; i < basm->profile_size; ++i) {
+        const Binding *binding = basm_resolve_binding(basm, basm->profile[i].label);
+        if (binding != NULL &&
+                binding->kind == BINDING_LABEL &&
+                binding->status == BINDING_EVALUATED &&
+                !binding->eliminated &&
+                binding->value.as_u64 < n &&
+                counts[binding->value.as_u64] < basm->profile[i].count) {
+            counts[binding->value.as_u64] = basm->profile[i].count;
+        }
+    }
+
+    size_t *starts = basm_optimizer_alloc(basm, sizeof(starts[0]) * (n + 1));
+    uint64_t *hotness = basm_optimizer_alloc(basm, sizeof(hotness[0]) * (n + 1));
+    size_t chains_count = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (i == 0 || inst_is_unconditional_jump(program[i - 1].type)) {
+            starts[chains_count++] = i;
+        }
+        if (hotness[chains_count - 1] < counts[i]) {
+            hotness[chains_count - 1] = counts[i];
+        }
+    }
+    starts[chains_count] = n;
+
+    // NOTE: the last chain may fall off the end of the program, so it
+    // stays the last one
+    const size_t movable = inst_is_unconditional_jump(program[n - 1].type) ? chains_count : chains_count - 1;
+
+    size_t *order = basm_optimizer_alloc(basm, sizeof(order[0]) * (chains_count + 1));
+    for (size_t i = 0; i < chains_count; ++i) {
+        order[i] = i;
+    }
+
+    // Stable insertion sort. The chains without the counts keep their order.
+    for (size_t i = 1; i < movable; ++i) {
+        const size_t chain = order[i];
+        size_t j = i;
+        while (j > 0 && hotness[order[j - 1]] < hotness[chain]) {
+            order[j] = order[j - 1];
+            j -= 1;
+        }
+        order[j] = chain;
+    }
+
+    Inst *out = basm_optimizer_alloc(basm, sizeof(out[0]) * (n + 1));
+    Type *out_types = basm_optimizer_alloc(basm, sizeof(out_types[0]) * (n + 1));
+    Inst_Addr *addrs = basm_optimizer_alloc(basm, sizeof(addrs[0]) * (n + 1));
+    size_t out_size = 0;
+    for (size_t i = 0; i < chains_count; ++i) {
+        for (size_t j = starts[order[i]]; j < starts[order[i] + 1]; ++j) {
+            addrs[j] = out_size;
+            out[out_size] = program[j];
+            out_types[out_size] = (*types)[j];
+            out_size += 1;
+        }
+    }
+    addrs[n] = n;
+
+    basm_replace_program(basm, types, out, out_types, NULL, out_size, addrs);
+}
+
+static void basm_optimize_passes(Basm *basm, Type **types)
+{
+    for (size_t pass = 0; pass < BASM_OPTIMIZER_MAX_PASSES; ++pass) {
+        if (!basm_optimize_pass(basm, types)) {
+            break;
+        }
+    }
+}
+
+void basm_optimize(Basm *basm)
+{
+    // NOTE: the optimizer needs to know which operands are addresses to
+    // move them along with the instructions
+    assert(basm->optimize);
+
+    Type *types = basm_optimizer_alloc(basm, sizeof(types[0]) * (basm->program_size + 1));
+    for (size_t i = 0; i < basm->relocations_size; ++i) {
+        types[basm->relocations[i].addr] = basm->relocations[i].type;
+    }
+
+    basm_inline_calls(basm, &types);
+
+    basm_optimize_passes(basm, &types);
+    basm_eliminate_dead_code(basm, &types);
+
+    // NOTE: the layout may put a jump right before its target
+    if (basm->profile_size > 0) {
+        basm_layout_program(basm, &types);
+        basm_optimize_passes(basm, &types);
+    }
+
+    basm->relocations_size = 0;
+    for (size_t i = 0; i < basm->program_size; ++i) {
+        if (type_is_addr(types[i])) {
+            basm_push_relocation(basm, i, types[i]);
+        }
+    }
+}
@@ -3,6 +3,34 @@
 
 #include "./sv.h"
 
+// NOTE: SSE2 is a part of the x86_64 baseline, so it's always available
+// there without any extra compiler flags. Everything else falls back to
+// scanning one char at a time.
+#if defined(__SSE2__) && (defined(__GNUC__) || defined(__clang__))
+#  define SV_SSE2
+#  include <emmintrin.h>
+#  define SV_BLOCK_SIZE 16
+#endif
+
+// NOTE: the same set of chars isspace() accepts in the "C" locale
+static bool sv_is_space(char x)
+{
+    return x == ' ' || (x >= '\t' && x <= '\r');
+}
+
+#ifdef SV_SSE2
+// Returns the bit mask of the chars of the block that are spaces
+static unsigned sv_block_space_mask(const char *block)
+{
+    const __m128i chars = _mm_loadu_si128((const __m128i *) block);
+    const __m128i spaces = _mm_cmpeq_epi8(chars, _mm_set1_epi8(' '));
+    // NOTE: '\t'..'\r' are the chars for which (x - '\t') as unsigned is at most 4
+    const __m128i shifted = _mm_sub_epi8(chars, _mm_set1_epi8('\t'));
+    const __m128i controls = _mm_cmpeq_epi8(_mm_min_epu8(shifted, _mm_set1_epi8(4)), shifted);
+    return (unsigned) _mm_movemask_epi8(_mm_or_si128(spaces, controls));
+}
+#endif // SV_SSE2
+
 String_View sv_from_cstr(const char *cstr)
 {
     return (String_View) {
@@ -14,7 +42,19 @@ String_View sv_from_cstr(const char *cstr)
 String_View sv_trim_left(String_View sv)
 {
     size_t i = 0;
-    while (i < sv.count && isspace(sv.data[i])) {
+
+#ifdef SV_SSE2
+    while (i + SV_BLOCK_SIZE <= sv.count) {
+        const unsigned mask = sv_block_space_mask(sv.data + i);
+        if (mask != 0xFFFF) {
+            i += (size_t) __builtin_ctz(~mask);
+            break;
+        }
+        i += SV_BLOCK_SIZE;
+    }
+#endif // SV_SSE2
+
+    while (i < sv.count && sv_is_space(sv.data[i])) {
         i += 1;
     }
 
@@ -27,7 +67,20 @@ String_View sv_trim_left(String_View sv)
 String_View sv_trim_right(String_View sv)
 {
     size_t i = 0;
-    while (i < sv.count && isspace(sv.data[sv.count - 1 - i])) {
+
+#ifdef SV_SSE2
+    while (i + SV_BLOCK_SIZE <= sv.count) {
+        const unsigned mask = sv_block_space_mask(sv.data + sv.count - i - SV_BLOCK_SIZE);
+        if (mask != 0xFFFF) {
+            // NOTE: the last char of the block is at the bit 15
+            i += (size_t) __builtin_clz(~mask << 16);
+            break;
+        }
+        i += SV_BLOCK_SIZE;
+    }
+#endif // SV_SSE2
+
+    while (i < sv.count && sv_is_space(sv.data[sv.count - 1 - i])) {
         i += 1;
     }
 
@@ -59,15 +112,13 @@ String_View sv_chop_left(String_View *sv, size_t n)
     return result;
 }
 
+// NOTE: memchr() of any decent libc is already vectorized
 bool sv_index_of(String_View sv, char c, size_t *index)
 {
-    size_t i = 0;
-    while (i < sv.count && sv.data[i] != c) {
-        i += 1;
-    }
+    const char *found = sv.count > 0 ? memchr(sv.data, c, sv.count) : NULL;
 
-    if (i < sv.count) {
-        *index = i;
+    if (found != NULL) {
+        *index = (size_t) (found - sv.data);
         return true;
     } else {
         return false;
@@ -77,8 +128,8 @@ bool sv_index_of(String_View sv, char c, size_t *index)
 String_View sv_chop_by_delim(String_View *sv, char delim)
 {
     size_t i = 0;
-    while (i < sv->count && sv->data[i] != delim) {
-        i += 1;
+    if (!sv_index_of(*sv, delim, &i)) {
+        i = sv->count;
     }
 
     String_View result = {
@@ -131,3 +182,14 @@ uint64_t sv_to_u64(String_View sv)
 
     return result;
 }
+
+// NOTE: FNV-1a https://en.wikipedia.org/wiki/Fowler%E2%80%93Noll%E2%80%93Vo_hash_function
+uint64_t sv_hash(String_View sv)
+{
+    uint64_t hash = 0xcbf29ce484222325;
+    for (size_t i = 0; i < sv.count; ++i) {
+        hash ^= (uint8_t) sv.data[i];
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
@@ -30,5 +30,6 @@ bool sv_index_of(String_View sv, char c, size_t *index);
 bool sv_eq(String_View a, String_View b);
 bool sv_has_prefix(String_View sv, String_View prefix);
 uint64_t sv_to_u64(String_View sv);
+uint64_t sv_hash(String_View sv);
 
 #endif  // SV_H_
@@ -0,0 +1,210 @@
+#include "./basm.h"
+
+typedef enum {
+    SIGNATURE_UNVERIFIED = 0,
+    SIGNATURE_IN_PROGRESS,
+    SIGNATURE_VERIFIED,
+} Signature_Status;
+
+typedef struct {
+    Basm *basm;
+    // The position of the hint of the function at every address plus one
+    size_t *hint_at;
+    Signature_Status *status;
+    // The depth every verified function needs. See Bm_Signature.
+    uint64_t *depth;
+
+    // The first signature that doesn't hold. The error is reported after
+    // bm_verify_function() of all of its callers has returned, so the
+    // error doesn't jump over the memory they allocated.
+    const Signature_Hint *failed_hint;
+    Inst_Addr failed_at;
+    const char *failed_reason;
+} Verifier;
+
+static void *basm_verifier_alloc(Basm *basm, size_t size)
+{
+    void *data = arena_alloc(&basm->arena, size);
+    memset(data, 0, size);
+    return data;
+}
+
+static void basm_verifier_error(const Signature_Hint *hint, Inst_Addr addr, const char *reason)
+{
+    fprintf(stderr, FL_Fmt": ERROR: could not verify the signature of `"SV_Fmt"`: %s at instruction %"PRIu64"\n",
+            FL_Arg(hint->location), SV_Arg(hint->name), reason, addr);
+    basm_exit();
+}
+
+static const Signature_Hint *basm_find_native_hint(Basm *basm, uint64_t native)
+{
+    for (size_t i = 0; i < basm->signature_hints_size; ++i) {
+        const Binding *binding = basm_resolve_binding(basm, basm->signature_hints[i].name);
+        if (binding != NULL && binding->kind == BINDING_NATIVE &&
+                binding->status == BINDING_EVALUATED &&
+                binding->value.as_u64 == native) {
+            return &basm->signature_hints[i];
+        }
+    }
+
+    return NULL;
+}
+
+static bool basm_verify_function(Verifier *verifier, size_t index);
+
+static const char *basm_verifier_callee_signature(void *data, Inst inst, Bm_Signature *callee)
+{
+    Verifier *verifier = data;
+    Basm *basm = verifier->basm;
+
+    if (inst.type == INST_CALL) {
+        const Inst_Addr target = inst.operand.as_u64;
+        if (target >= basm->program_size || verifier->hint_at[target] == 0) {
+            return "calls a function without a signature";
+        }
+        const size_t index = verifier->hint_at[target] - 1;
+        if (!basm_verify_function(verifier, index)) {
+            return "the callee does not match its signature";
+        }
+        if (verifier->status[index] != SIGNATURE_VERIFIED) {
+            return "the call is recursive";
+        }
+        callee->in = basm->signature_hints[index].in;
+        callee->out = basm->signature_hints[index].out;
+        callee->depth = verifier->depth[index];
+        return NULL;
+    }
+
+    assert(inst.type == INST_NATIVE);
+    const Signature_Hint *hint = basm_find_native_hint(basm, inst.operand.as_u64);
+    if (hint == NULL) {
+        return "invokes a native function without a signature";
+    }
+    callee->in = hint->in;
+    callee->out = hint->out;
+    return NULL;
+}
+
+// Returns false if the signature or the signature of any of the
+// functions it calls doesn't hold. See Verifier.failed_hint.
+static bool basm_verify_function(Verifier *verifier, size_t index)
+{
+    if (verifier->status[index] != SIGNATURE_UNVERIFIED) {
+        return true;
+    }
+
+    Basm *basm = verifier->basm;
+    const Signature_Hint *hint = &basm->signature_hints[index];
+    const Binding *binding = basm_resolve_binding(basm, hint->name);
+    assert(binding != NULL && binding->kind == BINDING_LABEL);
+
+    verifier->status[index] = SIGNATURE_IN_PROGRESS;
+    Bm_Signature signature = {
+        .addr = binding->value.as_u64,
+        .in = hint->in,
+        .out = hint->out,
+    };
+    Inst_Addr at = 0;
+    const char *reason = bm_verify_function(basm->program, basm->program_size, &signature,
+                                            basm_verifier_callee_signature, verifier, &at);
+    if (reason != NULL) {
+        // NOTE: the innermost failure is the one worth reporting. Its
+        // callers only fail because of it.
+        if (verifier->failed_hint == NULL) {
+            verifier->failed_hint = hint;
+            verifier->failed_at = at;
+            verifier->failed_reason = reason;
+        }
+        return false;
+    }
+    verifier->depth[index] = signature.depth;
+    verifier->status[index] = SIGNATURE_VERIFIED;
+
+    basm->signatures = arena_da_reserve(&basm->arena, basm->signatures,
+                                        sizeof(basm->signatures[0]),
+                                        &basm->signatures_capacity,
+                                        basm->signatures_size + 1);
+    basm->signatures[basm->signatures_size++] = signature;
+    return true;
+}
+
+void basm_verify_signatures(Basm *basm)
+{
+    const size_t n = basm->program_size;
+    Verifier verifier = {
+        .basm = basm,
+        .hint_at = basm_verifier_alloc(basm, sizeof(verifier.hint_at[0]) * (n + 1)),
+        .status = basm_verifier_alloc(basm, sizeof(verifier.status[0]) * (basm->signature_hints_size + 1)),
+        .depth = basm_verifier_alloc(basm, sizeof(verifier.depth[0]) * (basm->signature_hints_size + 1)),
+    };
+
+    size_t signatures_count = 0;
+    for (size_t i = 0; i < basm->signature_hints_size; ++i) {
+        const Signature_Hint *hint = &basm->signature_hints[i];
+        const Binding *binding = basm_resolve_binding(basm, hint->name);
+        if (binding == NULL) {
+            fprintf(stderr, FL_Fmt": ERROR: unknown binding `"SV_Fmt"`\n",
+                    FL_Arg(hint->location), SV_Arg(hint->name));
+            basm_exit();
+        }
+
+        if (binding->kind == BINDING_CONST) {
+            fprintf(stderr, FL_Fmt": ERROR: `"SV_Fmt"` is a %s. Only labels and natives have signatures.\n",
+                    FL_Arg(hint->location), SV_Arg(hint->name), binding_kind_as_cstr(binding->kind));
+            basm_exit();
+        }
+
+        if (binding->kind == BINDING_LABEL) {
+            // The optimizer removed the function
+            if (binding->eliminated) {
+                verifier.status[i] = SIGNATURE_VERIFIED;
+                continue;
+            }
+
+            const Inst_Addr addr = basm_binding_eval(basm, (Binding *) binding, hint->location, NULL).as_u64;
+            if (addr >= n) {
+                fprintf(stderr, FL_Fmt": ERROR: `"SV_Fmt"` is not a label of an instruction\n",
+                        FL_Arg(hint->location), SV_Arg(hint->name));
+                basm_exit();
+            }
+
+            if (verifier.hint_at[addr] != 0) {
+                fprintf(stderr, FL_Fmt": ERROR: the function at `"SV_Fmt"` already has a signature\n",
+                        FL_Arg(hint->location), SV_Arg(hint->name));
+                fprintf(stderr, FL_Fmt": NOTE: the first signature is located here\n",
+                        FL_Arg(basm->signature_hints[verifier.hint_at[addr] - 1].location));
+                basm_exit();
+            }
+            verifier.hint_at[addr] = i + 1;
+
+            signatures_count += 1;
+            if (signatures_count > BM_SIGNATURES_CAPACITY) {
+                fprintf(stderr, FL_Fmt": ERROR: too many signatures. The capacity is %d\n",
+                        FL_Arg(hint->location), BM_SIGNATURES_CAPACITY);
+                basm_exit();
+            }
+        } else {
+            verifier.status[i] = SIGNATURE_VERIFIED;
+
+            // NOTE: the VM checks the signatures of the natives, so they
+            // are saved into the program. The first one of the native wins.
+            if (basm_find_native_hint(basm, binding->value.as_u64) == hint) {
+                basm->native_signatures = arena_da_reserve(&basm->arena, basm->native_signatures,
+                                          sizeof(basm->native_signatures[0]),
+                                          &basm->native_signatures_capacity,
+                                          basm->native_signatures_size + 1);
+                basm->native_signatures[basm->native_signatures_size++] = (Bm_Native_Signature) {
+                    .native = binding->value.as_u64,
+                    .in = hint->in,
+                    .out = hint->out,
+                };
+            }
+        }
+    }
+
+    for (size_t i = 0; i < basm->signature_hints_size; ++i) {
+        if (!basm_verify_function(&verifier, i)) {
+            basm_verifier_error(verifier.failed_hint, verifier.failed_at, verifier.failed_reason);
+        }
+    }
+}
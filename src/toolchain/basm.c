@@ -1,7 +1,22 @@
+// NOTE: for realpath(3) of -watch
+#ifndef _WIN32
+#define _XOPEN_SOURCE 500
+#endif // _WIN32
+
 #define BM_IMPLEMENTATION
 #include "./basm.h"
 #include "./bm.h"
 
+#ifndef _WIN32
+#include <pthread.h>
+#endif // _WIN32
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#endif // __linux__
+
 static char *shift(int *argc, char ***argv)
 {
     assert(*argc > 0);
@@ -13,74 +28,743 @@ static char *shift(int *argc, char ***argv)
 
 static void usage(FILE *stream, const char *program)
 {
-    fprintf(stream, "Usage: %s [-g] <input.basm> <output.bm>\n", program);
+    fprintf(stream, "Usage: %s [OPTIONS] <input.basm> <output.bm>\n", program);
+    fprintf(stream, "       %s [OPTIONS] <input.basm>:<output.bm>...\n", program);
+    fprintf(stream, "       %s [OPTIONS] -m <manifest.txt>\n", program);
+    fprintf(stream, "OPTIONS:\n");
+    fprintf(stream, "    -g    generate the symbol table <output.bm>.sym\n");
+    fprintf(stream, "    -MD   generate the dependency file <output.bm>.d for make and nobuild\n");
+    fprintf(stream, "    -c    translate into a relocatable object file to be linked with bmld\n");
+    fprintf(stream, "    -O    optimize the program\n");
+    fprintf(stream, "    -fprofile-use=<profile.txt>\n");
+    fprintf(stream, "          optimize the program laying the hot code out first according to\n");
+    fprintf(stream, "          the profile written by `bme -prof`. Implies -O.\n");
+    fprintf(stream, "    -m <manifest.txt>\n");
+    fprintf(stream, "          translate the <input.basm>:<output.bm> pairs listed in the manifest\n");
+    fprintf(stream, "          one per line\n");
+    fprintf(stream, "    -j <jobs>\n");
+    fprintf(stream, "          translate up to <jobs> inputs in parallel\n");
+    fprintf(stream, "    -time-report[=tsv]\n");
+    fprintf(stream, "          print the time of every phase of the translation, the amount of\n");
+    fprintf(stream, "          lines, tokens, bindings and deferred operands and the usage of\n");
+    fprintf(stream, "          the memory. =tsv prints the same as <input> <metric> <value>\n");
+    fprintf(stream, "          lines separated by tabs.\n");
+    fprintf(stream, "    -watch\n");
+    fprintf(stream, "          keep running and translate the inputs again every time they or\n");
+    fprintf(stream, "          the files they include are changed. Linux only.\n");
 }
 
-int main(int argc, char **argv)
+typedef struct {
+    const char *input_file_path;
+    const char *output_file_path;
+} Unit;
+
+typedef struct {
+    Unit *items;
+    size_t size;
+    size_t capacity;
+} Units;
+
+typedef enum {
+    TIME_REPORT_NONE = 0,
+    TIME_REPORT_TEXT,
+    TIME_REPORT_TSV,
+} Time_Report;
+
+typedef struct {
+    Time_Report time_report;
+    int have_symbol_table;
+    int have_dependencies;
+    int relocatable;
+    int optimize;
+    const char *profile_file_path;
+} Options;
+
+static void units_push(Arena *arena, Units *units, Unit unit)
 {
-    int have_symbol_table = 0;
-    const char *program = shift(&argc, &argv);
+    units->items = arena_da_reserve(arena, units->items,
+                                    sizeof(units->items[0]),
+                                    &units->capacity,
+                                    units->size + 1);
+    units->items[units->size++] = unit;
+}
 
-    if (argc == 0) {
-        usage(stderr, program);
-        fprintf(stderr, "ERROR: expected input\n");
+// The colon of the drive letter like in `C:\foo.basm` is not a
+// separator
+static bool find_separator(String_View pair, size_t *index)
+{
+    for (size_t i = 0; i < pair.count; ++i) {
+        const bool drive_letter =
+            i == 1 && isalpha(pair.data[0]) &&
+            i + 1 < pair.count && (pair.data[i + 1] == '\\' || pair.data[i + 1] == '/');
+        if (pair.data[i] == ':' && !drive_letter) {
+            *index = i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Splits `<input.basm>:<output.bm>`
+static bool parse_unit(Arena *arena, String_View pair, Unit *unit)
+{
+    size_t i = 0;
+    if (!find_separator(pair, &i)) {
+        return false;
+    }
+
+    const String_View input = sv_trim((String_View) {
+        .count = i,
+        .data = pair.data,
+    });
+    const String_View output = sv_trim((String_View) {
+        .count = pair.count - i - 1,
+        .data = pair.data + i + 1,
+    });
+    if (input.count == 0 || output.count == 0) {
+        return false;
+    }
+
+    unit->input_file_path = arena_sv_to_cstr(arena, input);
+    unit->output_file_path = arena_sv_to_cstr(arena, output);
+    return true;
+}
+
+static void load_manifest(Arena *arena, const char *manifest_file_path, Units *units)
+{
+    String_View manifest = {0};
+    if (arena_slurp_file(arena, sv_from_cstr(manifest_file_path), &manifest) < 0) {
+        fprintf(stderr, "ERROR: could not read file `%s`: %s\n",
+                manifest_file_path, strerror(errno));
         exit(1);
     }
-    const char *input_file_path = shift(&argc, &argv);
 
-    if (!strcmp(input_file_path, "-g")) {
-        have_symbol_table = 1;
-        input_file_path = shift(&argc, &argv);
+    for (int line_number = 1; manifest.count > 0; ++line_number) {
+        const String_View line = sv_trim(sv_chop_by_delim(&manifest, '\n'));
+        if (line.count == 0) {
+            continue;
+        }
+
+        Unit unit = {0};
+        if (!parse_unit(arena, line, &unit)) {
+            fprintf(stderr, "%s:%d: ERROR: expected `<input.basm>:<output.bm>` but got `"SV_Fmt"`\n",
+                    manifest_file_path, line_number, SV_Arg(line));
+            exit(1);
+        }
+        units_push(arena, units, unit);
+    }
+}
+
+static void print_time_report(Basm *basm, Time_Report time_report, const char *input_file_path)
+{
+    const Basm_Stats *stats = &basm->stats;
+
+    double total = 0.0;
+    for (Basm_Phase phase = 0; phase < NUMBER_OF_BASM_PHASES; ++phase) {
+        total += stats->phase_times[phase];
     }
 
-    if (argc == 0) {
-        usage(stderr, program);
-        fprintf(stderr, "ERROR: expected output\n");
+    size_t used = 0;
+    size_t capacity = 0;
+    size_t regions_count = 0;
+    for (Region *iter = basm->arena.first; iter != NULL; iter = iter->next) {
+        used += iter->size;
+        capacity += iter->capacity;
+        regions_count += 1;
+    }
+
+    const double lines_per_second = total > 0.0 ? (double) stats->lines_count * 1000.0 / total : 0.0;
+
+    // NOTE: the peak memory is the one of the whole process, so it covers
+    // all of the units of a batch
+    long peak_rss_kb = 0;
+#ifdef __linux__
+    struct rusage usage = {0};
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        peak_rss_kb = usage.ru_maxrss;
+    }
+#endif // __linux__
+
+#ifndef _WIN32
+    // The reports of the parallel units are not mixed up
+    flockfile(stdout);
+#endif // _WIN32
+
+    switch (time_report) {
+    case TIME_REPORT_TEXT: {
+        printf("%s:\n", input_file_path);
+        for (Basm_Phase phase = 0; phase < NUMBER_OF_BASM_PHASES; ++phase) {
+            printf("  %-20s %10.3lf ms\n", basm_phase_name(phase), stats->phase_times[phase]);
+        }
+        printf("  %-20s %10.3lf ms\n", "total", total);
+        printf("  %-20s %10.0lf\n", "lines_per_second", lines_per_second);
+        printf("  %-20s %10zu\n", "lines", stats->lines_count);
+        printf("  %-20s %10zu\n", "tokens", stats->tokens_count);
+        printf("  %-20s %10zu\n", "bindings", basm->bindings_size);
+        printf("  %-20s %10zu\n", "deferred_operands", stats->deferred_operands_count);
+        printf("  %-20s %10zu of %zu bytes in %zu regions\n", "arena", used, capacity, regions_count);
+        if (peak_rss_kb > 0) {
+            printf("  %-20s %10ld KiB\n", "peak_rss", peak_rss_kb);
+        }
+    }
+    break;
+
+    case TIME_REPORT_TSV: {
+        for (Basm_Phase phase = 0; phase < NUMBER_OF_BASM_PHASES; ++phase) {
+            printf("%s\t%s_ms\t%.3lf\n", input_file_path, basm_phase_name(phase), stats->phase_times[phase]);
+        }
+        printf("%s\ttotal_ms\t%.3lf\n", input_file_path, total);
+        printf("%s\tlines_per_second\t%.0lf\n", input_file_path, lines_per_second);
+        printf("%s\tlines\t%zu\n", input_file_path, stats->lines_count);
+        printf("%s\ttokens\t%zu\n", input_file_path, stats->tokens_count);
+        printf("%s\tbindings\t%zu\n", input_file_path, basm->bindings_size);
+        printf("%s\tdeferred_operands\t%zu\n", input_file_path, stats->deferred_operands_count);
+        printf("%s\tarena_used\t%zu\n", input_file_path, used);
+        printf("%s\tarena_capacity\t%zu\n", input_file_path, capacity);
+        printf("%s\tarena_regions\t%zu\n", input_file_path, regions_count);
+        if (peak_rss_kb > 0) {
+            printf("%s\tpeak_rss_kb\t%ld\n", input_file_path, peak_rss_kb);
+        }
+    }
+    break;
+
+    case TIME_REPORT_NONE:
+    default:
+        assert(false && "print_time_report: unreachable");
         exit(1);
     }
-    const char *output_file_path = shift(&argc, &argv);
 
-    // NOTE: The structure might be quite big due its arena. Better allocate it in the static memory.
-    static Basm basm = {0};
-    basm_translate_source(&basm, sv_from_cstr(input_file_path));
+#ifndef _WIN32
+    funlockfile(stdout);
+#endif // _WIN32
+}
+
+// Reuses the memory of the previous translation. Returns false if the
+// unit has an error. The output of the failed unit is removed, so it's
+// never left half written.
+static bool assemble_unit(Basm *basm, Basm_Include_Cache *include_cache,
+                          const Options *options, Unit unit)
+{
+    Arena arena = basm->arena;
+    arena_clean(&arena);
+    memset(basm, 0, sizeof(*basm));
+    basm->arena = arena;
+
+    jmp_buf error_handler;
+    if (setjmp(error_handler) != 0) {
+        basm_error_handler = NULL;
+        remove(unit.output_file_path);
+        return false;
+    }
+    basm_error_handler = &error_handler;
+
+    basm->include_cache = include_cache;
+    basm->relocatable = options->relocatable;
+    basm->optimize = options->optimize;
+    if (options->profile_file_path != NULL) {
+        basm_load_profile(basm, options->profile_file_path);
+    }
+    basm_translate_source(basm, sv_from_cstr(unit.input_file_path));
 
-    if (!basm.has_entry) {
-        fprintf(stderr, "%s: ERROR: entry point for a BM program is not provided. Use preprocessor directive %%entry to provide the entry point. Examples:\n", input_file_path);
+    if (!options->relocatable && !basm->has_entry) {
+        fprintf(stderr, "%s: ERROR: entry point for a BM program is not provided. Use preprocessor directive %%entry to provide the entry point. Examples:\n", unit.input_file_path);
         fprintf(stderr, "  %%entry main\n");
         fprintf(stderr, "  %%entry 42\n");
+        basm_exit();
+    }
+
+    double start = basm_clock();
+    if (options->optimize) {
+        basm_optimize(basm);
+    }
+    basm->stats.phase_times[BASM_PHASE_OPTIMIZE] += basm_clock() - start;
+
+    start = basm_clock();
+    if (!options->relocatable) {
+        basm_verify_signatures(basm);
+    }
+    basm->stats.phase_times[BASM_PHASE_VERIFY] += basm_clock() - start;
+
+    start = basm_clock();
+    if (options->have_dependencies) {
+        basm_save_dependencies_to_file(basm, unit.output_file_path,
+                                       CSTR_CONCAT(&basm->arena, unit.output_file_path, ".d"));
+    }
+
+    if (options->relocatable) {
+        basm_save_to_object_file(basm, unit.output_file_path);
+    } else {
+        basm_save_to_file(basm, unit.output_file_path);
+    }
+
+    if (options->have_symbol_table) {
+        basm_save_symbols_to_file(basm, CSTR_CONCAT(&basm->arena, unit.output_file_path, ".sym"));
+    }
+    basm->stats.phase_times[BASM_PHASE_SAVE] += basm_clock() - start;
+
+    if (options->time_report != TIME_REPORT_NONE) {
+        print_time_report(basm, options->time_report, unit.input_file_path);
+    }
+
+    basm_error_handler = NULL;
+    return true;
+}
+
+typedef struct {
+    const Options *options;
+    const Units *units;
+    size_t next_unit;
+    // No new units are started after any of them fails
+    bool failed;
+    Basm_Include_Cache include_cache;
+#ifndef _WIN32
+    pthread_mutex_t mutex;
+#endif // _WIN32
+} Batch;
+
+#ifndef _WIN32
+static void batch_lock(void *data)
+{
+    pthread_mutex_lock(data);
+}
+
+static void batch_unlock(void *data)
+{
+    pthread_mutex_unlock(data);
+}
+#endif // _WIN32
+
+static bool batch_next_unit(Batch *batch, Unit *unit, bool failed)
+{
+#ifndef _WIN32
+    pthread_mutex_lock(&batch->mutex);
+#endif // _WIN32
+
+    if (failed) {
+        batch->failed = true;
+    }
+
+    const bool result = !batch->failed && batch->next_unit < batch->units->size;
+    if (result) {
+        *unit = batch->units->items[batch->next_unit++];
+    }
+
+#ifndef _WIN32
+    pthread_mutex_unlock(&batch->mutex);
+#endif // _WIN32
+
+    return result;
+}
+
+// Every worker owns its Basm. Only the include cache is shared.
+static void *batch_worker(void *data)
+{
+    Batch *batch = data;
+    Basm basm = {0};
+
+    Unit unit = {0};
+    bool failed = false;
+    while (batch_next_unit(batch, &unit, failed)) {
+        failed = !assemble_unit(&basm, &batch->include_cache, batch->options, unit);
+    }
+
+    arena_free(&basm.arena);
+    return NULL;
+}
+
+#define JOBS_CAPACITY 256
+
+// Returns false if any of the units failed. The units that are being
+// assembled at the moment of the failure are finished, the rest are not
+// started.
+static bool assemble_batch(const Options *options, const Units *units, size_t jobs)
+{
+    Batch batch = {0};
+    batch.options = options;
+    batch.units = units;
+
+    if (jobs > units->size) {
+        jobs = units->size;
+    }
+
+#ifndef _WIN32
+    pthread_mutex_init(&batch.mutex, NULL);
+    batch.include_cache.lock = batch_lock;
+    batch.include_cache.unlock = batch_unlock;
+    batch.include_cache.lock_data = &batch.mutex;
+
+    if (jobs > 1) {
+        pthread_t threads[JOBS_CAPACITY];
+        size_t threads_size = 0;
+        while (threads_size < jobs) {
+            int error = pthread_create(&threads[threads_size], NULL, batch_worker, &batch);
+            if (error != 0) {
+                fprintf(stderr, "ERROR: could not create a thread: %s\n", strerror(error));
+                pthread_mutex_lock(&batch.mutex);
+                batch.failed = true;
+                pthread_mutex_unlock(&batch.mutex);
+                break;
+            }
+            threads_size += 1;
+        }
+
+        for (size_t i = 0; i < threads_size; ++i) {
+            pthread_join(threads[i], NULL);
+        }
+    } else {
+        batch_worker(&batch);
+    }
+
+    pthread_mutex_destroy(&batch.mutex);
+#else
+    // NOTE: -j is rejected on Windows
+    assert(jobs <= 1);
+    batch_worker(&batch);
+#endif // _WIN32
+
+    arena_free(&batch.include_cache.arena);
+    return !batch.failed;
+}
+
+#ifdef __linux__
+typedef struct {
+    Unit unit;
+    bool dirty;
+
+    // The canonical paths of the input and every file it includes
+    String_View *deps;
+    size_t deps_size;
+    size_t deps_capacity;
+    Arena deps_arena;
+} Watched_Unit;
+
+typedef struct {
+    int wd;
+    String_View dir_path;
+} Watched_Dir;
+
+typedef struct {
+    const Options *options;
+
+    Watched_Unit *units;
+    size_t units_size;
+
+    int inotify_fd;
+    Watched_Dir *dirs;
+    size_t dirs_size;
+    size_t dirs_capacity;
+
+    // Keeps the sources of the files between the rebuilds. Only the
+    // files that have been changed are read again.
+    Basm_Include_Cache include_cache;
+    // Reused by all of the rebuilds
+    Basm basm;
+    Arena arena;
+    Arena scratch;
+} Watch;
+
+static void watch_push_dep(Watched_Unit *unit, String_View dep)
+{
+    unit->deps = arena_da_reserve(&unit->deps_arena, unit->deps,
+                                  sizeof(unit->deps[0]),
+                                  &unit->deps_capacity,
+                                  unit->deps_size + 1);
+    unit->deps[unit->deps_size++] = arena_sv_dup(&unit->deps_arena, dep);
+}
+
+static void watch_dir_of(Watch *watch, String_View file_path)
+{
+    String_View dir_path = file_path;
+    while (dir_path.count > 0 && dir_path.data[dir_path.count - 1] != '/') {
+        dir_path.count -= 1;
+    }
+    if (dir_path.count > 1) {
+        dir_path.count -= 1;
+    }
+
+    const int wd = inotify_add_watch(watch->inotify_fd,
+                                     arena_sv_to_cstr(&watch->scratch, dir_path),
+                                     IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+    if (wd < 0) {
+        fprintf(stderr, "ERROR: could not watch directory `"SV_Fmt"`: %s\n",
+                SV_Arg(dir_path), strerror(errno));
+        exit(1);
+    }
+
+    for (size_t i = 0; i < watch->dirs_size; ++i) {
+        if (watch->dirs[i].wd == wd) {
+            return;
+        }
+    }
+
+    watch->dirs = arena_da_reserve(&watch->arena, watch->dirs,
+                                   sizeof(watch->dirs[0]),
+                                   &watch->dirs_capacity,
+                                   watch->dirs_size + 1);
+    watch->dirs[watch->dirs_size++] = (Watched_Dir) {
+        .wd = wd,
+        .dir_path = arena_sv_dup(&watch->arena, dir_path),
+    };
+}
+
+// The errors in the source don't stop the watch: assemble_unit() catches
+// them. Every rebuild assembles the whole program again. Only the sources
+// of the unchanged files are taken from the cache.
+static void watch_rebuild(Watch *watch, Watched_Unit *unit)
+{
+    const double start = basm_clock();
+    unit->dirty = false;
+
+    Basm *basm = &watch->basm;
+    const bool ok = assemble_unit(basm, &watch->include_cache, watch->options, unit->unit);
+
+    // NOTE: a failed translation stops at the error, so it may not reach
+    // some of the files of the previous one. They are still watched
+    // together with the ones it has read, including the one with the
+    // error.
+    if (ok) {
+        arena_clean(&unit->deps_arena);
+        unit->deps = NULL;
+        unit->deps_size = 0;
+        unit->deps_capacity = 0;
+    }
+
+    for (size_t i = 0; i < basm->included_files_size; ++i) {
+        const String_View dep = basm->included_files[i].canonical_path;
+        bool known = false;
+        for (size_t j = 0; !known && j < unit->deps_size; ++j) {
+            known = sv_eq(unit->deps[j], dep);
+        }
+        if (!known) {
+            watch_push_dep(unit, dep);
+            watch_dir_of(watch, dep);
+        }
+    }
+
+    if (!ok) {
+        fprintf(stderr, "%s: ERROR: could not assemble the program. Waiting for changes...\n",
+                unit->unit.input_file_path);
+        return;
+    }
+
+    printf("%s -> %s (%.3lfms)\n",
+           unit->unit.input_file_path, unit->unit.output_file_path,
+           basm_clock() - start);
+    fflush(stdout);
+}
+
+static void watch_units(const Options *options, const Units *units)
+{
+    Watch watch = {0};
+    watch.options = options;
+
+    watch.inotify_fd = inotify_init();
+    if (watch.inotify_fd < 0) {
+        fprintf(stderr, "ERROR: could not initialize inotify: %s\n", strerror(errno));
         exit(1);
     }
 
-    basm_save_to_file(&basm, output_file_path);
+    watch.units = arena_alloc(&watch.arena, sizeof(watch.units[0]) * units->size);
+    watch.units_size = units->size;
+    for (size_t i = 0; i < units->size; ++i) {
+        Watched_Unit *unit = &watch.units[i];
+        unit->unit = units->items[i];
+
+        char *canonical_path = realpath(unit->unit.input_file_path, NULL);
+        if (canonical_path == NULL) {
+            fprintf(stderr, "ERROR: could not read file `%s`: %s\n",
+                    unit->unit.input_file_path, strerror(errno));
+            exit(1);
+        }
+        watch_push_dep(unit, sv_from_cstr(canonical_path));
+        watch_dir_of(&watch, sv_from_cstr(canonical_path));
+        free(canonical_path);
+
+        watch_rebuild(&watch, unit);
+        arena_clean(&watch.scratch);
+    }
+
+    union {
+        struct inotify_event event;
+        char bytes[4096];
+    } buffer;
+
+    for (;;) {
+        const ssize_t n = read(watch.inotify_fd, buffer.bytes, sizeof(buffer.bytes));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "ERROR: could not read the inotify events: %s\n", strerror(errno));
+            exit(1);
+        }
+
+        // The events of a single save are usually read together, so
+        // every changed unit is rebuilt only once for them
+        for (ssize_t i = 0; i < n; ) {
+            const struct inotify_event *event = (const struct inotify_event *) (buffer.bytes + i);
+            i += (ssize_t) (sizeof(struct inotify_event) + event->len);
+
+            if (event->len == 0) {
+                continue;
+            }
 
-    if (have_symbol_table) {
-        const char *sym_file_name = CSTR_CONCAT(&basm.arena, output_file_path, ".sym");
+            String_View dir_path = SV_NULL;
+            for (size_t j = 0; j < watch.dirs_size; ++j) {
+                if (watch.dirs[j].wd == event->wd) {
+                    dir_path = watch.dirs[j].dir_path;
+                }
+            }
+            const String_View path = sv_from_cstr(
+                                         CSTR_CONCAT(&watch.scratch,
+                                                 arena_sv_to_cstr(&watch.scratch, dir_path),
+                                                 "/", event->name));
 
-        FILE *symbol_file = fopen(sym_file_name, "w");
-        if (!symbol_file) {
-            fprintf(stderr, "ERROR: Unable to open symbol table file\n");
-            return EXIT_FAILURE;
+            for (size_t j = 0; j < watch.units_size; ++j) {
+                Watched_Unit *unit = &watch.units[j];
+                for (size_t k = 0; k < unit->deps_size; ++k) {
+                    if (sv_eq(unit->deps[k], path)) {
+                        basm_include_cache_forget(&watch.include_cache, path);
+                        unit->dirty = true;
+                    }
+                }
+            }
         }
 
-        /*
-         * Note: This will dump out *ALL* symbols, no matter whether
-         * they are jump labels or not. However, since the
-         * preprocessor runs before the jump mark resolution, all the
-         * labels are allocated in a way that enables us to just
-         * overwrite prerocessor labels with a value equal to the
-         * address of a jump label.
-         *
-         */
-        for (size_t i = 0; i < basm.bindings_size; ++i) {
-            fprintf(symbol_file, "%"PRIu64"\t%u\t"SV_Fmt"\n",
-                    basm.bindings[i].value.as_u64,
-                    basm.bindings[i].kind,
-                    SV_Arg(basm.bindings[i].name));
+        for (size_t i = 0; i < watch.units_size; ++i) {
+            if (watch.units[i].dirty) {
+                watch_rebuild(&watch, &watch.units[i]);
+            }
         }
-        fclose(symbol_file);
+
+        arena_clean(&watch.scratch);
     }
+}
+#endif // __linux__
 
-    arena_free(&basm.arena);
+int main(int argc, char **argv)
+{
+    Options options = {0};
+    Arena arena = {0};
+    Units units = {0};
+    size_t jobs = 1;
+    bool watch = false;
+    const char *program = shift(&argc, &argv);
+
+    while (argc > 0 && **argv == '-') {
+        const char *flag = shift(&argc, &argv);
+
+        if (!strcmp(flag, "-g")) {
+            options.have_symbol_table = 1;
+        } else if (!strcmp(flag, "-MD")) {
+            options.have_dependencies = 1;
+        } else if (!strcmp(flag, "-c")) {
+            options.relocatable = 1;
+        } else if (!strcmp(flag, "-O")) {
+            options.optimize = 1;
+        } else if (!strncmp(flag, "-fprofile-use=", strlen("-fprofile-use="))) {
+            options.profile_file_path = flag + strlen("-fprofile-use=");
+            options.optimize = 1;
+        } else if (!strcmp(flag, "-m")) {
+            if (argc == 0) {
+                usage(stderr, program);
+                fprintf(stderr, "ERROR: no value provided for flag `%s`\n", flag);
+                exit(1);
+            }
+            load_manifest(&arena, shift(&argc, &argv), &units);
+        } else if (!strcmp(flag, "-j")) {
+            if (argc == 0) {
+                usage(stderr, program);
+                fprintf(stderr, "ERROR: no value provided for flag `%s`\n", flag);
+                exit(1);
+            }
+            const char *value = shift(&argc, &argv);
+            char *endptr = NULL;
+            const unsigned long value_jobs = strtoul(value, &endptr, 10);
+            if (*value == '\0' || *endptr != '\0' || value_jobs == 0 || value_jobs > JOBS_CAPACITY) {
+                usage(stderr, program);
+                fprintf(stderr, "ERROR: expected the amount of jobs from 1 to %d but got `%s`\n",
+                        JOBS_CAPACITY, value);
+                exit(1);
+            }
+            jobs = (size_t) value_jobs;
+#ifdef _WIN32
+            if (jobs > 1) {
+                usage(stderr, program);
+                fprintf(stderr, "ERROR: parallel jobs are not supported on Windows\n");
+                exit(1);
+            }
+#endif // _WIN32
+        } else if (!strcmp(flag, "-time-report")) {
+            options.time_report = TIME_REPORT_TEXT;
+        } else if (!strcmp(flag, "-time-report=tsv")) {
+            options.time_report = TIME_REPORT_TSV;
+        } else if (!strcmp(flag, "-watch")) {
+#ifdef __linux__
+            watch = true;
+#else
+            usage(stderr, program);
+            fprintf(stderr, "ERROR: flag `%s` is supported only on Linux\n", flag);
+            exit(1);
+#endif // __linux__
+        } else {
+            usage(stderr, program);
+            fprintf(stderr, "ERROR: unknown flag `%s`\n", flag);
+            exit(1);
+        }
+    }
+
+    if (options.have_symbol_table && options.relocatable) {
+        usage(stderr, program);
+        fprintf(stderr, "ERROR: the symbol table of a relocatable object is not final. Pass -g to bmld instead.\n");
+        exit(1);
+    }
+
+    if (options.optimize && options.relocatable) {
+        usage(stderr, program);
+        fprintf(stderr, "ERROR: only complete programs can be optimized\n");
+        exit(1);
+    }
+
+    // The original `<input.basm> <output.bm>` form
+    size_t separator = 0;
+    if (argc == 2 && units.size == 0 &&
+            !find_separator(sv_from_cstr(argv[0]), &separator) &&
+            !find_separator(sv_from_cstr(argv[1]), &separator)) {
+        const Unit unit = {
+            .input_file_path = shift(&argc, &argv),
+            .output_file_path = shift(&argc, &argv),
+        };
+        units_push(&arena, &units, unit);
+    }
+
+    while (argc > 0) {
+        const char *pair = shift(&argc, &argv);
+        Unit unit = {0};
+        if (!parse_unit(&arena, sv_from_cstr(pair), &unit)) {
+            usage(stderr, program);
+            fprintf(stderr, "ERROR: expected `<input.basm>:<output.bm>` but got `%s`\n", pair);
+            exit(1);
+        }
+        units_push(&arena, &units, unit);
+    }
+
+    if (units.size == 0) {
+        usage(stderr, program);
+        fprintf(stderr, "ERROR: expected input\n");
+        exit(1);
+    }
+
+#ifdef __linux__
+    if (watch) {
+        watch_units(&options, &units);
+    }
+#endif // __linux__
+
+    const bool ok = assemble_batch(&options, &units, jobs);
+
+    arena_free(&arena);
 
-    return 0;
+    return ok ? 0 : 1;
 }
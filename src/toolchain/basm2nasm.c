@@ -38,8 +38,7 @@ int main(int argc, char *argv[])
     const char *output_file_path = shift(&argc, &argv);
 
 
-    // NOTE: The structure might be quite big due its arena. Better allocate it in the static memory.
-    static Basm basm = {0};
+    Basm basm = {0};
     basm_translate_source(&basm, sv_from_cstr(input_file_path));
 
     FILE *output = fopen(output_file_path, "wb");
@@ -66,7 +65,7 @@ int main(int argc, char *argv[])
             fprintf(output, "_start:\n");
         }
 
-        for (size_t j = 0; j < BASM_BINDINGS_CAPACITY; ++j) {
+        for (size_t j = 0; j < basm.bindings_size; ++j) {
             if (basm.bindings[j].kind != BINDING_LABEL) continue;
 
             if (basm.bindings[j].value.as_u64 == i) {
@@ -0,0 +1,232 @@
+#define BM_IMPLEMENTATION
+#include "./bm.h"
+
+// NOTE: the memory of the generated program must fit into
+// BM_MEMORY_CAPACITY, so -lines doesn't scale the strings and the
+// tables beyond these
+#define BASMGEN_MAX_STRINGS (32 * 1024)
+#define BASMGEN_MAX_TABLES 256
+#define BASMGEN_TABLE_SIZE 64
+// The length of the chains of the consts that refer to the next const
+#define BASMGEN_CONST_CHAIN 16
+
+typedef struct {
+    size_t labels;
+    size_t consts;
+    size_t strings;
+    size_t tables;
+    size_t depth;
+} Workload;
+
+static char *shift(int *argc, char ***argv)
+{
+    assert(*argc > 0);
+    char *result = **argv;
+    *argv += 1;
+    *argc -= 1;
+    return result;
+}
+
+static void usage(FILE *stream, const char *program)
+{
+    fprintf(stream, "Usage: %s [OPTIONS] <output-dir>\n", program);
+    fprintf(stream, "Generates a synthetic program <output-dir>/main.basm to benchmark basm\n");
+    fprintf(stream, "OPTIONS:\n");
+    fprintf(stream, "    -lines <count>     pick the rest of the options to get about that many lines\n");
+    fprintf(stream, "    -labels <count>    the amount of labels, every one of them with a forward reference\n");
+    fprintf(stream, "    -consts <count>    the amount of %%const bindings that refer to each other\n");
+    fprintf(stream, "    -strings <count>   the amount of string literals\n");
+    fprintf(stream, "    -tables <count>    the amount of %%table lookup tables\n");
+    fprintf(stream, "    -depth <count>     the depth of the binary tree of %%include files\n");
+}
+
+static size_t parse_count(const char *program, const char *flag, int *argc, char ***argv)
+{
+    if (*argc == 0) {
+        usage(stderr, program);
+        fprintf(stderr, "ERROR: no value provided for flag `%s`\n", flag);
+        exit(1);
+    }
+
+    const char *value = shift(argc, argv);
+    char *endptr = NULL;
+    const unsigned long long count = strtoull(value, &endptr, 10);
+    if (*value == '\0' || *endptr != '\0') {
+        usage(stderr, program);
+        fprintf(stderr, "ERROR: expected a number for flag `%s` but got `%s`\n", flag, value);
+        exit(1);
+    }
+
+    return (size_t) count;
+}
+
+static FILE *open_output(const char *file_path)
+{
+    FILE *f = fopen(file_path, "w");
+    if (f == NULL) {
+        fprintf(stderr, "ERROR: could not open file `%s`: %s\n",
+                file_path, strerror(errno));
+        exit(1);
+    }
+    return f;
+}
+
+// Defines the consts and the strings from first with the step. The consts
+// refer to the ones defined later, so their evaluation is deferred.
+static void generate_bindings(FILE *f, const Workload *workload, size_t first, size_t step)
+{
+    for (size_t i = first; i < workload->consts; i += step) {
+        if ((i + 1) % BASMGEN_CONST_CHAIN != 0 && i + 1 < workload->consts) {
+            fprintf(f, "%%const C_%zu C_%zu + %zu\n", i, i + 1, i);
+        } else {
+            fprintf(f, "%%const C_%zu %zu\n", i, i);
+        }
+    }
+
+    for (size_t i = first; i < workload->strings; i += step) {
+        fprintf(f, "%%const S_%zu \"s%zu\"\n", i, i);
+    }
+}
+
+// The include files form a binary tree numbered like a heap. Every
+// binding i is defined in the file i % files_count.
+static void generate_include(const Workload *workload, const char *output_dir,
+                             size_t file, size_t files_count)
+{
+    char file_path[4096];
+    snprintf(file_path, sizeof(file_path), "%s/inc_%zu.hasm", output_dir, file);
+    FILE *f = open_output(file_path);
+
+    fprintf(f, "%%pragma once\n");
+    for (size_t child = 2 * file + 1; child <= 2 * file + 2 && child < files_count; ++child) {
+        fprintf(f, "%%include \"%s/inc_%zu.hasm\"\n", output_dir, child);
+    }
+
+    generate_bindings(f, workload, file, files_count);
+
+    fclose(f);
+}
+
+static void generate_main(const Workload *workload, const char *output_dir, size_t files_count)
+{
+    char file_path[4096];
+    snprintf(file_path, sizeof(file_path), "%s/main.basm", output_dir);
+    FILE *f = open_output(file_path);
+
+    fprintf(f, ";; Generated by basmgen: %zu labels, %zu consts, %zu strings, %zu tables, include depth %zu\n",
+            workload->labels, workload->consts, workload->strings, workload->tables, workload->depth);
+    if (files_count > 0) {
+        fprintf(f, "%%include \"%s/inc_0.hasm\"\n", output_dir);
+    } else {
+        generate_bindings(f, workload, 0, 1);
+    }
+    fprintf(f, "%%entry main\n\n");
+
+    for (size_t i = 0; i < workload->tables; ++i) {
+        if (workload->consts > 0) {
+            fprintf(f, "%%table T_%zu u64 %d i * C_%zu\n", i, BASMGEN_TABLE_SIZE, i % workload->consts);
+        } else {
+            fprintf(f, "%%table T_%zu u64 %d i * %zu\n", i, BASMGEN_TABLE_SIZE, i);
+        }
+    }
+
+    fprintf(f, "\nmain:\n");
+    for (size_t i = 0; i < workload->labels; ++i) {
+        fprintf(f, "L_%zu:\n", i);
+        if (workload->consts > 0) {
+            fprintf(f, "    push C_%zu\n", i % workload->consts);
+        } else {
+            fprintf(f, "    push %zu\n", i);
+        }
+        // NOTE: the labels ahead are deferred operands
+        fprintf(f, "    push L_%zu\n", (i + 1) % workload->labels);
+        fprintf(f, "    plusi\n");
+        fprintf(f, "    drop\n");
+
+        if (workload->strings > 0 && i % 8 == 0) {
+            fprintf(f, "    push S_%zu\n", (i / 8) % workload->strings);
+            fprintf(f, "    drop\n");
+        }
+
+        if (workload->tables > 0 && i % 16 == 0) {
+            fprintf(f, "    push T_%zu\n", (i / 16) % workload->tables);
+            fprintf(f, "    drop\n");
+        }
+    }
+    fprintf(f, "    halt\n");
+
+    fclose(f);
+}
+
+int main(int argc, char **argv)
+{
+    Workload workload = {
+        .labels = 1000,
+        .consts = 1000,
+        .strings = 100,
+        .tables = 10,
+        .depth = 4,
+    };
+
+    const char *program = shift(&argc, &argv);
+
+    while (argc > 0 && **argv == '-') {
+        const char *flag = shift(&argc, &argv);
+
+        if (!strcmp(flag, "-lines")) {
+            const size_t lines = parse_count(program, flag, &argc, &argv);
+            // NOTE: a label takes about 5.4 lines, the rest take one
+            workload.labels = lines * 12 / 100;
+            workload.consts = lines * 3 / 10;
+            workload.strings = lines / 20;
+            if (workload.strings > BASMGEN_MAX_STRINGS) {
+                workload.strings = BASMGEN_MAX_STRINGS;
+            }
+            workload.tables = lines / 1000;
+            if (workload.tables > BASMGEN_MAX_TABLES) {
+                workload.tables = BASMGEN_MAX_TABLES;
+            }
+        } else if (!strcmp(flag, "-labels")) {
+            workload.labels = parse_count(program, flag, &argc, &argv);
+        } else if (!strcmp(flag, "-consts")) {
+            workload.consts = parse_count(program, flag, &argc, &argv);
+        } else if (!strcmp(flag, "-strings")) {
+            workload.strings = parse_count(program, flag, &argc, &argv);
+        } else if (!strcmp(flag, "-tables")) {
+            workload.tables = parse_count(program, flag, &argc, &argv);
+        } else if (!strcmp(flag, "-depth")) {
+            workload.depth = parse_count(program, flag, &argc, &argv);
+        } else {
+            usage(stderr, program);
+            fprintf(stderr, "ERROR: unknown flag `%s`\n", flag);
+            exit(1);
+        }
+    }
+
+    if (argc == 0) {
+        usage(stderr, program);
+        fprintf(stderr, "ERROR: expected output directory\n");
+        exit(1);
+    }
+    const char *output_dir = shift(&argc, &argv);
+
+    if (workload.labels == 0) {
+        usage(stderr, program);
+        fprintf(stderr, "ERROR: the program needs at least one label\n");
+        exit(1);
+    }
+
+    if (workload.depth >= 16) {
+        usage(stderr, program);
+        fprintf(stderr, "ERROR: the depth of the includes is limited to 15\n");
+        exit(1);
+    }
+
+    const size_t files_count = ((size_t) 1 << workload.depth) - 1;
+    for (size_t file = 0; file < files_count; ++file) {
+        generate_include(&workload, output_dir, file, files_count);
+    }
+    generate_main(&workload, output_dir, files_count);
+
+    return 0;
+}
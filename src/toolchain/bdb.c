@@ -63,6 +63,11 @@ Bdb_Err bdb_load_symtab(Bdb_State *state, const char *program_file_path)
         Word         value        = word_u64(sv_to_u64(raw_addr));
         Binding_Kind kind         = (Binding_Kind)sv_to_u64(raw_sym_type);
 
+        state->bindings = arena_da_reserve(&state->sym_arena, state->bindings,
+                                           sizeof(state->bindings[0]),
+                                           &state->bindings_capacity,
+                                           state->bindings_size + 1);
+
         state->bindings[state->bindings_size].name = name;
         state->bindings[state->bindings_size].value = value;
         state->bindings[state->bindings_size].kind = kind;
@@ -303,7 +308,9 @@ Bdb_Err bdb_reset(Bdb_State *state)
     bm_load_standard_natives(&state->bm);
 
     arena_clean(&state->sym_arena);
+    state->bindings = NULL;
     state->bindings_size = 0;
+    state->bindings_capacity = 0;
     state->is_in_step_over_mode = 0;
     state->step_over_mode_call_depth = 0;
 
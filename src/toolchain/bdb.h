@@ -41,8 +41,10 @@ typedef struct Bdb_State {
     Bdb_Breakpoint breakpoints[BDB_BREAKPOINTS_CAPACITY];
     size_t breakpoints_size;
 
-    Bdb_Binding bindings[BASM_BINDINGS_CAPACITY];
+    // Lives in sym_arena
+    Bdb_Binding *bindings;
     size_t bindings_size;
+    size_t bindings_capacity;
 
     int is_in_step_over_mode;
     unsigned int step_over_mode_call_depth;
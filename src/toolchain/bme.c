@@ -1,5 +1,6 @@
 #define BM_IMPLEMENTATION
 #include "./bm.h"
+#include "./basm.h"
 
 static char *shift(int *argc, char ***argv)
 {
@@ -12,7 +13,67 @@ static char *shift(int *argc, char ***argv)
 
 static void usage(FILE *stream, const char *program)
 {
-    fprintf(stream, "Usage: %s -i <input.bm> [-l <limit>] [-h]\n", program);
+    fprintf(stream, "Usage: %s -i <input.bm> [-l <limit>] [-prof <profile.txt>] [-h]\n", program);
+}
+
+static uint64_t counts[BM_PROGRAM_CAPACITY];
+
+static Err execute_program_with_profile(Bm *bm, int limit)
+{
+    while (limit != 0 && !bm->halt) {
+        if (bm->ip < BM_PROGRAM_CAPACITY) {
+            counts[bm->ip] += 1;
+        }
+
+        Err err = bm_execute_inst(bm);
+        if (err != ERR_OK) {
+            return err;
+        }
+        if (limit > 0) {
+            --limit;
+        }
+    }
+
+    return ERR_OK;
+}
+
+// Writes how many times the instruction every label of the symbol table
+// <input.bm>.sym points to was executed
+static void save_profile(const char *input_file_path, const char *profile_file_path)
+{
+    Arena arena = {0};
+
+    String_View symtab_file_path = sv_from_cstr(CSTR_CONCAT(&arena, input_file_path, ".sym"));
+    String_View symtab = {0};
+    if (arena_slurp_file(&arena, symtab_file_path, &symtab) < 0) {
+        fprintf(stderr, "ERROR: could not read file "SV_Fmt": %s. Assemble the program with -g to profile it.\n",
+                SV_Arg(symtab_file_path), strerror(errno));
+        exit(1);
+    }
+
+    FILE *f = fopen(profile_file_path, "wb");
+    if (f == NULL) {
+        fprintf(stderr, "ERROR: could not open file %s: %s\n",
+                profile_file_path, strerror(errno));
+        exit(1);
+    }
+
+    while (symtab.count > 0) {
+        symtab = sv_trim_left(symtab);
+        String_View raw_addr = sv_chop_by_delim(&symtab, '\t');
+        symtab = sv_trim_left(symtab);
+        String_View raw_kind = sv_chop_by_delim(&symtab, '\t');
+        symtab = sv_trim_left(symtab);
+        String_View name = sv_chop_by_delim(&symtab, '\n');
+
+        const uint64_t addr = sv_to_u64(raw_addr);
+        if ((Binding_Kind) sv_to_u64(raw_kind) == BINDING_LABEL && addr < BM_PROGRAM_CAPACITY) {
+            fprintf(f, "%"PRIu64"\t"SV_Fmt"\n", counts[addr], SV_Arg(name));
+        }
+    }
+
+    fclose(f);
+    arena_free(&arena);
 }
 
 int main(int argc, char **argv)
@@ -23,6 +84,7 @@ int main(int argc, char **argv)
     const char *program = shift(&argc, &argv);
     const char *input_file_path = NULL;
     int limit = -1;
+    const char *profile_file_path = NULL;
 
     while (argc > 0) {
         const char *flag = shift(&argc, &argv);
@@ -43,6 +105,14 @@ int main(int argc, char **argv)
             }
 
             limit = atoi(shift(&argc, &argv));
+        } else if (strcmp(flag, "-prof") == 0) {
+            if (argc == 0) {
+                usage(stderr, program);
+                fprintf(stderr, "ERROR: No argument is provided for flag `%s`\n", flag);
+                exit(1);
+            }
+
+            profile_file_path = shift(&argc, &argv);
         } else if (strcmp(flag, "-h") == 0) {
             usage(stdout, program);
             exit(0);
@@ -62,7 +132,13 @@ int main(int argc, char **argv)
     bm_load_program_from_file(&bm, input_file_path);
     bm_load_standard_natives(&bm);
 
-    Err err = bm_execute_program(&bm, limit);
+    Err err = ERR_OK;
+    if (profile_file_path != NULL) {
+        err = execute_program_with_profile(&bm, limit);
+        save_profile(input_file_path, profile_file_path);
+    } else {
+        err = bm_execute_program(&bm, limit);
+    }
 
     if (err != ERR_OK) {
         fprintf(stderr, "ERROR: %s\n", err_as_cstr(err));
@@ -0,0 +1,108 @@
+#define BM_IMPLEMENTATION
+#include "./basm.h"
+#include "./bm.h"
+
+static char *shift(int *argc, char ***argv)
+{
+    assert(*argc > 0);
+    char *result = **argv;
+    *argv += 1;
+    *argc -= 1;
+    return result;
+}
+
+static void usage(FILE *stream, const char *program)
+{
+    fprintf(stream, "Usage: %s [-g] [-shared] [-m <module.bm>]... -o <output.bm> <input.bo>...\n", program);
+    fprintf(stream, "    -g         generate the symbol table <output.bm>.sym\n");
+    fprintf(stream, "    -shared    link a shared module that programs load at runtime\n");
+    fprintf(stream, "    -m         import the functions the objects do not define from the shared module\n");
+}
+
+int main(int argc, char **argv)
+{
+    int have_symbol_table = 0;
+    int shared = 0;
+    const char *modules[BM_MODULES_CAPACITY];
+    size_t modules_size = 0;
+    const char *output_file_path = NULL;
+    const char *program = shift(&argc, &argv);
+
+    while (argc > 0 && **argv == '-') {
+        const char *flag = shift(&argc, &argv);
+
+        if (!strcmp(flag, "-g")) {
+            have_symbol_table = 1;
+        } else if (!strcmp(flag, "-shared")) {
+            shared = 1;
+        } else if (!strcmp(flag, "-m")) {
+            if (argc == 0) {
+                usage(stderr, program);
+                fprintf(stderr, "ERROR: no value provided for flag `%s`\n", flag);
+                exit(1);
+            }
+            if (modules_size >= BM_MODULES_CAPACITY) {
+                fprintf(stderr, "ERROR: too many modules. The capacity is %d\n", BM_MODULES_CAPACITY);
+                exit(1);
+            }
+            modules[modules_size++] = shift(&argc, &argv);
+        } else if (!strcmp(flag, "-o")) {
+            if (argc == 0) {
+                usage(stderr, program);
+                fprintf(stderr, "ERROR: no value provided for flag `%s`\n", flag);
+                exit(1);
+            }
+            output_file_path = shift(&argc, &argv);
+        } else {
+            usage(stderr, program);
+            fprintf(stderr, "ERROR: unknown flag `%s`\n", flag);
+            exit(1);
+        }
+    }
+
+    if (shared && modules_size > 0) {
+        usage(stderr, program);
+        fprintf(stderr, "ERROR: a shared module can't import from other modules\n");
+        exit(1);
+    }
+
+    if (output_file_path == NULL) {
+        usage(stderr, program);
+        fprintf(stderr, "ERROR: expected output\n");
+        exit(1);
+    }
+
+    if (argc == 0) {
+        usage(stderr, program);
+        fprintf(stderr, "ERROR: expected input\n");
+        exit(1);
+    }
+
+    Basm basm = {0};
+    basm.shared = shared;
+
+    while (argc > 0) {
+        basm_link_object_file(&basm, shift(&argc, &argv));
+    }
+
+    for (size_t i = 0; i < modules_size; ++i) {
+        basm_link_module(&basm, modules[i]);
+    }
+
+    basm_resolve_deferred_operands(&basm);
+
+    if (!basm.has_entry && !shared) {
+        fprintf(stderr, "ERROR: none of the linked objects provides the entry point. Use preprocessor directive %%entry to provide the entry point.\n");
+        exit(1);
+    }
+
+    basm_save_to_file(&basm, output_file_path);
+
+    if (have_symbol_table) {
+        basm_save_symbols_to_file(&basm, CSTR_CONCAT(&basm.arena, output_file_path, ".sym"));
+    }
+
+    arena_free(&basm.arena);
+
+    return 0;
+}